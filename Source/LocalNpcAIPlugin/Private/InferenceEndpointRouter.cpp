@@ -0,0 +1,166 @@
+#include "InferenceEndpointRouter.h"
+#include "InferenceHealthMonitor.h"
+
+FInferenceEndpointRouter& FInferenceEndpointRouter::Get()
+{
+    static FInferenceEndpointRouter Instance;
+    return Instance;
+}
+
+FInferenceEndpointLoad* FInferenceEndpointRouter::Find(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint)
+{
+    return Servers.FindByPredicate([Backend, &Endpoint](const FInferenceEndpointLoad& Server) { return Server.Backend == Backend && Server.Endpoint == Endpoint; });
+}
+
+FInferenceEndpointLoad& FInferenceEndpointRouter::FindOrAdd(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint)
+{
+    if (FInferenceEndpointLoad* Existing = Find(Backend, Endpoint))
+    {
+        return *Existing;
+    }
+
+    FInferenceEndpointLoad& Server = Servers.AddDefaulted_GetRef();
+    Server.Backend = Backend;
+    Server.Endpoint = Endpoint;
+    return Server;
+}
+
+FInferenceEndpointLeasePtr FInferenceEndpointRouter::Acquire(EInferenceBackend Backend, TConstArrayView<FInferenceEndpoint> Endpoints, const FString& AffinityKey)
+{
+    FInferenceHealthMonitor& HealthMonitor = FInferenceHealthMonitor::Get();
+    FScopeLock ScopeLock(&Lock);
+
+    // Added first, so adding servers cannot move the ones already collected.
+    for (const FInferenceEndpoint& Endpoint : Endpoints)
+    {
+        FindOrAdd(Backend, Endpoint);
+        HealthMonitor.RegisterEndpoint(Backend, Endpoint);
+    }
+
+    TArray<FInferenceEndpointLoad*, TInlineAllocator<8>> Candidates;
+    for (const FInferenceEndpoint& Endpoint : Endpoints)
+    {
+        Candidates.AddUnique(Find(Backend, Endpoint));
+    }
+    if (Candidates.IsEmpty())
+    {
+        return nullptr;
+    }
+
+    // Least outstanding first, the faster server breaks ties.
+    Candidates.Sort([](const FInferenceEndpointLoad& A, const FInferenceEndpointLoad& B)
+        {
+            return A.Outstanding != B.Outstanding ? A.Outstanding < B.Outstanding : A.AverageLatencyMs < B.AverageLatencyMs;
+        });
+
+    const TPair<EInferenceBackend, FString> Key(Backend, AffinityKey);
+    const FInferenceEndpoint* Bound = AffinityKey.IsEmpty() ? nullptr : Affinity.Find(Key);
+    if (Bound)
+    {
+        const int32 BoundIndex = Candidates.IndexOfByPredicate([Bound](const FInferenceEndpointLoad* Server) { return Server->Endpoint == *Bound; });
+        if (BoundIndex > 0 && Candidates[BoundIndex]->Outstanding <= Candidates[0]->Outstanding + MaxStickyImbalance)
+        {
+            FInferenceEndpointLoad* BoundServer = Candidates[BoundIndex];
+            Candidates.RemoveAt(BoundIndex);
+            Candidates.Insert(BoundServer, 0);
+        }
+    }
+
+    for (FInferenceEndpointLoad* Server : Candidates)
+    {
+        if (!HealthMonitor.AllowRequest(Backend, Server->Endpoint))
+        {
+            continue;
+        }
+
+        Server->Outstanding++;
+        Server->Requests++;
+
+        if (!AffinityKey.IsEmpty() && !(Bound && *Bound == Server->Endpoint))
+        {
+            if (Bound)
+            {
+                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Router] Moving %s from %s to %s"), *AffinityKey, *Bound->ToString(), *Server->Endpoint.ToString());
+                if (FInferenceEndpointLoad* Previous = Find(Backend, *Bound))
+                {
+                    Previous->BoundNpcs--;
+                }
+            }
+            Server->BoundNpcs++;
+            Affinity.Add(Key, Server->Endpoint);
+        }
+
+        return MakeShared<FInferenceEndpointLease, ESPMode::ThreadSafe>(Backend, Server->Endpoint);
+    }
+
+    return nullptr;
+}
+
+void FInferenceEndpointLease::Release()
+{
+    if (!bReleased.exchange(true))
+    {
+        FInferenceEndpointRouter::Get().Release(Backend, Endpoint, (FPlatformTime::Seconds() - StartTime) * 1000.0);
+    }
+}
+
+void FInferenceEndpointRouter::Release(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint, double LatencyMs)
+{
+    FScopeLock ScopeLock(&Lock);
+    if (FInferenceEndpointLoad* Server = Find(Backend, Endpoint))
+    {
+        Server->Outstanding = FMath::Max(0, Server->Outstanding - 1);
+        Server->AverageLatencyMs = Server->AverageLatencyMs > 0.0f ? FMath::Lerp(Server->AverageLatencyMs, static_cast<float>(LatencyMs), 0.2f) : LatencyMs;
+    }
+}
+
+bool FInferenceEndpointRouter::HasAvailable(EInferenceBackend Backend, TConstArrayView<FInferenceEndpoint> Endpoints) const
+{
+    const FInferenceHealthMonitor& HealthMonitor = FInferenceHealthMonitor::Get();
+    for (const FInferenceEndpoint& Endpoint : Endpoints)
+    {
+        if (HealthMonitor.IsAvailable(Backend, Endpoint))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FInferenceEndpointRouter::Unbind(EInferenceBackend Backend, const FString& AffinityKey)
+{
+    FScopeLock ScopeLock(&Lock);
+    FInferenceEndpoint Bound;
+    if (Affinity.RemoveAndCopyValue(TPair<EInferenceBackend, FString>(Backend, AffinityKey), Bound))
+    {
+        if (FInferenceEndpointLoad* Server = Find(Backend, Bound))
+        {
+            Server->BoundNpcs--;
+        }
+    }
+}
+
+void FInferenceEndpointRouter::SetMaxStickyImbalance(int32 InMaxStickyImbalance)
+{
+    FScopeLock ScopeLock(&Lock);
+    MaxStickyImbalance = FMath::Max(0, InMaxStickyImbalance);
+}
+
+TArray<FInferenceEndpointLoad> FInferenceEndpointRouter::GetLoad() const
+{
+    FScopeLock ScopeLock(&Lock);
+    return Servers;
+}
+
+TArray<FInferenceEndpoint> FInferenceEndpointRouter::ResolveEndpoints(const TArray<FInferenceEndpoint>& Endpoints, int32 DefaultPort, const FString& DefaultHost)
+{
+    if (!Endpoints.IsEmpty())
+    {
+        return Endpoints;
+    }
+
+    FInferenceEndpoint Local;
+    Local.Host = DefaultHost;
+    Local.Port = DefaultPort;
+    return { Local };
+}
@@ -0,0 +1,297 @@
+#include "InferenceHealthMonitor.h"
+#include "HttpModule.h"
+#include "Interfaces/IHttpRequest.h"
+#include "Interfaces/IHttpResponse.h"
+
+namespace
+{
+    constexpr int32 OutcomeWindow = 32;
+    constexpr double MaxCooldownSeconds = 60.0;
+}
+
+FInferenceHealthMonitor& FInferenceHealthMonitor::Get()
+{
+    static FInferenceHealthMonitor Instance;
+    return Instance;
+}
+
+FInferenceHealthMonitor::FServerState* FInferenceHealthMonitor::Find(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint)
+{
+    return Servers.FindByPredicate([Backend, &Endpoint](const FServerState& Server) { return Server.Health.Backend == Backend && Server.Health.Endpoint == Endpoint; });
+}
+
+const FInferenceHealthMonitor::FServerState* FInferenceHealthMonitor::Find(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint) const
+{
+    return Servers.FindByPredicate([Backend, &Endpoint](const FServerState& Server) { return Server.Health.Backend == Backend && Server.Health.Endpoint == Endpoint; });
+}
+
+FInferenceHealthMonitor::FServerState& FInferenceHealthMonitor::FindOrAdd(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint)
+{
+    if (FServerState* Existing = Find(Backend, Endpoint))
+    {
+        return *Existing;
+    }
+
+    FServerState& Server = Servers.AddDefaulted_GetRef();
+    Server.Health.Backend = Backend;
+    Server.Health.Endpoint = Endpoint;
+    Server.Cooldown = CooldownSeconds;
+    return Server;
+}
+
+void FInferenceHealthMonitor::RegisterEndpoint(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint)
+{
+    FScopeLock ScopeLock(&Lock);
+    FindOrAdd(Backend, Endpoint);
+}
+
+bool FInferenceHealthMonitor::AllowRequest(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint)
+{
+    FScopeLock ScopeLock(&Lock);
+    FServerState& Server = FindOrAdd(Backend, Endpoint);
+    if (Server.Health.State == EInferenceCircuitState::Closed)
+    {
+        return true;
+    }
+
+    // A trial whose outcome was never reported (e.g. a cancelled request) must not block the server forever.
+    const double Now = FPlatformTime::Seconds();
+    const bool bTrialDue = Server.Health.State == EInferenceCircuitState::Open ? Now >= Server.OpenUntil : Now - Server.TrialStart >= Server.Cooldown;
+    if (!bTrialDue)
+    {
+        return false;
+    }
+
+    Server.Health.State = EInferenceCircuitState::HalfOpen;
+    Server.TrialStart = Now;
+    return true;
+}
+
+bool FInferenceHealthMonitor::IsAvailable(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint) const
+{
+    FScopeLock ScopeLock(&Lock);
+    const FServerState* Server = Find(Backend, Endpoint);
+    return !Server || Server->Health.State != EInferenceCircuitState::Open;
+}
+
+void FInferenceHealthMonitor::RecordOutcome(FServerState& Server, bool bFailed)
+{
+    Server.FailureBits = (Server.FailureBits << 1) | (bFailed ? 1u : 0u);
+    Server.NumOutcomes = FMath::Min(Server.NumOutcomes + 1, OutcomeWindow);
+    Server.Health.ErrorRate = static_cast<float>(FMath::CountBits(Server.FailureBits)) / Server.NumOutcomes;
+}
+
+void FInferenceHealthMonitor::ReportSuccess(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint, double LatencyMs)
+{
+    FScopeLock ScopeLock(&Lock);
+    FServerState* Server = Find(Backend, Endpoint);
+    if (!Server)
+    {
+        return;
+    }
+
+    RecordOutcome(*Server, false);
+    Server->Health.ConsecutiveFailures = 0;
+    Server->Health.AverageLatencyMs = Server->Health.AverageLatencyMs > 0.0f ? FMath::Lerp(Server->Health.AverageLatencyMs, static_cast<float>(LatencyMs), 0.2f) : LatencyMs;
+
+    if (Server->Health.State != EInferenceCircuitState::Closed)
+    {
+        CloseCircuit(*Server);
+    }
+}
+
+void FInferenceHealthMonitor::ReportFailure(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint)
+{
+    FScopeLock ScopeLock(&Lock);
+    FServerState* Server = Find(Backend, Endpoint);
+    if (!Server)
+    {
+        return;
+    }
+
+    RecordOutcome(*Server, true);
+    Server->Health.ConsecutiveFailures++;
+
+    const double Now = FPlatformTime::Seconds();
+    if (Server->Health.State == EInferenceCircuitState::HalfOpen)
+    {
+        Server->Cooldown = FMath::Min(Server->Cooldown * 2.0, MaxCooldownSeconds);
+        OpenCircuit(*Server, Now, TEXT("trial request failed"));
+    }
+    else if (Server->Health.State == EInferenceCircuitState::Closed
+        && (Server->Health.ConsecutiveFailures >= FailureThreshold || (Server->NumOutcomes >= OutcomeWindow / 2 && Server->Health.ErrorRate >= 0.5f)))
+    {
+        OpenCircuit(*Server, Now, TEXT("requests are failing"));
+    }
+}
+
+void FInferenceHealthMonitor::OpenCircuit(FServerState& Server, double Now, const TCHAR* Reason)
+{
+    if (Server.Health.State != EInferenceCircuitState::Open)
+    {
+        Server.Health.TimesOpened++;
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Health] %s at %s is unavailable (%s), failing fast for %.1f s"),
+            *UEnum::GetValueAsString(Server.Health.Backend), *Server.Health.Endpoint.ToString(), Reason, Server.Cooldown);
+    }
+    Server.Health.State = EInferenceCircuitState::Open;
+    Server.OpenUntil = Now + Server.Cooldown;
+}
+
+void FInferenceHealthMonitor::CloseCircuit(FServerState& Server)
+{
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Health] %s at %s is available again"), *UEnum::GetValueAsString(Server.Health.Backend), *Server.Health.Endpoint.ToString());
+
+    Server.Health.State = EInferenceCircuitState::Closed;
+    Server.Health.ConsecutiveFailures = 0;
+    Server.Cooldown = CooldownSeconds;
+}
+
+void FInferenceHealthMonitor::Poll(double IntervalSeconds, double TimeoutSeconds)
+{
+    TArray<TPair<EInferenceBackend, FInferenceEndpoint>> Due;
+    {
+        FScopeLock ScopeLock(&Lock);
+        const double Now = FPlatformTime::Seconds();
+        for (FServerState& Server : Servers)
+        {
+            if (!Server.bPollInFlight && Now - Server.LastPollTime >= IntervalSeconds)
+            {
+                Server.bPollInFlight = true;
+                Server.LastPollTime = Now;
+                Due.Emplace(Server.Health.Backend, Server.Health.Endpoint);
+            }
+        }
+    }
+
+    for (const TPair<EInferenceBackend, FInferenceEndpoint>& Target : Due)
+    {
+        TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
+        Request->SetURL(FString::Printf(TEXT("http://%s/health"), *Target.Value.ToString()));
+        Request->SetVerb("GET");
+        Request->SetTimeout(TimeoutSeconds);
+
+        // llama-server answers 503 while it is still loading the model. Servers without a /health route (404) are up.
+        Request->OnProcessRequestComplete().BindLambda([Backend = Target.Key, Endpoint = Target.Value](FHttpRequestPtr Req, FHttpResponsePtr Response, bool bWasSuccessful)
+            {
+                const bool bHealthy = bWasSuccessful && Response.IsValid() && Response->GetResponseCode() > 0 && Response->GetResponseCode() < 500;
+                FInferenceHealthMonitor::Get().HandlePollResult(Backend, Endpoint, bHealthy);
+            });
+        Request->ProcessRequest();
+    }
+}
+
+void FInferenceHealthMonitor::HandlePollResult(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint, bool bHealthy)
+{
+    FScopeLock ScopeLock(&Lock);
+    FServerState* Server = Find(Backend, Endpoint);
+    if (!Server)
+    {
+        return;
+    }
+
+    Server->bPollInFlight = false;
+    Server->Health.bReachable = bHealthy;
+
+    if (bHealthy && Server->Health.State != EInferenceCircuitState::Closed)
+    {
+        CloseCircuit(*Server);
+    }
+    else if (!bHealthy)
+    {
+        OpenCircuit(*Server, FPlatformTime::Seconds(), TEXT("health check failed"));
+    }
+}
+
+void FInferenceHealthMonitor::Configure(int32 InFailureThreshold, double InCooldownSeconds)
+{
+    FScopeLock ScopeLock(&Lock);
+    FailureThreshold = FMath::Max(1, InFailureThreshold);
+    CooldownSeconds = FMath::Max(0.1, InCooldownSeconds);
+}
+
+TArray<FInferenceEndpointHealth> FInferenceHealthMonitor::GetHealth() const
+{
+    FScopeLock ScopeLock(&Lock);
+    TArray<FInferenceEndpointHealth> Health;
+    for (const FServerState& Server : Servers)
+    {
+        Health.Add(Server.Health);
+    }
+    return Health;
+}
+
+void UInferenceHealthSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+    Super::Initialize(Collection);
+
+    FInferenceHealthMonitor::Get().Configure(FailureThreshold, CircuitCooldownSeconds);
+    FInferenceEndpointRouter::Get().SetMaxStickyImbalance(MaxStickyImbalance);
+    FInferenceHedging::Get().SetMaxHedgeRate(MaxHedgeRate);
+    TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UInferenceHealthSubsystem::Tick), 0.1f);
+}
+
+void UInferenceHealthSubsystem::Deinitialize()
+{
+    FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+
+    for (const FInferenceEndpointHealth& Health : GetAllEndpointHealth())
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Health] %s at %s: circuit opened %d times, error rate %.0f%%, average latency %.2f ms"),
+            *UEnum::GetValueAsString(Health.Backend), *Health.Endpoint.ToString(), Health.TimesOpened, 100.0f * Health.ErrorRate, Health.AverageLatencyMs);
+    }
+    for (const FInferenceEndpointLoad& Load : GetAllEndpointLoad())
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Router] %s at %s: %d requests, average %.2f ms"),
+            *UEnum::GetValueAsString(Load.Backend), *Load.Endpoint.ToString(), Load.Requests, Load.AverageLatencyMs);
+    }
+    for (const FInferenceHedgeStats& Stats : GetAllHedgeStats())
+    {
+        if (Stats.Hedged > 0)
+        {
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Hedging] %s: %d of %d requests hedged, %d won by the hedge, p90 %.2f ms"),
+                *UEnum::GetValueAsString(Stats.Backend), Stats.Hedged, Stats.Requests, Stats.HedgeWins, Stats.P90LatencyMs);
+        }
+    }
+
+    Super::Deinitialize();
+}
+
+bool UInferenceHealthSubsystem::Tick(float DeltaTime)
+{
+    FInferenceHealthMonitor& Monitor = FInferenceHealthMonitor::Get();
+    Monitor.Poll(HealthCheckIntervalSeconds, HealthCheckTimeoutSeconds);
+
+    // Circuits change state on worker threads, so changes are picked up here and broadcast on the game thread.
+    TArray<FInferenceEndpointHealth> Health = Monitor.GetHealth();
+    for (const FInferenceEndpointHealth& Current : Health)
+    {
+        const FInferenceEndpointHealth* Previous = LastHealth.FindByPredicate([&Current](const FInferenceEndpointHealth& Last) { return Last.Backend == Current.Backend && Last.Endpoint == Current.Endpoint; });
+        if (Previous ? Previous->State != Current.State : Current.State != EInferenceCircuitState::Closed)
+        {
+            OnCircuitStateChanged.Broadcast(Current);
+        }
+    }
+    LastHealth = MoveTemp(Health);
+
+    return true;
+}
+
+TArray<FInferenceEndpointHealth> UInferenceHealthSubsystem::GetAllEndpointHealth() const
+{
+    return FInferenceHealthMonitor::Get().GetHealth();
+}
+
+TArray<FInferenceEndpointLoad> UInferenceHealthSubsystem::GetAllEndpointLoad() const
+{
+    return FInferenceEndpointRouter::Get().GetLoad();
+}
+
+TArray<FInferenceHedgeStats> UInferenceHealthSubsystem::GetAllHedgeStats() const
+{
+    return FInferenceHedging::Get().GetStats();
+}
+
+bool UInferenceHealthSubsystem::IsBackendAvailable(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint) const
+{
+    return FInferenceHealthMonitor::Get().IsAvailable(Backend, Endpoint);
+}
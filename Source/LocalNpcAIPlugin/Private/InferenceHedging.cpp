@@ -0,0 +1,264 @@
+#include "InferenceHedging.h"
+#include "InferenceEndpointRouter.h"
+#include "InferenceHealthMonitor.h"
+#include "LlamaConnectionPool.h"
+
+namespace
+{
+    constexpr int32 LatencyWindow = 64;
+    constexpr int32 MinLatencySamples = 16;
+    constexpr float MaxHedgeBurst = 2.0f;
+
+    // State shared by the attempts of one request. An attempt only counts as launched once it actually runs, so the
+    // caller never waits for a hedge that is still queued behind busy workers.
+    struct FHedgedCall
+    {
+        FHedgedCall() : Done(FPlatformProcess::GetSynchEventFromPool(true)) {}
+        ~FHedgedCall() { FPlatformProcess::ReturnSynchEventToPool(Done); }
+
+        FCriticalSection Lock;
+        FEvent* Done;
+        int32 Launched = 1;
+        int32 Finished = 0;
+        int32 Winner = INDEX_NONE;
+        bool bHasResponse = false;
+        FLlamaHttpResponse Response;
+
+        bool HasLost(int32 Attempt)
+        {
+            FScopeLock ScopeLock(&Lock);
+            return Winner != INDEX_NONE && Winner != Attempt;
+        }
+
+        bool IsSettled()
+        {
+            FScopeLock ScopeLock(&Lock);
+            return Winner != INDEX_NONE || Finished == Launched;
+        }
+    };
+
+    using FHedgedCallRef = TSharedRef<FHedgedCall, ESPMode::ThreadSafe>;
+
+    // Sends the request to the server of Lease and returns once it answered, failed or lost to the other attempt.
+    // OnPoll runs about every 20 ms while waiting for the answer.
+    void RunAttempt(const FHedgedCallRef& Call, int32 Attempt, const FInferenceEndpointLeasePtr& Lease, const FString& Path, const FString& Body, TFunctionRef<void()> OnPoll)
+    {
+        FInferenceHealthMonitor& HealthMonitor = FInferenceHealthMonitor::Get();
+        const EInferenceBackend Backend = Lease->GetBackend();
+        const FInferenceEndpoint Endpoint = Lease->GetEndpoint();
+        const double StartTime = FPlatformTime::Seconds();
+
+        FLlamaHttpResponse Response;
+        const bool bConnected = FLlamaConnectionPool::Get().Post(Endpoint.Host, Endpoint.Port, Path, Body, Response, 60.0,
+            [&Call, Attempt, &HealthMonitor, Backend, &Endpoint, &OnPoll]()
+            {
+                OnPoll();
+                return Call->HasLost(Attempt) || !HealthMonitor.IsAvailable(Backend, Endpoint);
+            });
+        Lease->Release();
+
+        const bool bAnswered = bConnected && Response.Code < 500;
+        if (bAnswered)
+        {
+            HealthMonitor.ReportSuccess(Backend, Endpoint, (FPlatformTime::Seconds() - StartTime) * 1000.0);
+        }
+        else if (!Call->HasLost(Attempt))
+        {
+            HealthMonitor.ReportFailure(Backend, Endpoint);
+        }
+
+        FScopeLock ScopeLock(&Call->Lock);
+        Call->Finished++;
+        if (Call->Winner == INDEX_NONE && (bAnswered || (bConnected && !Call->bHasResponse)))
+        {
+            // A server error is kept in case the other attempt fails too, but does not end the race.
+            Call->Response = MoveTemp(Response);
+            Call->bHasResponse = true;
+            if (bAnswered)
+            {
+                Call->Winner = Attempt;
+            }
+        }
+        if (Call->Winner != INDEX_NONE || Call->Finished == Call->Launched)
+        {
+            Call->Done->Trigger();
+        }
+    }
+}
+
+FInferenceHedging& FInferenceHedging::Get()
+{
+    static FInferenceHedging Instance;
+    return Instance;
+}
+
+FInferenceHedging::FBackendState& FInferenceHedging::FindOrAdd(EInferenceBackend Backend)
+{
+    if (FBackendState* Existing = Backends.FindByPredicate([Backend](const FBackendState& State) { return State.Stats.Backend == Backend; }))
+    {
+        return *Existing;
+    }
+
+    FBackendState& State = Backends.AddDefaulted_GetRef();
+    State.Stats.Backend = Backend;
+    State.Latencies.Reserve(LatencyWindow);
+    return State;
+}
+
+void FInferenceHedging::SetMaxHedgeRate(float InMaxHedgeRate)
+{
+    FScopeLock ScopeLock(&Lock);
+    MaxHedgeRate = FMath::Clamp(InMaxHedgeRate, 0.0f, 1.0f);
+}
+
+TArray<FInferenceHedgeStats> FInferenceHedging::GetStats() const
+{
+    FScopeLock ScopeLock(&Lock);
+    TArray<FInferenceHedgeStats> Stats;
+    for (const FBackendState& State : Backends)
+    {
+        Stats.Add(State.Stats);
+    }
+    return Stats;
+}
+
+double FInferenceHedging::BeginRequest(EInferenceBackend Backend, bool bHedge)
+{
+    FScopeLock ScopeLock(&Lock);
+    FBackendState& State = FindOrAdd(Backend);
+    State.Stats.Requests++;
+    if (!bHedge)
+    {
+        return -1.0;
+    }
+
+    // Every hedgeable request earns a fraction of a hedge, which caps the hedge rate at MaxHedgeRate over time.
+    State.HedgeBudget = FMath::Min(State.HedgeBudget + MaxHedgeRate, MaxHedgeBurst);
+    return State.Latencies.Num() >= MinLatencySamples ? State.Stats.P90LatencyMs : -1.0;
+}
+
+bool FInferenceHedging::TryStartHedge(EInferenceBackend Backend)
+{
+    FScopeLock ScopeLock(&Lock);
+    FBackendState& State = FindOrAdd(Backend);
+    if (State.HedgeBudget < 1.0f)
+    {
+        return false;
+    }
+
+    State.HedgeBudget -= 1.0f;
+    State.Stats.Hedged++;
+    return true;
+}
+
+void FInferenceHedging::CancelHedge(EInferenceBackend Backend)
+{
+    FScopeLock ScopeLock(&Lock);
+    FBackendState& State = FindOrAdd(Backend);
+    State.HedgeBudget = FMath::Min(State.HedgeBudget + 1.0f, MaxHedgeBurst);
+    State.Stats.Hedged--;
+}
+
+void FInferenceHedging::EndRequest(EInferenceBackend Backend, double LatencyMs, bool bAnswered, bool bHedgeWon)
+{
+    FScopeLock ScopeLock(&Lock);
+    FBackendState& State = FindOrAdd(Backend);
+    if (bHedgeWon)
+    {
+        State.Stats.HedgeWins++;
+    }
+    if (!bAnswered)
+    {
+        return;
+    }
+
+    if (State.Latencies.Num() < LatencyWindow)
+    {
+        State.Latencies.Add(LatencyMs);
+    }
+    else
+    {
+        State.Latencies[State.NextLatency] = LatencyMs;
+    }
+    State.NextLatency = (State.NextLatency + 1) % LatencyWindow;
+
+    TArray<double, TInlineAllocator<LatencyWindow>> Sorted(State.Latencies);
+    Sorted.Sort();
+    State.Stats.P90LatencyMs = Sorted[(Sorted.Num() - 1) * 9 / 10];
+}
+
+bool FInferenceHedging::Post(EInferenceBackend Backend, EInferencePriority Priority, TConstArrayView<FInferenceEndpoint> Endpoints, const FString& Path, const FString& Body, FLlamaHttpResponse& OutResponse, bool bHedge)
+{
+    FInferenceEndpointLeasePtr Lease = FInferenceEndpointRouter::Get().Acquire(Backend, Endpoints);
+    if (!Lease.IsValid())
+    {
+        return false;
+    }
+
+    // A duplicate only helps on another server, a second slot on the same one would wait behind the same batch.
+    const double HedgeDelayMs = BeginRequest(Backend, bHedge && Endpoints.Num() > 1);
+    const double StartTime = FPlatformTime::Seconds();
+    FHedgedCallRef Call = MakeShared<FHedgedCall, ESPMode::ThreadSafe>();
+    bool bHedgeLaunched = false;
+
+    auto LaunchHedgeWhenDue = [this, &Call, &bHedgeLaunched, HedgeDelayMs, StartTime, Backend, Priority, Endpoints, &Lease, &Path, &Body]()
+        {
+            if (bHedgeLaunched || HedgeDelayMs < 0.0 || (FPlatformTime::Seconds() - StartTime) * 1000.0 < HedgeDelayMs)
+            {
+                return;
+            }
+
+            bHedgeLaunched = true;
+            if (!TryStartHedge(Backend))
+            {
+                return;
+            }
+
+            TArray<FInferenceEndpoint> Others(Endpoints);
+            Others.Remove(Lease->GetEndpoint());
+
+            // Takes a scheduler slot like any other request, so hedging never exceeds the backend's concurrency limit.
+            // The hedge has no owner, since its request must not be dropped with the component that queued it.
+            FInferenceScheduler::Get().Launch(Backend, Priority, nullptr, [this, Call, Backend, Others = MoveTemp(Others), Path, Body]()
+                {
+                    FInferenceEndpointLeasePtr HedgeLease = Call->IsSettled() ? nullptr : FInferenceEndpointRouter::Get().Acquire(Backend, Others);
+                    if (HedgeLease.IsValid())
+                    {
+                        FScopeLock ScopeLock(&Call->Lock);
+                        if (Call->Winner != INDEX_NONE || Call->Finished == Call->Launched)
+                        {
+                            HedgeLease.Reset();
+                        }
+                        else
+                        {
+                            Call->Launched++;
+                        }
+                    }
+                    if (!HedgeLease.IsValid())
+                    {
+                        CancelHedge(Backend);
+                        return;
+                    }
+
+                    UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Hedging] %s request is slow, also sending it to %s"),
+                        *UEnum::GetValueAsString(Backend), *HedgeLease->GetEndpoint().ToString());
+                    RunAttempt(Call, 1, HedgeLease, Path, Body, []() {});
+                });
+        };
+
+    RunAttempt(Call, 0, Lease, Path, Body, LaunchHedgeWhenDue);
+    Call->Done->Wait();
+
+    // Once the call is settled no attempt writes to it any more, so the response can be moved out.
+    int32 Winner;
+    bool bHasResponse;
+    {
+        FScopeLock ScopeLock(&Call->Lock);
+        Winner = Call->Winner;
+        bHasResponse = Call->bHasResponse;
+        OutResponse = MoveTemp(Call->Response);
+    }
+
+    EndRequest(Backend, (FPlatformTime::Seconds() - StartTime) * 1000.0, Winner != INDEX_NONE, Winner == 1);
+    return bHasResponse;
+}
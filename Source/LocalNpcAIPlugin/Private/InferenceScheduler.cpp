@@ -0,0 +1,313 @@
+#include "InferenceScheduler.h"
+#include "Async/Async.h"
+
+void FInferenceJobLease::Finish()
+{
+    if (!bFinished.exchange(true))
+    {
+        FInferenceScheduler::Get().Finish(Backend);
+    }
+}
+
+FInferenceScheduler& FInferenceScheduler::Get()
+{
+    static FInferenceScheduler Instance;
+    return Instance;
+}
+
+void FInferenceScheduler::Submit(EInferenceBackend Backend, EInferencePriority Priority, const UObject* Owner, FInferenceJob Job)
+{
+    {
+        FScopeLock ScopeLock(&Lock);
+
+        FBackendQueue& Queue = Queues[static_cast<int32>(Backend)];
+
+        FQueuedJob& Queued = Queue.Jobs.AddDefaulted_GetRef();
+        Queued.Priority = Priority;
+        Queued.Owner = Owner;
+        Queued.bHasOwner = Owner != nullptr;
+        Queued.SubmitTime = FPlatformTime::Seconds();
+        Queued.Job = MoveTemp(Job);
+
+        Queue.Submitted++;
+        Queue.PeakQueued = FMath::Max(Queue.PeakQueued, Queue.Jobs.Num());
+    }
+
+    ScheduleDispatch();
+}
+
+void FInferenceScheduler::Launch(EInferenceBackend Backend, EInferencePriority Priority, const UObject* Owner, TUniqueFunction<void()> Work)
+{
+    Submit(Backend, Priority, Owner, [Work = MoveTemp(Work)](FInferenceJobLeaseRef Lease) mutable
+        {
+            FNpcAiTaskPool::Get().Launch([Work = MoveTemp(Work), Lease]()
+                {
+                    Work();
+                    Lease->Finish();
+                });
+        });
+}
+
+int32 FInferenceScheduler::CancelJobs(const UObject* Owner)
+{
+    int32 NumCancelled = 0;
+
+    FScopeLock ScopeLock(&Lock);
+    for (FBackendQueue& Queue : Queues)
+    {
+        const int32 NumRemoved = Queue.Jobs.RemoveAll([Owner](const FQueuedJob& Queued)
+            {
+                return Queued.bHasOwner && Queued.Owner.Get() == Owner;
+            });
+        Queue.Cancelled += NumRemoved;
+        NumCancelled += NumRemoved;
+    }
+    return NumCancelled;
+}
+
+void FInferenceScheduler::SetConcurrencyLimit(EInferenceBackend Backend, int32 MaxConcurrent)
+{
+    {
+        FScopeLock ScopeLock(&Lock);
+        Queues[static_cast<int32>(Backend)].MaxConcurrent = FMath::Max(1, MaxConcurrent);
+    }
+    EnsureTaskPoolThreads();
+    ScheduleDispatch();
+}
+
+void FInferenceScheduler::EnsureConcurrencyLimit(EInferenceBackend Backend, int32 MaxConcurrent)
+{
+    {
+        FScopeLock ScopeLock(&Lock);
+        FBackendQueue& Queue = Queues[static_cast<int32>(Backend)];
+        Queue.MaxConcurrent = FMath::Max(Queue.MaxConcurrent, MaxConcurrent);
+    }
+    EnsureTaskPoolThreads();
+    ScheduleDispatch();
+}
+
+void FInferenceScheduler::EnsureTaskPoolThreads()
+{
+    int32 NumPoolThreads = 0;
+    {
+        FScopeLock ScopeLock(&Lock);
+        for (EInferenceBackend Backend : { EInferenceBackend::Llama, EInferenceBackend::Embedding, EInferenceBackend::Reranker })
+        {
+            NumPoolThreads += Queues[static_cast<int32>(Backend)].MaxConcurrent;
+        }
+    }
+
+    // Every running job of these backends holds a pool thread, so with at least this many the pool can never make a
+    // job that already got its slot wait behind lower priority work of another backend.
+    FNpcAiTaskPool::Get().EnsureThreads(NumPoolThreads);
+}
+
+void FInferenceScheduler::SetAgingSeconds(double InAgingSeconds)
+{
+    FScopeLock ScopeLock(&Lock);
+    AgingSeconds = InAgingSeconds;
+}
+
+FInferenceBackendStats FInferenceScheduler::GetStats(EInferenceBackend Backend) const
+{
+    FScopeLock ScopeLock(&Lock);
+
+    const FBackendQueue& Queue = Queues[static_cast<int32>(Backend)];
+
+    FInferenceBackendStats Stats;
+    Stats.Backend = Backend;
+    Stats.MaxConcurrent = Queue.MaxConcurrent;
+    Stats.Running = Queue.Running;
+    Stats.Queued = Queue.Jobs.Num();
+    Stats.PeakQueued = Queue.PeakQueued;
+    Stats.Submitted = Queue.Submitted;
+    Stats.Started = Queue.Started;
+    Stats.Cancelled = Queue.Cancelled;
+    Stats.AverageWaitMs = Queue.Started > 0 ? static_cast<float>(Queue.TotalWaitMs / Queue.Started) : 0.0f;
+    Stats.MaxWaitMs = static_cast<float>(Queue.MaxWaitMs);
+    Stats.PlayerFocusedAverageWaitMs = Queue.PlayerFocusedStarted > 0 ? static_cast<float>(Queue.PlayerFocusedWaitMs / Queue.PlayerFocusedStarted) : 0.0f;
+    return Stats;
+}
+
+void FInferenceScheduler::ResetStats()
+{
+    FScopeLock ScopeLock(&Lock);
+
+    for (FBackendQueue& Queue : Queues)
+    {
+        Queue.PeakQueued = Queue.Jobs.Num();
+        Queue.Submitted = 0;
+        Queue.Started = 0;
+        Queue.Cancelled = 0;
+        Queue.TotalWaitMs = 0.0;
+        Queue.MaxWaitMs = 0.0;
+        Queue.PlayerFocusedStarted = 0;
+        Queue.PlayerFocusedWaitMs = 0.0;
+    }
+}
+
+void FInferenceScheduler::Finish(EInferenceBackend Backend)
+{
+    {
+        FScopeLock ScopeLock(&Lock);
+        FBackendQueue& Queue = Queues[static_cast<int32>(Backend)];
+        Queue.Running = FMath::Max(0, Queue.Running - 1);
+    }
+
+    ScheduleDispatch();
+}
+
+void FInferenceScheduler::ScheduleDispatch()
+{
+    {
+        FScopeLock ScopeLock(&Lock);
+        if (bDispatchScheduled)
+        {
+            return;
+        }
+        bDispatchScheduled = true;
+    }
+
+    // Always deferred, so a job that finishes inside its own start callback cannot recurse into Dispatch.
+    AsyncTask(ENamedThreads::GameThread, [this]()
+        {
+            Dispatch();
+        });
+}
+
+double FInferenceScheduler::GetEffectivePriority(const FQueuedJob& Job, double Now) const
+{
+    const double Priority = static_cast<double>(Job.Priority);
+    if (AgingSeconds <= 0.0)
+    {
+        return Priority;
+    }
+    return Priority - (Now - Job.SubmitTime) / AgingSeconds;
+}
+
+void FInferenceScheduler::Dispatch()
+{
+    TArray<TPair<FInferenceJob, FInferenceJobLeaseRef>> JobsToStart;
+
+    {
+        FScopeLock ScopeLock(&Lock);
+        bDispatchScheduled = false;
+
+        const double Now = FPlatformTime::Seconds();
+        for (int32 BackendIndex = 0; BackendIndex < NumBackends; ++BackendIndex)
+        {
+            FBackendQueue& Queue = Queues[BackendIndex];
+
+            Queue.Cancelled += Queue.Jobs.RemoveAll([](const FQueuedJob& Queued)
+                {
+                    return Queued.bHasOwner && !Queued.Owner.IsValid();
+                });
+
+            while (Queue.Running < Queue.MaxConcurrent && Queue.Jobs.Num() > 0)
+            {
+                // Jobs are appended in arrival order, so on equal effective priority the oldest one wins.
+                int32 BestIndex = 0;
+                double BestPriority = GetEffectivePriority(Queue.Jobs[0], Now);
+                for (int32 i = 1; i < Queue.Jobs.Num(); ++i)
+                {
+                    const double Priority = GetEffectivePriority(Queue.Jobs[i], Now);
+                    if (Priority < BestPriority)
+                    {
+                        BestIndex = i;
+                        BestPriority = Priority;
+                    }
+                }
+
+                FQueuedJob Queued = MoveTemp(Queue.Jobs[BestIndex]);
+                Queue.Jobs.RemoveAt(BestIndex, 1, EAllowShrinking::No);
+
+                const double WaitMs = (Now - Queued.SubmitTime) * 1000.0;
+                Queue.Running++;
+                Queue.Started++;
+                Queue.TotalWaitMs += WaitMs;
+                Queue.MaxWaitMs = FMath::Max(Queue.MaxWaitMs, WaitMs);
+                if (Queued.Priority == EInferencePriority::PlayerFocused)
+                {
+                    Queue.PlayerFocusedStarted++;
+                    Queue.PlayerFocusedWaitMs += WaitMs;
+                }
+
+                UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Scheduler] Starting %s job (priority %d) after %.2f ms, %d running, %d queued"),
+                    *UEnum::GetValueAsString(static_cast<EInferenceBackend>(BackendIndex)), static_cast<int32>(Queued.Priority), WaitMs, Queue.Running, Queue.Jobs.Num());
+
+                JobsToStart.Emplace(MoveTemp(Queued.Job), MakeShared<FInferenceJobLease, ESPMode::ThreadSafe>(static_cast<EInferenceBackend>(BackendIndex)));
+            }
+        }
+    }
+
+    for (TPair<FInferenceJob, FInferenceJobLeaseRef>& JobToStart : JobsToStart)
+    {
+        JobToStart.Key(MoveTemp(JobToStart.Value));
+    }
+}
+
+void UInferenceSchedulerSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+    Super::Initialize(Collection);
+
+    // Created first, so the configured size is the starting point the caps below can only grow.
+    FNpcAiTaskPool::Get().Initialize(TaskPoolThreads);
+
+    FInferenceScheduler& Scheduler = FInferenceScheduler::Get();
+    Scheduler.SetConcurrencyLimit(EInferenceBackend::Llama, LlamaConcurrency);
+    Scheduler.SetConcurrencyLimit(EInferenceBackend::Embedding, EmbeddingConcurrency);
+    Scheduler.SetConcurrencyLimit(EInferenceBackend::Reranker, RerankerConcurrency);
+    Scheduler.SetConcurrencyLimit(EInferenceBackend::Whisper, WhisperConcurrency);
+    Scheduler.SetConcurrencyLimit(EInferenceBackend::Kokoro, KokoroConcurrency);
+    Scheduler.SetAgingSeconds(AgingSeconds);
+    Scheduler.ResetStats();
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Scheduler] Initialized with concurrency Llama=%d Embedding=%d Reranker=%d Whisper=%d Kokoro=%d, aging every %.1f s"),
+        LlamaConcurrency, EmbeddingConcurrency, RerankerConcurrency, WhisperConcurrency, KokoroConcurrency, AgingSeconds);
+}
+
+void UInferenceSchedulerSubsystem::Deinitialize()
+{
+    for (const FInferenceBackendStats& Stats : GetAllBackendStats())
+    {
+        if (Stats.Submitted > 0)
+        {
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Scheduler] %s: %d jobs, %d cancelled, peak queue %d, average wait %.2f ms (player focused %.2f ms), max wait %.2f ms"),
+                *UEnum::GetValueAsString(Stats.Backend), Stats.Submitted, Stats.Cancelled, Stats.PeakQueued, Stats.AverageWaitMs, Stats.PlayerFocusedAverageWaitMs, Stats.MaxWaitMs);
+        }
+    }
+
+    const FNpcAiTaskPoolStats PoolStats = GetTaskPoolStats();
+    if (PoolStats.Executed > 0)
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | TaskPool] %d tasks on %d threads, peak %d busy, average queue latency %.2f ms, max %.2f ms"),
+            PoolStats.Executed, PoolStats.NumThreads, PoolStats.PeakActive, PoolStats.AverageQueueLatencyMs, PoolStats.MaxQueueLatencyMs);
+    }
+
+    Super::Deinitialize();
+}
+
+void UInferenceSchedulerSubsystem::SetConcurrencyLimit(EInferenceBackend Backend, int32 MaxConcurrent)
+{
+    FInferenceScheduler::Get().SetConcurrencyLimit(Backend, MaxConcurrent);
+}
+
+FInferenceBackendStats UInferenceSchedulerSubsystem::GetBackendStats(EInferenceBackend Backend) const
+{
+    return FInferenceScheduler::Get().GetStats(Backend);
+}
+
+TArray<FInferenceBackendStats> UInferenceSchedulerSubsystem::GetAllBackendStats() const
+{
+    TArray<FInferenceBackendStats> AllStats;
+    for (int32 BackendIndex = 0; BackendIndex <= static_cast<int32>(EInferenceBackend::Kokoro); ++BackendIndex)
+    {
+        AllStats.Add(FInferenceScheduler::Get().GetStats(static_cast<EInferenceBackend>(BackendIndex)));
+    }
+    return AllStats;
+}
+
+FNpcAiTaskPoolStats UInferenceSchedulerSubsystem::GetTaskPoolStats() const
+{
+    return FNpcAiTaskPool::Get().GetStats();
+}
@@ -0,0 +1,191 @@
+#include "KnowledgeIndex.h"
+#include "LlamaComponent.h"
+#include "HAL/PlatformFileManager.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace
+{
+    constexpr uint32 IndexMagic = 0x494B4E4C; // "LNKI"
+    // Bump when the chunking or the file layout changes, so old indexes are rebuilt.
+    constexpr uint32 IndexVersion = 2;
+
+    struct FIndexHeader
+    {
+        uint32 Magic = IndexMagic;
+        uint32 Version = IndexVersion;
+        uint8 SourceHash[20] = {};
+        int32 SentencesPerChunk = 0;
+        int32 SentenceOverlap = 0;
+        // Model ids can be long file paths, so only their hash is stored.
+        uint8 ModelHash[20] = {};
+        int32 NumChunks = 0;
+        int32 Dimensions = 0;
+        uint64 VectorsOffset = 0;
+        uint64 TextOffsetsOffset = 0;
+        uint64 TextOffset = 0;
+        uint64 TextSize = 0;
+    };
+
+    FIndexHeader MakeHeader(const FKnowledgeIndexKey& Key)
+    {
+        FIndexHeader Header;
+        FMemory::Memcpy(Header.SourceHash, Key.SourceHash.Hash, sizeof(Header.SourceHash));
+        Header.SentencesPerChunk = Key.SentencesPerChunk;
+        Header.SentenceOverlap = Key.SentenceOverlap;
+
+        FTCHARToUTF8 ModelId(*Key.ModelId);
+        FSHA1::HashBuffer(ModelId.Get(), ModelId.Length(), Header.ModelHash);
+        return Header;
+    }
+}
+
+FString FKnowledgeIndex::GetIndexPath(const FString& Folder, const FString& KnowledgePath)
+{
+    const FString IndexFolder = Folder.IsEmpty() ? FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("KnowledgeIndex")) : Folder;
+    const uint32 PathHash = FCrc::StrCrc32(*FPaths::ConvertRelativePathToFull(KnowledgePath));
+    return FPaths::Combine(IndexFolder, FString::Printf(TEXT("%s_%08x.knowledge"), *FPaths::GetBaseFilename(KnowledgePath), PathHash));
+}
+
+bool FKnowledgeIndex::Load(const FString& Path, const FKnowledgeIndexKey& Key, TArray<FKnowledgeEntry>& OutEntries)
+{
+    IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+    if (!PlatformFile.FileExists(*Path))
+    {
+        return false;
+    }
+
+    // Mapped where the platform supports it, read into memory otherwise.
+    TUniquePtr<IMappedFileHandle> MappedFile(PlatformFile.OpenMapped(*Path));
+    TUniquePtr<IMappedFileRegion> MappedRegion(MappedFile ? MappedFile->MapRegion(0, MappedFile->GetFileSize()) : nullptr);
+    TArray<uint8> FileData;
+    const uint8* Data;
+    uint64 Size;
+    if (MappedRegion)
+    {
+        Data = MappedRegion->GetMappedPtr();
+        Size = MappedRegion->GetMappedSize();
+    }
+    else if (FFileHelper::LoadFileToArray(FileData, *Path, FILEREAD_Silent))
+    {
+        Data = FileData.GetData();
+        Size = FileData.Num();
+    }
+    else
+    {
+        return false;
+    }
+
+    FIndexHeader Header;
+    if (Size < sizeof(Header))
+    {
+        return false;
+    }
+    FMemory::Memcpy(&Header, Data, sizeof(Header));
+
+    const FIndexHeader Expected = MakeHeader(Key);
+    if (Header.Magic != IndexMagic || Header.Version != IndexVersion)
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Knowledge index %s has an old format, rebuilding"), *Path);
+        return false;
+    }
+    if (FMemory::Memcmp(Header.SourceHash, Expected.SourceHash, sizeof(Header.SourceHash)) != 0
+        || Header.SentencesPerChunk != Expected.SentencesPerChunk || Header.SentenceOverlap != Expected.SentenceOverlap
+        || FMemory::Memcmp(Header.ModelHash, Expected.ModelHash, sizeof(Header.ModelHash)) != 0)
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Knowledge index %s is out of date, rebuilding"), *Path);
+        return false;
+    }
+
+    const uint64 NumChunks = Header.NumChunks;
+    const uint64 Dimensions = Header.Dimensions;
+    if (Header.NumChunks < 0 || Header.Dimensions <= 0 || Header.Dimensions > 65536
+        || Header.VectorsOffset + NumChunks * Dimensions * sizeof(float) > Size
+        || Header.TextOffsetsOffset + (NumChunks + 1) * sizeof(uint32) > Size
+        || Header.TextOffset + Header.TextSize > Size)
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Knowledge index %s is corrupt, rebuilding"), *Path);
+        return false;
+    }
+
+    TArray<uint32> TextOffsets;
+    TextOffsets.SetNumUninitialized(NumChunks + 1);
+    FMemory::Memcpy(TextOffsets.GetData(), Data + Header.TextOffsetsOffset, TextOffsets.Num() * sizeof(uint32));
+
+    TArray<FKnowledgeEntry> Entries;
+    Entries.SetNum(NumChunks);
+    for (int32 i = 0; i < Entries.Num(); i++)
+    {
+        if (TextOffsets[i] > TextOffsets[i + 1] || TextOffsets[i + 1] > Header.TextSize)
+        {
+            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Knowledge index %s is corrupt, rebuilding"), *Path);
+            return false;
+        }
+
+        const ANSICHAR* Text = reinterpret_cast<const ANSICHAR*>(Data + Header.TextOffset + TextOffsets[i]);
+        Entries[i].Text = FString(FUTF8ToTCHAR(Text, TextOffsets[i + 1] - TextOffsets[i]));
+
+        Entries[i].Embedding.SetNumUninitialized(Dimensions);
+        FMemory::Memcpy(Entries[i].Embedding.GetData(), Data + Header.VectorsOffset + i * Dimensions * sizeof(float), Dimensions * sizeof(float));
+    }
+
+    OutEntries = MoveTemp(Entries);
+    return true;
+}
+
+bool FKnowledgeIndex::Save(const FString& Path, const FKnowledgeIndexKey& Key, const TArray<FKnowledgeEntry>& Entries)
+{
+    const int32 Dimensions = Entries.IsEmpty() ? 0 : Entries[0].Embedding.Num();
+    int32 NumMissing = 0;
+    for (const FKnowledgeEntry& Entry : Entries)
+    {
+        NumMissing += Entry.Embedding.Num() != Dimensions ? 1 : 0;
+    }
+    if (Dimensions == 0 || NumMissing > 0)
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Not saving knowledge index, %d of %d chunks have no embedding"), Dimensions == 0 ? Entries.Num() : NumMissing, Entries.Num());
+        return false;
+    }
+
+    TArray<uint8> Text;
+    TArray<uint32> TextOffsets;
+    TextOffsets.Reserve(Entries.Num() + 1);
+    for (const FKnowledgeEntry& Entry : Entries)
+    {
+        TextOffsets.Add(Text.Num());
+        FTCHARToUTF8 Converted(*Entry.Text);
+        Text.Append(reinterpret_cast<const uint8*>(Converted.Get()), Converted.Length());
+    }
+    TextOffsets.Add(Text.Num());
+
+    FIndexHeader Header = MakeHeader(Key);
+    Header.NumChunks = Entries.Num();
+    Header.Dimensions = Dimensions;
+    Header.VectorsOffset = Align(sizeof(FIndexHeader), 16);
+    Header.TextOffsetsOffset = Header.VectorsOffset + static_cast<uint64>(Entries.Num()) * Dimensions * sizeof(float);
+    Header.TextOffset = Header.TextOffsetsOffset + TextOffsets.Num() * sizeof(uint32);
+    Header.TextSize = Text.Num();
+
+    TArray<uint8> Buffer;
+    Buffer.SetNumZeroed(Header.TextOffset + Header.TextSize);
+    FMemory::Memcpy(Buffer.GetData(), &Header, sizeof(Header));
+    for (int32 i = 0; i < Entries.Num(); i++)
+    {
+        FMemory::Memcpy(Buffer.GetData() + Header.VectorsOffset + static_cast<uint64>(i) * Dimensions * sizeof(float), Entries[i].Embedding.GetData(), Dimensions * sizeof(float));
+    }
+    FMemory::Memcpy(Buffer.GetData() + Header.TextOffsetsOffset, TextOffsets.GetData(), TextOffsets.Num() * sizeof(uint32));
+    FMemory::Memcpy(Buffer.GetData() + Header.TextOffset, Text.GetData(), Text.Num());
+
+    // Several NPCs can share a document and finish building it at the same time, so each writes its own temporary file.
+    const FString TempPath = FString::Printf(TEXT("%s.%s.tmp"), *Path, *FGuid::NewGuid().ToString());
+    if (!FFileHelper::SaveArrayToFile(Buffer, *TempPath) || !IFileManager::Get().Move(*Path, *TempPath, true))
+    {
+        IFileManager::Get().Delete(*TempPath, false, false, true);
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Failed to save knowledge index %s"), *Path);
+        return false;
+    }
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Saved knowledge index with %d chunks to %s"), Entries.Num(), *Path);
+    return true;
+}
@@ -0,0 +1,170 @@
+#include "KnowledgeMatrix.h"
+#include "LlamaComponent.h"
+#include "Math/VectorRegister.h"
+
+#if defined(PLATFORM_ALWAYS_HAS_AVX_2) && PLATFORM_ALWAYS_HAS_AVX_2
+#include <immintrin.h>
+#define LOCALNPCAI_KNOWLEDGE_AVX2 1
+#else
+#define LOCALNPCAI_KNOWLEDGE_AVX2 0
+#endif
+
+namespace
+{
+    constexpr int32 RowAlignment = 8;
+
+    // Writes Source scaled to unit length to Out. A zero vector stays zero, so it matches nothing.
+    void NormalizeInto(const float* Source, int32 Num, float* Out)
+    {
+        double SquaredNorm = 0.0;
+        for (int32 i = 0; i < Num; i++)
+        {
+            SquaredNorm += static_cast<double>(Source[i]) * Source[i];
+        }
+
+        const float InvNorm = SquaredNorm > KINDA_SMALL_NUMBER ? static_cast<float>(1.0 / FMath::Sqrt(SquaredNorm)) : 0.0f;
+        for (int32 i = 0; i < Num; i++)
+        {
+            Out[i] = Source[i] * InvNorm;
+        }
+    }
+}
+
+float FKnowledgeMatrix::Dot(const float* A, const float* B, int32 Num)
+{
+#if LOCALNPCAI_KNOWLEDGE_AVX2
+    // Multiply and add rather than FMA, which AVX2 targets do not have to enable.
+    __m256 Sum0 = _mm256_setzero_ps();
+    __m256 Sum1 = _mm256_setzero_ps();
+    int32 i = 0;
+    for (; i + 16 <= Num; i += 16)
+    {
+        Sum0 = _mm256_add_ps(Sum0, _mm256_mul_ps(_mm256_load_ps(A + i), _mm256_load_ps(B + i)));
+        Sum1 = _mm256_add_ps(Sum1, _mm256_mul_ps(_mm256_load_ps(A + i + 8), _mm256_load_ps(B + i + 8)));
+    }
+    if (i < Num)
+    {
+        Sum0 = _mm256_add_ps(Sum0, _mm256_mul_ps(_mm256_load_ps(A + i), _mm256_load_ps(B + i)));
+    }
+
+    Sum0 = _mm256_add_ps(Sum0, Sum1);
+    __m128 Sum = _mm_add_ps(_mm256_castps256_ps128(Sum0), _mm256_extractf128_ps(Sum0, 1));
+    Sum = _mm_hadd_ps(Sum, Sum);
+    Sum = _mm_hadd_ps(Sum, Sum);
+    return _mm_cvtss_f32(Sum);
+#else
+    VectorRegister4Float Sum0 = VectorZeroFloat();
+    VectorRegister4Float Sum1 = VectorZeroFloat();
+    for (int32 i = 0; i < Num; i += 8)
+    {
+        Sum0 = VectorMultiplyAdd(VectorLoadAligned(A + i), VectorLoadAligned(B + i), Sum0);
+        Sum1 = VectorMultiplyAdd(VectorLoadAligned(A + i + 4), VectorLoadAligned(B + i + 4), Sum1);
+    }
+
+    float Lanes[4];
+    VectorStore(VectorAdd(Sum0, Sum1), Lanes);
+    return (Lanes[0] + Lanes[1]) + (Lanes[2] + Lanes[3]);
+#endif
+}
+
+void FKnowledgeMatrix::Reset()
+{
+    Data.Empty();
+    Texts.Empty();
+    Dimensions = 0;
+    Stride = 0;
+}
+
+void FKnowledgeMatrix::Build(TArray<FKnowledgeEntry>&& Entries)
+{
+    Reset();
+
+    const FKnowledgeEntry* First = Entries.FindByPredicate([](const FKnowledgeEntry& Entry) { return !Entry.Embedding.IsEmpty(); });
+    if (!First)
+    {
+        return;
+    }
+
+    const int32 EmbeddingSize = First->Embedding.Num();
+    int32 NumRows = 0;
+    for (const FKnowledgeEntry& Entry : Entries)
+    {
+        NumRows += Entry.Embedding.Num() == EmbeddingSize ? 1 : 0;
+    }
+
+    const int32 RowStride = Align(EmbeddingSize, RowAlignment);
+    if (static_cast<int64>(NumRows) * RowStride > MAX_int32)
+    {
+        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Knowledge base of %d chunks with %d dimensions is too large"), NumRows, EmbeddingSize);
+        return;
+    }
+
+    Dimensions = EmbeddingSize;
+    Stride = RowStride;
+    Data.SetNumZeroed(NumRows * Stride);
+    Texts.Reserve(NumRows);
+    for (FKnowledgeEntry& Entry : Entries)
+    {
+        if (Entry.Embedding.Num() == Dimensions)
+        {
+            NormalizeInto(Entry.Embedding.GetData(), Dimensions, Data.GetData() + Texts.Num() * Stride);
+            Texts.Add(MoveTemp(Entry.Text));
+        }
+    }
+
+    if (NumRows < Entries.Num())
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Dropped %d knowledge chunks without a %d-dimensional embedding"), Entries.Num() - NumRows, Dimensions);
+    }
+    Entries.Empty();
+}
+
+void FKnowledgeMatrix::FindNearest(TConstArrayView<float> Query, int32 K, TArray<int32>& OutRows, TArray<float>* OutScores) const
+{
+    OutRows.Reset();
+    if (OutScores)
+    {
+        OutScores->Reset();
+    }
+    if (Query.Num() != Dimensions || Texts.IsEmpty() || K <= 0)
+    {
+        return;
+    }
+
+    TArray<float, TAlignedHeapAllocator<32>> NormalizedQuery;
+    NormalizedQuery.SetNumZeroed(Stride);
+    NormalizeInto(Query.GetData(), Dimensions, NormalizedQuery.GetData());
+
+    struct FScoredRow
+    {
+        float Score;
+        int32 Row;
+    };
+
+    // Min-heap of the best K rows so far, so the knowledge base is never sorted as a whole.
+    auto Worse = [](const FScoredRow& A, const FScoredRow& B) { return A.Score < B.Score; };
+    TArray<FScoredRow, TInlineAllocator<32>> Best;
+    for (int32 Row = 0; Row < Texts.Num(); Row++)
+    {
+        const float Score = Dot(NormalizedQuery.GetData(), GetRow(Row), Stride);
+        if (Best.Num() < K)
+        {
+            Best.HeapPush({ Score, Row }, Worse);
+        }
+        else if (Score > Best.HeapTop().Score)
+        {
+            Best.HeapPopDiscard(Worse);
+            Best.HeapPush({ Score, Row }, Worse);
+        }
+    }
+
+    Best.Sort([](const FScoredRow& A, const FScoredRow& B) { return A.Score > B.Score; });
+    for (const FScoredRow& Scored : Best)
+    {
+        OutRows.Add(Scored.Row);
+        if (OutScores)
+        {
+            OutScores->Add(Scored.Score);
+        }
+    }
+}
@@ -12,6 +12,9 @@
 #include "Sound/SoundWaveProcedural.h"
 #include "Components/AudioComponent.h"
 #include "Kismet/GameplayStatics.h"
+#include "InferenceScheduler.h"
+#include "InferenceHealthMonitor.h"
+#include "InferenceEndpointRouter.h"
 
 UKokoroComponent::UKokoroComponent()
 {
@@ -31,7 +34,7 @@ void UKokoroComponent::BeginPlay()
     }
 }
 
-void UKokoroComponent::CreateSoundWave(const FString& Text)
+void UKokoroComponent::CreateSoundWave(const FString& Text, bool bCacheAudio)
 {
     if (Text.IsEmpty())
     {
@@ -57,10 +60,206 @@ void UKokoroComponent::CreateSoundWave(const FString& Text)
         return;
 	}
 
+    const int32 Generation = RequestGeneration;
+    if (PlayFromAudioCache(Text, Generation))
+    {
+        return;
+    }
+
+    // Cached lines are still spoken while the server is down; anything else fails fast.
+    if (!FInferenceEndpointRouter::Get().HasAvailable(EInferenceBackend::Kokoro, GetKokoroEndpoints()))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Kokoro] No Kokoro server is available, skipping audio"));
+
+        AsyncTask(ENamedThreads::GameThread, [this]()
+            {
+                OnSoundReady.Broadcast({ nullptr, 0.0f });
+            });
+
+        return;
+    }
+
+    QueuedRequests++;
+
+    FInferenceScheduler::Get().Submit(EInferenceBackend::Kokoro, InferencePriority, this, [this, Text, bCacheAudio, Generation](FInferenceJobLeaseRef JobLease)
+        {
+            QueuedRequests = FMath::Max(0, QueuedRequests - 1);
+            if (Generation == RequestGeneration)
+            {
+                SendSpeechRequest(Text, bCacheAudio, Generation, JobLease);
+            }
+        });
+}
+
+bool UKokoroComponent::PlayFromAudioCache(const FString& Text, int32 Generation)
+{
+    // Lines still being synthesized would be overtaken, so the cache is only used when nothing is ahead in line.
+    if (QueuedRequests > 0 || !PendingRequests.IsEmpty())
+    {
+        return false;
+    }
+
+    FCachedAudio* Cached = AudioCache.Find(Text);
+    if (!Cached)
+    {
+        return false;
+    }
+
+    Cached->LastUsed = FPlatformTime::Seconds();
+    AudioCacheStats.Hits++;
+    AudioCacheStats.SavedMs += Cached->SynthesisMs;
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Kokoro] Audio for %d characters taken from the cache, %.2f ms of synthesis saved."), Text.Len(), Cached->SynthesisMs);
+
+    FSoundWaveWithDuration Sound = CreateSoundWaveFromWav(Cached->Wav);
+    AsyncTask(ENamedThreads::GameThread, [this, Sound, Generation]()
+        {
+            if (Generation == RequestGeneration)
+            {
+                OnSoundReady.Broadcast(Sound);
+            }
+        });
+    return true;
+}
+
+void UKokoroComponent::AddToAudioCache(const FString& Text, const TArray<uint8>& Wav, double SynthesisMs, bool bPinned)
+{
+    if (AudioCacheEntries <= 0 && !bPinned)
+    {
+        return;
+    }
+
+    // Pinned lines neither count towards AudioCacheEntries nor get evicted.
+    int32 NumUnpinned = 0;
+    for (const auto& Pair : AudioCache)
+    {
+        NumUnpinned += Pair.Value.bPinned ? 0 : 1;
+    }
+    while (!bPinned && NumUnpinned >= AudioCacheEntries)
+    {
+        FString OldestText;
+        double OldestUse = TNumericLimits<double>::Max();
+        for (const auto& Pair : AudioCache)
+        {
+            if (!Pair.Value.bPinned && Pair.Value.LastUsed < OldestUse)
+            {
+                OldestText = Pair.Key;
+                OldestUse = Pair.Value.LastUsed;
+            }
+        }
+        AudioCache.Remove(OldestText);
+        NumUnpinned--;
+    }
+
+    FCachedAudio& Cached = AudioCache.FindOrAdd(Text);
+    Cached.Wav = Wav;
+    Cached.SynthesisMs = SynthesisMs;
+    Cached.LastUsed = FPlatformTime::Seconds();
+    Cached.bPinned |= bPinned;
+    AudioCacheStats.Entries = AudioCache.Num();
+}
+
+void UKokoroComponent::PrepareSoundWave(const FString& Text)
+{
+    if (Text.IsEmpty() || Voice.IsEmpty())
+    {
+        return;
+    }
+
+    if (FCachedAudio* Cached = AudioCache.Find(Text))
+    {
+        Cached->bPinned = true;
+        return;
+    }
+
+    // Owned by the actor rather than this component, so StopSpeaking does not cancel the preparation. The actor can
+    // outlive the component, so the job and the request only come back through the weak pointer.
+    TWeakObjectPtr<UKokoroComponent> WeakThis(this);
+    FInferenceScheduler::Get().Submit(EInferenceBackend::Kokoro, EInferencePriority::Background, GetOwner(), [WeakThis, Text](FInferenceJobLeaseRef JobLease)
+        {
+            UKokoroComponent* Kokoro = WeakThis.Get();
+            if (!Kokoro || !Kokoro->HasBegunPlay())
+            {
+                JobLease->Finish();
+                return;
+            }
+
+            FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Kokoro, Kokoro->GetKokoroEndpoints());
+            if (!EndpointLease.IsValid())
+            {
+                JobLease->Finish();
+                return;
+            }
+            const FInferenceEndpoint Endpoint = EndpointLease->GetEndpoint();
+
+            TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
+            Request->SetURL(FString::Printf(TEXT("http://%s/v1/audio/speech"), *Endpoint.ToString()));
+            Request->SetVerb("POST");
+            Request->SetHeader("Content-Type", "application/json");
+            Request->SetContentAsString(Kokoro->CreateJsonRequest(Text));
+
+            double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+
+            Request->OnProcessRequestComplete().BindLambda([WeakThis, Text, StartTimeBenchmark, JobLease, EndpointLease, Endpoint](FHttpRequestPtr Req, FHttpResponsePtr Response, bool bWasSuccessful)
+                {
+                    EndpointLease->Release();
+                    JobLease->Finish();
+
+                    // Gone, or cancelled by EndPlay, which says nothing about the server's health.
+                    UKokoroComponent* Component = WeakThis.Get();
+                    if (!Component || Component->PreparedRequests.Remove(Req) == 0)
+                    {
+                        return;
+                    }
+
+                    const double DurationBenchmark = FPlatformTime::Seconds() * 1000.0 - StartTimeBenchmark;
+                    if (bWasSuccessful && Response.IsValid() && Response->GetResponseCode() < 500)
+                    {
+                        FInferenceHealthMonitor::Get().ReportSuccess(EInferenceBackend::Kokoro, Endpoint, DurationBenchmark);
+                    }
+                    else
+                    {
+                        FInferenceHealthMonitor::Get().ReportFailure(EInferenceBackend::Kokoro, Endpoint);
+                    }
+
+                    if (!bWasSuccessful || !Response.IsValid() || Response->GetResponseCode() != 200)
+                    {
+                        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Kokoro] Failed to prepare audio for: %s"), *Text);
+                        return;
+                    }
+
+                    Component->AddToAudioCache(Text, Response->GetContent(), DurationBenchmark, true);
+                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Kokoro] Audio for %d characters prepared in %.2f ms."), Text.Len(), DurationBenchmark);
+                });
+            Kokoro->PreparedRequests.Add(Request);
+            Request->ProcessRequest();
+        });
+}
+
+bool UKokoroComponent::HasCachedAudio(const FString& Text) const
+{
+    return AudioCache.Contains(Text);
+}
+
+void UKokoroComponent::SendSpeechRequest(const FString& Text, bool bCacheAudio, int32 Generation, FInferenceJobLeaseRef JobLease)
+{
     FString Guid = FGuid::NewGuid().ToString(EGuidFormats::Short);
     FString AudioPath = FPaths::Combine(OutputAudioFolder, FString::Printf(TEXT("kokoro-%s.wav"), *Guid));
 
-    FString Url = FString::Printf(TEXT("http://localhost:%d/v1/audio/speech"), Port);
+    FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Kokoro, GetKokoroEndpoints());
+    if (!EndpointLease.IsValid())
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Kokoro] No Kokoro server is available, skipping audio"));
+
+        AsyncTask(ENamedThreads::GameThread, [this]()
+            {
+                OnSoundReady.Broadcast({ nullptr, 0.0f });
+            });
+
+        return;
+    }
+    const FInferenceEndpoint Endpoint = EndpointLease->GetEndpoint();
+
+    FString Url = FString::Printf(TEXT("http://%s/v1/audio/speech"), *Endpoint.ToString());
     FString Content = CreateJsonRequest(Text);
 
 	TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
@@ -72,11 +271,29 @@ void UKokoroComponent::CreateSoundWave(const FString& Text)
     double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
     int32 LengthBenchmark = Text.Len();
 
-    Request->OnProcessRequestComplete().BindLambda([this, StartTimeBenchmark, LengthBenchmark, AudioPath](FHttpRequestPtr Req, FHttpResponsePtr Response, bool bWasSuccessful)
+    Request->OnProcessRequestComplete().BindLambda([this, Text, bCacheAudio, StartTimeBenchmark, LengthBenchmark, AudioPath, Generation, JobLease, EndpointLease, Endpoint](FHttpRequestPtr Req, FHttpResponsePtr Response, bool bWasSuccessful)
         {
+            EndpointLease->Release();
+            JobLease->Finish();
+            PendingRequests.Remove(Req);
+            if (Generation != RequestGeneration)
+            {
+                UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Kokoro] Dropping audio of a cancelled turn."));
+                return;
+            }
+
             double EndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
             double DurationBenchmark = EndTimeBenchmark - StartTimeBenchmark;
 
+            if (bWasSuccessful && Response.IsValid() && Response->GetResponseCode() < 500)
+            {
+                FInferenceHealthMonitor::Get().ReportSuccess(EInferenceBackend::Kokoro, Endpoint, DurationBenchmark);
+            }
+            else
+            {
+                FInferenceHealthMonitor::Get().ReportFailure(EInferenceBackend::Kokoro, Endpoint);
+            }
+
             if (!bWasSuccessful || !Response.IsValid())
             {
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Whisper] Request failed."));
@@ -103,6 +320,11 @@ void UKokoroComponent::CreateSoundWave(const FString& Text)
             }
 
             const TArray<uint8>& AudioData = Response->GetContent();
+            if (bCacheAudio)
+            {
+                AddToAudioCache(Text, AudioData, DurationBenchmark, false);
+            }
+
             if (FFileHelper::SaveArrayToFile(AudioData, *AudioPath))
             {
                 UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Kokoro] Audio for %d characters generated in %.2f ms. Result saved to %s."), LengthBenchmark, DurationBenchmark, *AudioPath);
@@ -124,10 +346,16 @@ void UKokoroComponent::CreateSoundWave(const FString& Text)
             }
         });
 
+    PendingRequests.Add(Request);
     Request->ProcessRequest();
     UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Kokoro] Request sent to %s. Response will be saved to %s"), *Url, *AudioPath);
 }
 
+TArray<FInferenceEndpoint> UKokoroComponent::GetKokoroEndpoints() const
+{
+    return FInferenceEndpointRouter::ResolveEndpoints(KokoroEndpoints, Port, TEXT("localhost"));
+}
+
 FString UKokoroComponent::CreateJsonRequest(FString Input)
 {
     TSharedPtr<FJsonObject> RootObject = MakeShared<FJsonObject>();
@@ -154,10 +382,15 @@ FSoundWaveWithDuration UKokoroComponent::LoadSoundWaveFromWav(FString AudioPath)
 		return { nullptr, 0.0f };
     }
 
+    return CreateSoundWaveFromWav(FileData);
+}
+
+FSoundWaveWithDuration UKokoroComponent::CreateSoundWaveFromWav(const TArray<uint8>& FileData)
+{
     FWaveModInfo WaveInfo;
     if (!WaveInfo.ReadWaveInfo(FileData.GetData(), FileData.Num()))
     {
-        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Kokoro] Failed to parse WAV: %s"), *AudioPath);
+        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Kokoro] Failed to parse WAV data."));
 		return { nullptr, 0.0f };
     }
 
@@ -223,7 +456,7 @@ void UKokoroComponent::PlayNextInQueue()
 	CustomAttenuation->Attenuation.AbsorptionMethod = EAirAbsorptionMethod::Linear;
     CustomAttenuation->Attenuation.AttenuationShape = EAttenuationShape::Sphere;
     CustomAttenuation->Attenuation.FalloffDistance = 1000.f;
-    UGameplayStatics::PlaySoundAtLocation(this, NextSound.SoundWave, Location, 1.0f, 1.0f, 0.0f, CustomAttenuation);
+    ActiveAudioComponent = UGameplayStatics::SpawnSoundAtLocation(this, NextSound.SoundWave, Location, FRotator::ZeroRotator, 1.0f, 1.0f, 0.0f, CustomAttenuation);
 
     UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Kokoro] Playing sound for %.2f seconds."), NextSound.Duration);
 	GetWorld()->GetTimerManager().SetTimer(AudioFinishTimer, this, &UKokoroComponent::AudioFinishedHandler, NextSound.Duration, false);
@@ -232,13 +465,60 @@ void UKokoroComponent::PlayNextInQueue()
 void UKokoroComponent::AudioFinishedHandler() 
 {
     bIsPlayingSound = false;
+    ActiveAudioComponent = nullptr;
     GetWorld()->GetTimerManager().ClearTimer(AudioFinishTimer);
 
 	PlayNextInQueue();
 }
 
+void UKokoroComponent::StopSpeaking()
+{
+    RequestGeneration++;
+    FInferenceScheduler::Get().CancelJobs(this);
+    QueuedRequests = 0;
+
+    // Cancelling runs the completion callbacks, which remove themselves from PendingRequests.
+    TArray<FHttpRequestPtr> RequestsToCancel = MoveTemp(PendingRequests);
+    for (const FHttpRequestPtr& Request : RequestsToCancel)
+    {
+        Request->CancelRequest();
+    }
+
+    {
+        FScopeLock Lock(&SoundQueueLock);
+        SoundQueue.Empty();
+        bIsPlayingSound = false;
+    }
+
+    if (IsValid(ActiveAudioComponent))
+    {
+        ActiveAudioComponent->Stop();
+    }
+    ActiveAudioComponent = nullptr;
+
+    if (GetWorld())
+    {
+        GetWorld()->GetTimerManager().ClearTimer(AudioFinishTimer);
+    }
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Kokoro] Stopped speaking, %d pending requests cancelled."), RequestsToCancel.Num());
+}
+
+bool UKokoroComponent::IsSpeaking() const
+{
+    return bIsPlayingSound || !SoundQueue.IsEmpty() || !PendingRequests.IsEmpty() || QueuedRequests > 0;
+}
+
 void UKokoroComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
+    StopSpeaking();
+
+    TArray<FHttpRequestPtr> PreparationsToCancel = MoveTemp(PreparedRequests);
+    for (const FHttpRequestPtr& Request : PreparationsToCancel)
+    {
+        Request->CancelRequest();
+    }
+
     Super::EndPlay(EndPlayReason);
 
     if (!OutputAudioFolder.IsEmpty() && IFileManager::Get().DirectoryExists(*OutputAudioFolder))
@@ -7,12 +7,29 @@
 #include "Dom/JsonValue.h"
 #include "Serialization/JsonWriter.h"
 #include "Serialization/JsonSerializer.h"
+#include "LlamaConnectionPool.h"
+#include "LlamaStreamParser.h"
+#include "LlamaDeltaExtractor.h"
+#include "LlamaSlotManager.h"
+#include "LlamaRequestBuilder.h"
+#include "InferenceScheduler.h"
+#include "NpcAiTaskPool.h"
+#include "NpcAiTextSanitizer.h"
+#include "LlamaToolCalls.h"
+#include "InferenceHealthMonitor.h"
+#include "InferenceEndpointRouter.h"
+#include "InferenceHedging.h"
+#include "KnowledgeIndex.h"
+#include "Misc/ScopeExit.h"
 #include "SocketSubsystem.h"
 #include "Sockets.h"
 
+static const FString LlamaHost = TEXT("127.0.0.1");
+
 ULlamaComponent::ULlamaComponent()
 {
-    PrimaryComponentTick.bCanEverTick = false;
+    PrimaryComponentTick.bCanEverTick = true;
+    PrimaryComponentTick.bStartWithTickEnabled = false;
 
     OnStreamTokenReceived.AddDynamic(this, &ULlamaComponent::HandleStreamChunk);
 }
@@ -28,56 +45,85 @@ void ULlamaComponent::SendChatMessage(FString Message)
         return;
 	}
 
+    bTurnPrefilled = bHistoryPrefilled && ConfirmedPrefillGeneration == PrefillGeneration;
+    TurnStartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+    bPendingCacheStore = false;
+    bTurnTriggeredAction = false;
+    TurnToolResults.Reset();
+    TurnOpener = MoveTemp(NextResponseOpener);
+
+    // Whatever an earlier stream left behind must not end up at the start of this reply.
+    {
+        FScopeLock Lock(&ChunkMutex);
+        Sanitizer.Reset();
+        Segmenter.Reset();
+        ChunkStartTimeBenchmark = TurnStartTimeBenchmark;
+    }
+
+    // The state the reply depends on, taken before the new message becomes part of the history.
+    const uint32 CacheStateHash = bUseResponseCache ? ComputeCacheStateHash() : 0;
+
     FChatMessage NewMessage;
     NewMessage.Role = "user";
     NewMessage.Content = Message;
-    ChatHistory.Add(NewMessage);
+    AddChatMessage(NewMessage);
+    StreamedResponse.Empty();
 
-    if (RagMode != ERagMode::Disabled)
+    if (RagMode != ERagMode::Disabled || bUseResponseCache)
     {
-        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Starting RAG process"));
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Embedding the message for %s"), RagMode != ERagMode::Disabled ? TEXT("RAG") : TEXT("the response cache"));
 
-        Async(EAsyncExecution::Thread, [this, Message]()
+        const int32 Generation = RequestGeneration.load();
+        const EInferencePriority Priority = InferencePriority;
+        TWeakObjectPtr<ULlamaComponent> WeakThis(this);
+        EmbedText(Message, Priority, [this, WeakThis, Message, Generation, Priority, CacheStateHash](TArray<float> Embedding)
             {
-                TArray<float> Embedding = EmbedText(Message);
-
-                TArray<FString> RagDocuments = GetTopKDocuments(Embedding);
-
-                for (const FString& Doc : RagDocuments)
-                {
-                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Embedding selected document: %s"), *Doc);
-				}
-
-                if (RagMode == ERagMode::EmbeddingPlusReranker)
-                {
-                    RagDocuments = RerankDocuments(Message, RagDocuments);
-
-                    for (const FString& Doc : RagDocuments)
-                    {
-                        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Reranking selected document: %s"), *Doc);
-                    }
-                }
-
-                AsyncTask(ENamedThreads::GameThread, [this, RagDocuments]()
+                // Knowledge is only touched on the game thread, so the lookup happens there.
+                RunOnGameThread(WeakThis, Generation, [this, WeakThis, Message, Generation, Priority, CacheStateHash, Embedding = MoveTemp(Embedding)]()
                     {
-                        FString NewSystemMessage = SystemMessage;
+                        if (bUseResponseCache && RespondFromCache(Embedding, CacheStateHash))
+                        {
+                            return;
+                        }
 
-                        NewSystemMessage.Append(TEXT("\n\n"));
-                        NewSystemMessage.Append(TEXT("Relevant context for the query: \n"));
-                        for (const FString& Doc : RagDocuments)
+                        if (RagMode == ERagMode::Disabled)
                         {
-                            NewSystemMessage.Append(Doc);
-                            NewSystemMessage.Append(TEXT("\n"));
+                            if (!bStream)
+                            {
+                                SendRequest(WorldContext);
+                            }
+                            else
+                            {
+                                SendRequestStreaming(WorldContext);
+                            }
+                            return;
                         }
 
-                        if (!bStream)
+                        TArray<FString> RagDocuments = GetTopKDocuments(Embedding);
+
+                        for (const FString& Doc : RagDocuments)
                         {
-                            SendRequest(NewSystemMessage);
+                            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Embedding selected document: %s"), *Doc);
                         }
-                        else
+
+                        if (RagMode != ERagMode::EmbeddingPlusReranker)
                         {
-							SendRequestStreaming(NewSystemMessage);
+                            SendRequestWithDocuments(RagDocuments);
+                            return;
                         }
+
+                        RerankDocuments(Message, MoveTemp(RagDocuments), Priority, [this, WeakThis, Generation](TArray<FString> RerankedDocuments)
+                            {
+                                for (const FString& Doc : RerankedDocuments)
+                                {
+                                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Reranking selected document: %s"), *Doc);
+                                }
+
+                                RunOnGameThread(WeakThis, Generation, [this, RerankedDocuments = MoveTemp(RerankedDocuments)]()
+                                    {
+                                        SendRequestWithDocuments(RerankedDocuments);
+                                    });
+                            });
                     });
             });
     }
@@ -85,59 +131,141 @@ void ULlamaComponent::SendChatMessage(FString Message)
     {
         if (!bStream)
         {
-            SendRequest(SystemMessage);
+            SendRequest(WorldContext);
         }
         else
         {
-            SendRequestStreaming(SystemMessage);
+            SendRequestStreaming(WorldContext);
 		}
 	}
 }
 
-void ULlamaComponent::SendRequest(FString InSystemMessage)
+void ULlamaComponent::SendRequestWithDocuments(const TArray<FString>& RagDocuments)
 {
-    FString Url = FString::Printf(TEXT("http://localhost:%d/v1/chat/completions"), Port);
-    FString Content = CreateJsonRequest(InSystemMessage);
+    FString Context = WorldContext;
 
-    double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+    if (!Context.IsEmpty())
+    {
+        Context.Append(TEXT("\n\n"));
+    }
+    Context.Append(TEXT("Relevant context for the query: \n"));
+    for (const FString& Doc : RagDocuments)
+    {
+        Context.Append(Doc);
+        Context.Append(TEXT("\n"));
+    }
+
+    if (!bStream)
+    {
+        SendRequest(Context);
+    }
+    else
+    {
+        SendRequestStreaming(Context);
+    }
+}
+
+void ULlamaComponent::SendRequest(FString InContext)
+{
+    if (!FInferenceEndpointRouter::Get().HasAvailable(EInferenceBackend::Llama, GetLlamaEndpoints()))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No llama-server is available, skipping request"));
+        BroadcastFallbackResponse();
+        return;
+    }
+
+    const int32 Generation = RequestGeneration.load();
+
+    FInferenceScheduler::Get().Submit(EInferenceBackend::Llama, InferencePriority, this, [this, InContext = MoveTemp(InContext), Generation](FInferenceJobLeaseRef JobLease)
+        {
+            // Cancelled while it was still queued.
+            if (RequestGeneration.load() == Generation)
+            {
+                StartRequest(InContext, Generation, JobLease);
+            }
+        });
+}
+
+void ULlamaComponent::StartRequest(const FString& InContext, int32 Generation, FInferenceJobLeaseRef JobLease)
+{
+    // Picked when the job starts rather than when it is queued, so the load it is based on is current.
+    FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Llama, GetLlamaEndpoints(), SlotNpcId);
+    if (!EndpointLease.IsValid())
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No llama-server is available, skipping request"));
+        BroadcastFallbackResponse();
+        return;
+    }
+    const FInferenceEndpoint& SelectedEndpoint = EndpointLease->GetEndpoint();
 
-    TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
-    Request->SetURL(Url);
-    Request->SetVerb("POST");
-    Request->SetHeader("Content-Type", "application/json");
-    Request->SetContentAsString(Content);
+    FLlamaSlotLease SlotLease = FLlamaSlotManager::Get().AcquireSlot(SelectedEndpoint.Host, SelectedEndpoint.Port, SlotNpcId, ServerSlots, bSaveSlotState);
+    FString Content = CreateJsonRequest(InContext, SlotLease.SlotId);
+
+    double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+    const double TurnStartTime = TurnStartTimeBenchmark;
+    const bool bPrefilled = bTurnPrefilled;
+    TWeakObjectPtr<ULlamaComponent> WeakThis(this);
 
-    Request->OnProcessRequestComplete().BindLambda([this, StartTimeBenchmark](FHttpRequestPtr Req, FHttpResponsePtr Response, bool bWasSuccessful)
+    FNpcAiTaskPool::Get().Launch([this, WeakThis, Content = MoveTemp(Content), StartTimeBenchmark, SlotLease, Generation, TurnStartTime, bPrefilled, JobLease, EndpointLease]()
         {
+            ON_SCOPE_EXIT
+            {
+                FLlamaSlotManager::Get().ReleaseSlot(SlotLease);
+                EndpointLease->Release();
+                JobLease->Finish();
+            };
+            const FInferenceEndpoint& Endpoint = EndpointLease->GetEndpoint();
+            FLlamaSlotManager::Get().PrepareSlot(SlotLease);
+
+            FLlamaHttpResponse Response;
+            // Also gives up when the server is found to be down while the request is waiting.
+            FInferenceHealthMonitor& HealthMonitor = FInferenceHealthMonitor::Get();
+            bool bWasSuccessful = FLlamaConnectionPool::Get().Post(Endpoint.Host, Endpoint.Port, TEXT("/v1/chat/completions"), Content, Response, 60.0,
+                [WeakThis, Generation, &HealthMonitor, &Endpoint]() { return !IsRequestCurrent(WeakThis, Generation) || !HealthMonitor.IsAvailable(EInferenceBackend::Llama, Endpoint); });
+
             double EndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
             double DurationBenchmark = EndTimeBenchmark - StartTimeBenchmark;
 
-            if (!bWasSuccessful || !Response.IsValid())
+            if (!IsRequestCurrent(WeakThis, Generation))
+            {
+                return;
+            }
+
+            if (bWasSuccessful && Response.Code < 500)
+            {
+                HealthMonitor.ReportSuccess(EInferenceBackend::Llama, Endpoint, DurationBenchmark);
+            }
+            else
+            {
+                HealthMonitor.ReportFailure(EInferenceBackend::Llama, Endpoint);
+            }
+
+            if (!bWasSuccessful)
             {
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Request failed."));
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
             }
 
-            int32 Code = Response->GetResponseCode();
+            int32 Code = Response.Code;
             if (Code != 200)
             {
-                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] HTTP %d: %s"), Code, *Response->GetContentAsString());
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] HTTP %d: %s"), Code, *Response.Content);
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
             }
 
-            FString JsonResponse = Response->GetContentAsString();
+            const FString& JsonResponse = Response.Content;
             TSharedPtr<FJsonObject> JsonObject;
             TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(JsonResponse);
             if (!FJsonSerializer::Deserialize(Reader, JsonObject) || !JsonObject.IsValid())
@@ -145,9 +273,9 @@ void ULlamaComponent::SendRequest(FString InSystemMessage)
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Failed to parse JSON response"));
                 UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response: %s"), *JsonResponse);
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
@@ -158,9 +286,9 @@ void ULlamaComponent::SendRequest(FString InSystemMessage)
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] No choices found in response"));
                 UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response: %s"), *JsonResponse);
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
@@ -171,9 +299,9 @@ void ULlamaComponent::SendRequest(FString InSystemMessage)
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Invalid choice object in response"));
                 UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response: %s"), *JsonResponse);
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
@@ -184,213 +312,416 @@ void ULlamaComponent::SendRequest(FString InSystemMessage)
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] No message object found in choice"));
                 UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response: %s"), *JsonResponse);
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
             }
+            // A reply that only calls tools has no content.
+            TArray<FLlamaToolCall> ToolCalls;
+            FLlamaToolCallAccumulator::ParseMessage(**MessageObj, ToolCalls);
+
             FString ResponseContent;
-            if (!(*MessageObj)->TryGetStringField(TEXT("content"), ResponseContent) || ResponseContent.IsEmpty())
+            if ((!(*MessageObj)->TryGetStringField(TEXT("content"), ResponseContent) || ResponseContent.IsEmpty()) && ToolCalls.IsEmpty())
             {
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] No content field found in message"));
                 UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response: %s"), *JsonResponse);
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
             }
 
-            FString SanitizedResponse = SanitizeString(ResponseContent);
+            FLlamaStreamTimings Timings;
+            const TSharedPtr<FJsonObject>* TimingsObj;
+            const bool bHasTimings = JsonObject->TryGetObjectField(TEXT("timings"), TimingsObj);
+            if (bHasTimings)
+            {
+                (*TimingsObj)->TryGetNumberField(TEXT("prompt_n"), Timings.PromptTokens);
+                (*TimingsObj)->TryGetNumberField(TEXT("cache_n"), Timings.CachedTokens);
+                (*TimingsObj)->TryGetNumberField(TEXT("prompt_ms"), Timings.PromptMs);
+            }
+
+            TArray<FString> ActionCommands;
+            FString SanitizedResponse = FNpcAiTextSanitizer::Sanitize(ResponseContent, &ActionCommands);
             int32 LengthBenchmark = ResponseContent.Len();
             UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response received in %.2f ms, %d characters."), DurationBenchmark, LengthBenchmark);
             UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response: %s"), *ResponseContent);
 
-            AsyncTask(ENamedThreads::GameThread, [this, SanitizedResponse]()
+            const double TtftMs = EndTimeBenchmark - TurnStartTime;
+            RunOnGameThread(WeakThis, Generation, [this, SanitizedResponse, ActionCommands, ToolCalls = MoveTemp(ToolCalls), Timings, bHasTimings, TtftMs, bPrefilled]()
                 {
-                    OnResponseReceived.Broadcast(SanitizedResponse);
+                    if (bHasTimings)
+                    {
+                        RecordPromptTimings(Timings);
+                    }
+                    RecordTimeToFirstToken(TtftMs, bPrefilled);
+
+                    const bool bHasActions = !ActionCommands.IsEmpty() || !ToolCalls.IsEmpty();
+
+                    // Stored before the broadcast, so listeners can already tell that the reply is cached.
+                    StoreInResponseCache(SanitizedResponse, bHasActions);
+                    if (SanitizedResponse.IsEmpty() && bHasActions)
+                    {
+                        OnActionOnlyResponse.Broadcast();
+                    }
+                    else
+                    {
+                        OnResponseReceived.Broadcast(SanitizedResponse);
+                    }
+
+                    FChatMessage NewResponse;
+                    NewResponse.Role = "assistant";
+                    NewResponse.Content = PrependTurnOpener(SanitizedResponse);
+                    if (!ToolCalls.IsEmpty())
+                    {
+                        FLlamaToolCallAccumulator::AppendJson(NewResponse.ToolCalls, ToolCalls);
+                    }
+                    AddChatMessage(NewResponse);
+
+                    for (const FString& ActionCommand : ActionCommands)
+                    {
+                        HandleNpcAction(ActionCommand);
+                    }
+                    for (const FLlamaToolCall& ToolCall : ToolCalls)
+                    {
+                        HandleToolCall(ToolCall);
+                    }
+                    AddToolResultMessages(ToolCalls);
                 });
+        });
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Request sent to %s"), *SelectedEndpoint.ToString());
+}
+
+void ULlamaComponent::SendRequestStreaming(FString InContext)
+{
+    if (!FInferenceEndpointRouter::Get().HasAvailable(EInferenceBackend::Llama, GetLlamaEndpoints()))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No llama-server is available, skipping request"));
+        BroadcastFallbackResponse();
+        return;
+    }
 
-            FChatMessage NewResponse;
-            NewResponse.Role = "assistant";
-            NewResponse.Content = SanitizedResponse;
-            ChatHistory.Add(NewResponse);
+    const int32 Generation = RequestGeneration.load();
 
-            FRegexPattern ActionPattern(TEXT("\\[\\[action: (.+?)\\]\\]"));
-            FRegexMatcher Matcher(ActionPattern, ResponseContent);
-            while (Matcher.FindNext())
+    FInferenceScheduler::Get().Submit(EInferenceBackend::Llama, InferencePriority, this, [this, InContext = MoveTemp(InContext), Generation](FInferenceJobLeaseRef JobLease)
+        {
+            // Cancelled while it was still queued.
+            if (RequestGeneration.load() == Generation)
             {
-                FString ActionCommand = Matcher.GetCaptureGroup(1);
-                HandleNpcAction(ActionCommand);
+                StartRequestStreaming(InContext, Generation, JobLease);
             }
         });
-
-    Request->ProcessRequest();
-    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Request sent to %s"), *Url);
 }
 
-void ULlamaComponent::SendRequestStreaming(FString InSystemMessage)
+void ULlamaComponent::StartRequestStreaming(const FString& InContext, int32 Generation, FInferenceJobLeaseRef JobLease)
 {
-    FString Url = FString::Printf(TEXT("http://localhost:%d/v1/chat/completions"), Port);
-    FString Content = CreateJsonRequest(InSystemMessage);
+    // Picked when the job starts rather than when it is queued, so the load it is based on is current.
+    FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Llama, GetLlamaEndpoints(), SlotNpcId);
+    if (!EndpointLease.IsValid())
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No llama-server is available, skipping request"));
+        BroadcastFallbackResponse();
+        return;
+    }
+    const FInferenceEndpoint& SelectedEndpoint = EndpointLease->GetEndpoint();
 
-    double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+    FLlamaSlotLease SlotLease = FLlamaSlotManager::Get().AcquireSlot(SelectedEndpoint.Host, SelectedEndpoint.Port, SlotNpcId, ServerSlots, bSaveSlotState);
+    FString Content = CreateJsonRequest(InContext, SlotLease.SlotId);
 
-    FString RequestHeaders = FString::Printf(
-        TEXT("POST /v1/chat/completions HTTP/1.1\r\n")
-        TEXT("Host: localhost:%d\r\n")
-        TEXT("Content-Type: application/json\r\n")
-        TEXT("Accept: text/event-stream\r\n")
-        TEXT("Content-Length: %d\r\n")
-        TEXT("Connection: close\r\n\r\n"),
-        Port, Content.Len());
+    double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+    const double TurnStartTime = TurnStartTimeBenchmark;
+    const bool bPrefilled = bTurnPrefilled;
 
-    FString FullRequest = RequestHeaders + Content;
+    ActiveStreams++;
+    SetComponentTickEnabled(true);
+    TWeakObjectPtr<ULlamaComponent> WeakThis(this);
 
-    Async(EAsyncExecution::Thread, [this, FullRequest = MoveTemp(FullRequest), StartTimeBenchmark]()
+    // Members are only touched while WeakThis is current; the stream count and the token queue stay valid regardless,
+    // since IsReadyForFinishDestroy holds the component back until ActiveStreams is zero.
+    FNpcAiTaskPool::Get().Launch([this, WeakThis, Content = MoveTemp(Content), StartTimeBenchmark, SlotLease, Generation, TurnStartTime, bPrefilled, JobLease, EndpointLease]()
         {
-            ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
-            TSharedRef<FInternetAddr> Addr = SocketSubsystem->CreateInternetAddr();
-            bool bIsValid;
-            Addr->SetIp(TEXT("127.0.0.1"), bIsValid);
-            Addr->SetPort(Port);
-
-            if (!bIsValid)
+            ON_SCOPE_EXIT
             {
-                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Invalid IP address"));
-
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                FLlamaSlotManager::Get().ReleaseSlot(SlotLease);
+                EndpointLease->Release();
+                JobLease->Finish();
+                ActiveStreams--;
+            };
+            const FInferenceEndpoint& Endpoint = EndpointLease->GetEndpoint();
+            FLlamaSlotManager::Get().PrepareSlot(SlotLease);
+
+            FLlamaConnectionPool& Pool = FLlamaConnectionPool::Get();
+            FInferenceHealthMonitor& HealthMonitor = FInferenceHealthMonitor::Get();
+
+            FTCHARToUTF8 ConvertedBody(*Content);
+            FTCHARToUTF8 ConvertedHeaders(*FLlamaConnectionPool::BuildRequestHeaders(Endpoint.Host, Endpoint.Port, TEXT("/v1/chat/completions"), ConvertedBody.Length(), TEXT("text/event-stream")));
+
+            FLlamaConnection Connection;
+            auto LeaseAndSend = [&]() -> bool
+                {
+                    for (int32 Attempt = 0; Attempt < 2; ++Attempt)
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
-                    });
+                        Connection = Pool.Lease(Endpoint.Host, Endpoint.Port);
+                        if (!Connection.IsValid())
+                        {
+                            return false;
+                        }
 
-                return;
-            }
+                        if (FLlamaConnectionPool::SendAll(Connection.Socket, (const uint8*)ConvertedHeaders.Get(), ConvertedHeaders.Length())
+                            && FLlamaConnectionPool::SendAll(Connection.Socket, (const uint8*)ConvertedBody.Get(), ConvertedBody.Length()))
+                        {
+                            return true;
+                        }
+
+                        const bool bWasReused = Connection.bReused;
+                        Pool.Release(Connection, false);
+                        if (!bWasReused)
+                        {
+                            return false;
+                        }
+                        Pool.NotifyReconnect();
+                    }
+                    return false;
+                };
 
-            FSocket* Socket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("LlamaStreamSocket"), false);
-            if (!Socket || !Socket->Connect(*Addr))
+            if (!LeaseAndSend())
             {
-                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Failed to connect to Llama server on port %d"), Port);
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Failed to connect to Llama server at %s"), *Endpoint.ToString());
+                HealthMonitor.ReportFailure(EInferenceBackend::Llama, Endpoint);
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                StreamTokenQueue.Enqueue({ FString(), true, Generation });
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
             }
 
-            int32 BytesSent = 0;
-            auto ConvertedRequest = StringCast<UTF8CHAR>(*FullRequest);
-            Socket->Send((const uint8*)ConvertedRequest.Get(), ConvertedRequest.Length(), BytesSent);
-
-            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Sent streaming request, waiting for response..."));
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Sent streaming request on %s connection, waiting for response..."), Connection.bReused ? TEXT("reused") : TEXT("new"));
 
             constexpr int32 BufferSize = 8192;
             uint8 Buffer[BufferSize];
-            FString StreamedData;
+            FLlamaStreamParser Parser;
             bool bDone = false;
+            bool bStreamError = false;
+            bool bReceivedAny = false;
 
             FString FullResponse;
 
             const double TimeoutSeconds = 60.0;
+            const double DrainTimeoutSeconds = 1.0;
             double StartTime = FPlatformTime::Seconds();
+            double DoneTime = 0.0;
 
             double TokenStartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
             double ChunkStartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
 
-            while (!bDone && (FPlatformTime::Seconds() - StartTime) < TimeoutSeconds)
-            {
-                if (Socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromSeconds(1.0f)))
+            FLlamaStreamDelta Delta;
+            FLlamaStreamTimings Timings;
+            bool bHasTimings = false;
+
+            FLlamaToolCallAccumulator ToolCallAccumulator;
+            TArray<FLlamaToolCall> CompletedToolCalls;
+            TArray<FLlamaToolCall> TurnToolCalls;
+
+            auto EmitToken = [&](const FString& PartialText)
                 {
-                    int32 BytesRead = 0;
-                    if (Socket->Recv(Buffer, BufferSize, BytesRead))
+                    double TokenEndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+                    UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Llama] Token received in %.2f ms"), TokenEndTimeBenchmark - TokenStartTimeBenchmark);
+                    TokenStartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+
+                    if (FullResponse.IsEmpty() && !PartialText.IsEmpty())
+                    {
+                        const double TtftMs = TokenEndTimeBenchmark - TurnStartTime;
+                        RunOnGameThread(WeakThis, Generation, [this, TtftMs, bPrefilled]()
+                            {
+                                RecordTimeToFirstToken(TtftMs, bPrefilled);
+                            });
+                    }
+
+                    FullResponse.Append(PartialText);
+                    StreamTokenQueue.Enqueue({ PartialText, false, Generation });
+                };
+
+            // Each tool call is carried out as soon as its arguments are complete, not when the whole reply is.
+            auto DispatchToolCalls = [&](bool bFinished)
+                {
+                    ToolCallAccumulator.PopCompleted(CompletedToolCalls, bFinished);
+                    for (FLlamaToolCall& ToolCall : CompletedToolCalls)
+                    {
+                        TurnToolCalls.Add(ToolCall);
+                        RunOnGameThread(WeakThis, Generation, [this, ToolCall = MoveTemp(ToolCall)]()
+                            {
+                                // Whatever the NPC said before the call reaches the listeners first.
+                                DeliverStreamTokens(TNumericLimits<double>::Max());
+                                HandleToolCall(ToolCall);
+                            });
+                    }
+                    CompletedToolCalls.Reset();
+                };
+
+            auto HandleEvent = [&](const FLlamaSseEvent& Event)
+                {
+                    if (bDone)
+                    {
+                        return;
+                    }
+
+                    if (Event.bIsError)
+                    {
+                        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Server reported an error while streaming: %s"), *Event.ToString());
+                        bStreamError = true;
+                        return;
+                    }
+
+                    FUtf8StringView Data = Event.Data.TrimStartAndEnd();
+                    if (Data.Equals(UTF8TEXT("[DONE]")))
+                    {
+                        int32 LengthBenchmark = FullResponse.Len();
+                        double EndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+                        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response of %d characters received in %.2f ms"), LengthBenchmark, EndTimeBenchmark - StartTimeBenchmark);
+
+                        DispatchToolCalls(true);
+                        bDone = true;
+                        DoneTime = FPlatformTime::Seconds();
+                        StreamTokenQueue.Enqueue({ FString(), true, Generation });
+                        return;
+                    }
+
+                    if (FLlamaDeltaExtractor::Extract(Data, Delta))
                     {
-                        FString Chunk = FString(StringCast<TCHAR>((const UTF8CHAR*)Buffer, BytesRead).Get(), BytesRead);
-                        StreamedData += Chunk;
+                        if (Delta.bHasContent)
+                        {
+                            EmitToken(Delta.GetContent());
+                        }
+                        if (Delta.bHasFinishReason)
+                        {
+                            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Stream finished: %s"), *Delta.GetFinishReason());
+                            DispatchToolCalls(true);
+                        }
+                        if (Delta.bHasTimings)
+                        {
+                            Timings = Delta.Timings;
+                            bHasTimings = true;
+                            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Prompt: %d tokens (%d cached) in %.2f ms, generation: %d tokens at %.2f tokens/s"),
+                                Timings.PromptTokens, Timings.CachedTokens, Timings.PromptMs, Timings.PredictedTokens,
+                                Timings.PredictedMs > 0.0 ? Timings.PredictedTokens * 1000.0 / Timings.PredictedMs : 0.0);
+                        }
+                        return;
+                    }
 
-                        TArray<FString> Lines;
-                        Chunk.ParseIntoArrayLines(Lines);
-                        for (const FString& Line : Lines)
+                    FString Payload = Event.ToString();
+                    TSharedPtr<FJsonObject> JsonObject;
+                    TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Payload);
+                    if (FJsonSerializer::Deserialize(Reader, JsonObject) && JsonObject.IsValid())
+                    {
+                        const TArray<TSharedPtr<FJsonValue>>* Choices;
+                        if (JsonObject->TryGetArrayField(TEXT("choices"), Choices) && Choices->Num() > 0)
                         {
-                            if (Line.StartsWith("data: "))
+                            const TSharedPtr<FJsonObject>* DeltaObject;
+                            if ((*Choices)[0]->AsObject()->TryGetObjectField(TEXT("delta"), DeltaObject))
                             {
-                                FString Payload = Line.Mid(6).TrimStartAndEnd();
-                                if (Payload == TEXT("[DONE]"))
+                                const TArray<TSharedPtr<FJsonValue>>* ToolCallDeltas = nullptr;
+                                if ((*DeltaObject)->TryGetArrayField(TEXT("tool_calls"), ToolCallDeltas))
                                 {
-                                    int32 LengthBenchmark = FullResponse.Len();
-                                    double EndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
-                                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Response of %d characters received in %.2f ms"), LengthBenchmark, EndTimeBenchmark - StartTimeBenchmark);
-
-                                    bDone = true;
-                                    AsyncTask(ENamedThreads::GameThread, [this, bDone]()
-                                        {
-                                            OnStreamTokenReceived.Broadcast(TEXT(""), bDone);
-                                        });
-                                    break;
+                                    ToolCallAccumulator.AddDeltas(*ToolCallDeltas);
+                                    DispatchToolCalls(false);
                                 }
 
-                                TSharedPtr<FJsonObject> JsonObject;
-                                TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Payload);
-                                if (FJsonSerializer::Deserialize(Reader, JsonObject) && JsonObject.IsValid())
+                                FString PartialText;
+                                if ((*DeltaObject)->TryGetStringField(TEXT("content"), PartialText))
                                 {
-                                    const TArray<TSharedPtr<FJsonValue>>* Choices;
-                                    if (JsonObject->TryGetArrayField(TEXT("choices"), Choices) && Choices->Num() > 0)
-                                    {
-                                        const TSharedPtr<FJsonObject>* Delta;
-                                        if ((*Choices)[0]->AsObject()->TryGetObjectField(TEXT("delta"), Delta))
-                                        {
-                                            FString PartialText;
-                                            if ((*Delta)->TryGetStringField(TEXT("content"), PartialText))
-                                            {
-                                                double TokenEndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
-                                                UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Llama] Token received in %.2f ms"), TokenEndTimeBenchmark - TokenStartTimeBenchmark);
-                                                TokenStartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
-
-                                                FullResponse.Append(PartialText);
-                                                AsyncTask(ENamedThreads::GameThread, [this, PartialText, bDone]()
-                                                    {
-                                                        OnStreamTokenReceived.Broadcast(PartialText, bDone);
-                                                        UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Llama] Streamed token: %s"), *PartialText);
-                                                    });
-                                            }
-                                            else
-                                            {
-                                                UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No content field in delta"));
-                                                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Payload: %s"), *Payload);
-                                            }
-                                        }
-                                        else
-                                        {
-                                            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No delta field in choice"));
-                                            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Payload: %s"), *Payload);
-                                        }
-                                    }
-                                    else
-                                    {
-                                        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No choices found in streamed data"));
-                                        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Payload: %s"), *Payload);
-                                    }
+                                    EmitToken(PartialText);
                                 }
-                                else
+                                else if (!ToolCallDeltas)
                                 {
-                                    UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Failed to parse JSON from streamed data: %s"), *Payload);
+                                    UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No content field in delta"));
+                                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Payload: %s"), *Payload);
                                 }
                             }
                             else
                             {
-                                UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Llama] Ignoring line: %s"), *Line);
+                                UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No delta field in choice"));
+                                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Payload: %s"), *Payload);
                             }
                         }
+                        else
+                        {
+                            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No choices found in streamed data"));
+                            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Payload: %s"), *Payload);
+                        }
                     }
                     else
                     {
-                        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Failed to read data from socket"));
-                        bDone = true;
+                        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Failed to parse JSON from streamed data: %s"), *Payload);
+                    }
+                };
+
+            bool bCancelled = false;
+            while (!Parser.IsMessageComplete() && !Parser.HasError() && !bStreamError)
+            {
+                if (!IsRequestCurrent(WeakThis, Generation))
+                {
+                    // Dropping the connection mid-stream is what makes llama-server stop generating for this slot.
+                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Streaming request cancelled after %d characters"), FullResponse.Len());
+                    bCancelled = true;
+                    break;
+                }
+
+                const double Now = FPlatformTime::Seconds();
+                if (Now - StartTime >= TimeoutSeconds || (bDone && Now - DoneTime >= DrainTimeoutSeconds))
+                {
+                    break;
+                }
+
+                // A stream that is already producing tokens is left alone, whatever the other requests report.
+                if (!bReceivedAny && !HealthMonitor.IsAvailable(EInferenceBackend::Llama, Endpoint))
+                {
+                    UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] llama-server at %s is unavailable, giving up on the stream"), *Endpoint.ToString());
+                    break;
+                }
+
+                if (Connection.Socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromMilliseconds(100.0)))
+                {
+                    int32 BytesRead = 0;
+                    if (Connection.Socket->Recv(Buffer, BufferSize, BytesRead) && BytesRead > 0)
+                    {
+                        bReceivedAny = true;
+
+                        if (!Parser.Feed(Buffer, BytesRead, HandleEvent))
+                        {
+                            UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Malformed HTTP response while streaming"));
+                        }
+                    }
+                    else if (!bReceivedAny && Connection.bReused)
+                    {
+                        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Reused connection was closed by the server, reconnecting"));
+
+                        Pool.Release(Connection, false);
+                        Pool.NotifyReconnect();
+                        Parser.Reset();
+                        if (!LeaseAndSend())
+                        {
+                            UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Failed to reconnect to Llama server at %s"), *Endpoint.ToString());
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        Parser.NotifyConnectionClosed(HandleEvent);
+                        if (!bDone)
+                        {
+                            UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] Connection closed before the stream completed"));
+                        }
+                        break;
                     }
                 }
                 else
@@ -398,96 +729,523 @@ void ULlamaComponent::SendRequestStreaming(FString InSystemMessage)
                     UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Llama] No data ready to read yet..."));
                 }
             }
+
+            if (bCancelled)
+            {
+                Pool.Release(Connection, false);
+                return;
+            }
+
+            // A stream that ended without [DONE] (timeout, dropped connection, HTTP error) still closes the turn, so the
+            // sanitizer and segmenter hand out what they were holding back.
             if (!bDone)
             {
-                UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Streaming timed out after %.2f seconds"), TimeoutSeconds);
+                StreamTokenQueue.Enqueue({ FString(), true, Generation });
+            }
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
-                    {
-                        OnResponseReceived.Broadcast(TEXT(""));
-                    });
+            if (bDone || (Parser.IsMessageComplete() && Parser.GetStatusCode() < 500))
+            {
+                HealthMonitor.ReportSuccess(EInferenceBackend::Llama, Endpoint, FPlatformTime::Seconds() * 1000.0 - StartTimeBenchmark);
+            }
+            else
+            {
+                HealthMonitor.ReportFailure(EInferenceBackend::Llama, Endpoint);
+            }
+
+            if (Parser.IsHeaderComplete() && Parser.GetStatusCode() != 200)
+            {
+                const TArray<uint8>& ErrorBody = Parser.GetBody();
+                auto ConvertedError = StringCast<TCHAR>((const UTF8CHAR*)ErrorBody.GetData(), ErrorBody.Num());
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Llama] HTTP %d: %s"), Parser.GetStatusCode(), *FString(ConvertedError.Length(), ConvertedError.Get()));
+            }
+
+            if (!bDone && !bStreamError && !bCancelled && !Parser.IsMessageComplete() && !Parser.HasError())
+            {
+                UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Streaming timed out after %.2f seconds"), TimeoutSeconds);
             }
 
-            Socket->Close();
-            ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+            // The socket only goes back to the pool when the whole response, including the terminating chunk, was consumed.
+            const bool bKeepAlive = Parser.IsKeepAlive();
+            Pool.Release(Connection, bKeepAlive);
             UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Streamed response complete. Full response: %s"), *FullResponse);
-            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Socket closed after streaming"));
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Connection %s after streaming"), bKeepAlive ? TEXT("returned to pool") : TEXT("closed"));
 
-            if (FullResponse.IsEmpty())
+            if (FullResponse.IsEmpty() && TurnToolCalls.IsEmpty())
             {
                 UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] No response received from server"));
 
-                AsyncTask(ENamedThreads::GameThread, [this]()
+                RunOnGameThread(WeakThis, Generation, [this]()
                     {
-                        OnResponseReceived.Broadcast(TEXT(""));
+                        BroadcastFallbackResponse();
                     });
 
                 return;
             }
 
-            AsyncTask(ENamedThreads::GameThread, [this, FullResponse]()
+            RunOnGameThread(WeakThis, Generation, [this, FullResponse, TurnToolCalls = MoveTemp(TurnToolCalls), Timings, bHasTimings]()
                 {
+                    // Tokens still waiting for the next tick have to reach the listeners before the full response does.
+                    DeliverStreamTokens(TNumericLimits<double>::Max());
+
+                    if (bHasTimings)
+                    {
+                        RecordPromptTimings(Timings);
+                    }
+
                     FString SanitizedResponse = SanitizeString(FullResponse);
-                    OnResponseReceived.Broadcast(SanitizedResponse);
+                    StoreInResponseCache(SanitizedResponse, false);
+                    // Action tags and tool calls have been carried out by now, so bTurnTriggeredAction is complete.
+                    if (SanitizedResponse.IsEmpty() && bTurnTriggeredAction)
+                    {
+                        OnActionOnlyResponse.Broadcast();
+                    }
+                    else
+                    {
+                        OnResponseReceived.Broadcast(SanitizedResponse);
+                    }
+
                     FChatMessage NewResponse;
                     NewResponse.Role = "assistant";
-                    NewResponse.Content = SanitizedResponse;
-                    ChatHistory.Add(NewResponse);
-
-                    FRegexPattern ActionPattern(TEXT("\\[\\[action: (.+?)\\]\\]"));
-                    FRegexMatcher Matcher(ActionPattern, FullResponse);
-                    while (Matcher.FindNext())
+                    NewResponse.Content = PrependTurnOpener(SanitizedResponse);
+                    if (!TurnToolCalls.IsEmpty())
                     {
-                        FString ActionCommand = Matcher.GetCaptureGroup(1);
-                        HandleNpcAction(ActionCommand);
+                        FLlamaToolCallAccumulator::AppendJson(NewResponse.ToolCalls, TurnToolCalls);
                     }
+                    AddChatMessage(NewResponse);
+
+                    // Action tags and tool calls were already carried out as soon as they were complete.
+                    AddToolResultMessages(TurnToolCalls);
                 });
         });
 }
 
-FString ULlamaComponent::CreateJsonRequest(FString InSystemMessage)
+FString ULlamaComponent::CreateJsonRequest(const FString& InContext, int32 SlotId, bool bPrefillOnly)
 {
-    TSharedPtr<FJsonObject> RootObject = MakeShared<FJsonObject>();
-    RootObject->SetNumberField("temperature", Temperature);
-    RootObject->SetNumberField("top_p", TopP);
-    RootObject->SetNumberField("max_tokens", MaxTokens);
-    RootObject->SetNumberField("repeat_penalty", RepeatPenalty);
-    RootObject->SetNumberField("seed", Seed);
-    RootObject->SetBoolField("stream", bStream);
-
-    TArray<TSharedPtr<FJsonValue>> JsonMessages;
-    if (!SystemMessage.IsEmpty())
+    const bool bContextAfterHistory = PromptLayout == ELlamaPromptLayout::ContextAfterHistory && !ChatHistory.IsEmpty() && ChatHistory.Last().Role == TEXT("user");
+    const bool bSplitLastMessage = bContextAfterHistory && !InContext.IsEmpty();
+
+    FString OutputString;
+    OutputString.Reserve(RequestBuilder.GetSerializedLength() + SystemMessage.Len() + ConversationSummary.Len() + InContext.Len() + 512);
+
+    OutputString.Appendf(TEXT("{\"temperature\":%s,\"top_p\":%s,\"max_tokens\":%d,\"repeat_penalty\":%s,\"seed\":%d,\"stream\":%s,\"cache_prompt\":%s"),
+        *FString::SanitizeFloat(Temperature), *FString::SanitizeFloat(TopP), bPrefillOnly ? 0 : MaxTokens, *FString::SanitizeFloat(RepeatPenalty), Seed,
+        bStream && !bPrefillOnly ? TEXT("true") : TEXT("false"), bCachePrompt ? TEXT("true") : TEXT("false"));
+    if (bPrefillOnly)
+    {
+        OutputString.Append(TEXT(",\"n_predict\":0"));
+    }
+    if (SlotId >= 0)
+    {
+        OutputString.Appendf(TEXT(",\"id_slot\":%d"), SlotId);
+    }
+    if (!bPrefillOnly && !ActionGrammar.IsEmpty())
     {
-        TSharedPtr<FJsonObject> SystemObj = MakeShared<FJsonObject>();
-        SystemObj->SetStringField("role", "system");
-        SystemObj->SetStringField("content", InSystemMessage);
-        JsonMessages.Add(MakeShared<FJsonValueObject>(SystemObj));
+        OutputString.Append(TEXT(",\"grammar\":"));
+        FLlamaRequestBuilder::AppendJsonString(OutputString, ActionGrammar);
     }
-    for (const FChatMessage& Msg : ChatHistory)
+    if (!ActionToolsJson.IsEmpty())
     {
-        TSharedPtr<FJsonObject> MsgObj = MakeShared<FJsonObject>();
-        MsgObj->SetStringField("role", Msg.Role);
-        MsgObj->SetStringField("content", Msg.Content);
-        JsonMessages.Add(MakeShared<FJsonValueObject>(MsgObj));
+        // The chat template renders the tools into the prompt, so a prefill has to send them as well to match it.
+        OutputString.Append(TEXT(",\"tools\":"));
+        OutputString.Append(ActionToolsJson);
     }
-    RootObject->SetArrayField("messages", JsonMessages);
+    OutputString.Append(TEXT(",\"messages\":["));
 
-    FString OutputString;
-    TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&OutputString);
-    FJsonSerializer::Serialize(RootObject.ToSharedRef(), Writer);
+    // The summary only changes when the history is compacted, so it sits right after the persona and stays part of
+    // the cached prefix between compactions.
+    FString SystemContent = SystemMessage;
+    if (!ConversationSummary.IsEmpty())
+    {
+        SystemContent += (SystemContent.IsEmpty() ? TEXT("") : TEXT("\n\n")) + FString(TEXT("Summary of the earlier conversation:\n")) + ConversationSummary;
+    }
+    if (!bContextAfterHistory && !InContext.IsEmpty())
+    {
+        SystemContent += (SystemContent.IsEmpty() ? TEXT("") : TEXT("\n\n")) + InContext;
+    }
 
-	return OutputString;
-}
+    bool bHasMessages = false;
+    if (!SystemContent.IsEmpty())
+    {
+        FLlamaRequestBuilder::AppendMessageObject(OutputString, TEXT("system"), SystemContent);
+        bHasMessages = true;
+    }
+
+    // Everything before the newest user message is identical to the previous turn's prompt, so the volatile
+    // context goes into that message and the cached prefix stays valid.
+    const int32 NumSerialized = bSplitLastMessage ? ChatHistory.Num() - 1 : ChatHistory.Num();
+    if (NumSerialized > 0)
+    {
+        if (bHasMessages)
+        {
+            OutputString.AppendChar(TEXT(','));
+        }
+        RequestBuilder.AppendMessages(OutputString, NumSerialized);
+        bHasMessages = true;
+    }
+    if (bSplitLastMessage)
+    {
+        if (bHasMessages)
+        {
+            OutputString.AppendChar(TEXT(','));
+        }
+        const FChatMessage& LastMessage = ChatHistory.Last();
+        FLlamaRequestBuilder::AppendMessageObject(OutputString, LastMessage.Role, InContext + TEXT("\n") + LastMessage.Content);
+        bHasMessages = true;
+    }
+    if (!bPrefillOnly && !TurnOpener.IsEmpty())
+    {
+        // A trailing assistant message is continued by llama-server instead of starting a new reply.
+        if (bHasMessages)
+        {
+            OutputString.AppendChar(TEXT(','));
+        }
+        FLlamaRequestBuilder::AppendMessageObject(OutputString, TEXT("assistant"), TurnOpener);
+    }
+
+    OutputString.Append(TEXT("]}"));
+
+	return OutputString;
+}
+
+void ULlamaComponent::PrefillPrompt()
+{
+    // Without prompt caching the server throws the prefilled prefix away before the turn arrives.
+    if (bHistoryPrefilled || !bCachePrompt)
+    {
+        return;
+    }
+    if (!ChatHistory.IsEmpty() && ChatHistory.Last().Role == TEXT("user"))
+    {
+        UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Llama] A turn is still in flight, skipping prefill"));
+        return;
+    }
+    if (!FInferenceEndpointRouter::Get().HasAvailable(EInferenceBackend::Llama, GetLlamaEndpoints()))
+    {
+        return;
+    }
+
+    bHistoryPrefilled = true;
+    const int32 Generation = PrefillGeneration;
+
+    FInferenceScheduler::Get().Submit(EInferenceBackend::Llama, InferencePriority, this, [this, Generation](FInferenceJobLeaseRef JobLease)
+        {
+            // The history changed while the prefill was queued, so it would warm up a prefix nobody asks for anymore.
+            if (Generation == PrefillGeneration)
+            {
+                StartPrefill(Generation, JobLease);
+            }
+        });
+}
+
+void ULlamaComponent::StartPrefill(int32 Generation, FInferenceJobLeaseRef JobLease)
+{
+    // Picked when the job starts, like a turn, and from the server the next turn will stick to, since that is where
+    // the prefix has to be cached.
+    FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Llama, GetLlamaEndpoints(), SlotNpcId);
+    if (!EndpointLease.IsValid())
+    {
+        bHistoryPrefilled = false;
+        return;
+    }
+    const FInferenceEndpoint& SelectedEndpoint = EndpointLease->GetEndpoint();
+
+    // The context only belongs to the prefix when it is part of the system message; otherwise it travels with the
+    // next user message and must not be prefilled here.
+    const FString PrefixContext = PromptLayout == ELlamaPromptLayout::ContextInSystemMessage ? WorldContext : FString();
+
+    FLlamaSlotLease SlotLease = FLlamaSlotManager::Get().AcquireSlot(SelectedEndpoint.Host, SelectedEndpoint.Port, SlotNpcId, ServerSlots, bSaveSlotState);
+    FString Content = CreateJsonRequest(PrefixContext, SlotLease.SlotId, true);
+    TWeakObjectPtr<ULlamaComponent> WeakThis(this);
+
+    FNpcAiTaskPool::Get().Launch([WeakThis, Content = MoveTemp(Content), SlotLease, Generation, JobLease, EndpointLease]()
+        {
+            ON_SCOPE_EXIT
+            {
+                EndpointLease->Release();
+                JobLease->Finish();
+            };
+            const FInferenceEndpoint& Endpoint = EndpointLease->GetEndpoint();
+            FLlamaSlotManager::Get().PrepareSlot(SlotLease);
+
+            // The slot is handed back before the prefill itself, so the real request can pin the same slot and simply
+            // queue behind it on the server instead of being sent unpinned.
+            FLlamaSlotManager::Get().ReleaseSlot(SlotLease);
+
+            double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+
+            FLlamaHttpResponse Response;
+            bool bWasSuccessful = FLlamaConnectionPool::Get().Post(Endpoint.Host, Endpoint.Port, TEXT("/v1/chat/completions"), Content, Response);
+            double DurationBenchmark = FPlatformTime::Seconds() * 1000.0 - StartTimeBenchmark;
+
+            if (bWasSuccessful && Response.Code < 500)
+            {
+                FInferenceHealthMonitor::Get().ReportSuccess(EInferenceBackend::Llama, Endpoint, DurationBenchmark);
+            }
+            else
+            {
+                FInferenceHealthMonitor::Get().ReportFailure(EInferenceBackend::Llama, Endpoint);
+            }
+
+            if (bWasSuccessful && Response.Code == 200)
+            {
+                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Prompt prefix prefilled in %.2f ms"), DurationBenchmark);
+
+                // Only a prefill the server accepted counts for the time to first token of the next turn.
+                AsyncTask(ENamedThreads::GameThread, [WeakThis, Generation]()
+                    {
+                        if (WeakThis.IsValid())
+                        {
+                            WeakThis->ConfirmedPrefillGeneration = Generation;
+                        }
+                    });
+            }
+            else
+            {
+                UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Prefill request failed (HTTP %d): %s"), Response.Code, *Response.Content);
+            }
+        });
+}
+
+void ULlamaComponent::RecordTimeToFirstToken(double TtftMs, bool bPrefilled)
+{
+    int32& Turns = bPrefilled ? TtftStats.PrefilledTurns : TtftStats.ColdTurns;
+    float& AverageMs = bPrefilled ? TtftStats.PrefilledAverageMs : TtftStats.ColdAverageMs;
+
+    Turns++;
+    AverageMs += (static_cast<float>(TtftMs) - AverageMs) / Turns;
+    TtftStats.LastMs = static_cast<float>(TtftMs);
+    TtftStats.bLastWasPrefilled = bPrefilled;
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Time to first token: %.2f ms (%s). Average %.2f ms over %d prefilled turns, %.2f ms over %d turns without prefill."),
+        TtftMs, bPrefilled ? TEXT("prefilled") : TEXT("no prefill"), TtftStats.PrefilledAverageMs, TtftStats.PrefilledTurns, TtftStats.ColdAverageMs, TtftStats.ColdTurns);
+}
+
+void ULlamaComponent::AddChatMessage(const FChatMessage& Message)
+{
+    bHistoryPrefilled = false;
+    PrefillGeneration++;
+    ChatHistory.Add(Message);
+    RequestBuilder.AppendMessage(Message.Role, Message.Content, Message.ToolCalls, Message.ToolCallId);
+    HistoryTokenEstimate += EstimateTokens(Message);
+
+    // Compacting after the reply keeps the summary request out of the way of the next user turn.
+    if (Message.Role == TEXT("assistant"))
+    {
+        CompactHistoryIfNeeded();
+    }
+}
+
+int32 ULlamaComponent::EstimateTokens(const FChatMessage& Message)
+{
+    // Roughly four characters per token for English text, plus the chat template's per-message overhead.
+    return (Message.Content.Len() + Message.ToolCalls.Len() + Message.ToolCallId.Len()) / 4 + 4;
+}
+
+void ULlamaComponent::CompactHistoryIfNeeded()
+{
+    if (HistoryTokenBudget <= 0 || bSummaryInFlight || HistoryTokenEstimate <= HistoryTokenBudget)
+    {
+        return;
+    }
+
+    // Compact down to half the budget so the prefix (and its cache) only changes every few turns, and always cut
+    // right before a user message so the remaining history still alternates correctly.
+    const int32 TargetTokens = HistoryTokenBudget / 2;
+    int32 RemainingTokens = HistoryTokenEstimate;
+    int32 NumToCompact = 0;
+    for (int32 i = 0; i < ChatHistory.Num() - 1; ++i)
+    {
+        RemainingTokens -= EstimateTokens(ChatHistory[i]);
+        if (ChatHistory[i + 1].Role == TEXT("user"))
+        {
+            NumToCompact = i + 1;
+            if (RemainingTokens <= TargetTokens)
+            {
+                break;
+            }
+        }
+    }
+
+    if (NumToCompact == 0)
+    {
+        return;
+    }
+
+    FString Transcript;
+    if (!ConversationSummary.IsEmpty())
+    {
+        Transcript += TEXT("Summary so far:\n") + ConversationSummary + TEXT("\n\nNew messages:\n");
+    }
+    for (int32 i = 0; i < NumToCompact; ++i)
+    {
+        Transcript += ChatHistory[i].Role + TEXT(": ") + ChatHistory[i].Content + TEXT("\n");
+    }
+
+    FString Body = FString::Printf(TEXT("{\"temperature\":0.2,\"max_tokens\":%d,\"cache_prompt\":false,\"messages\":["), SummaryMaxTokens);
+    FLlamaRequestBuilder::AppendMessageObject(Body, TEXT("system"),
+        TEXT("Summarize the conversation below between a player (user) and you (assistant) in a few short sentences. Keep names, facts, promises and the player's goals. Reply with the summary only."));
+    Body.AppendChar(TEXT(','));
+    FLlamaRequestBuilder::AppendMessageObject(Body, TEXT("user"), Transcript);
+    Body.Append(TEXT("]}"));
+
+    bSummaryInFlight = true;
+    const int32 Generation = HistoryGeneration;
+    double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] History at ~%d tokens exceeds the budget of %d, summarizing the oldest %d messages"), HistoryTokenEstimate, HistoryTokenBudget, NumToCompact);
+
+    // The job may outlive the component, so it gets copies of what it needs and only comes back through the weak pointer.
+    TWeakObjectPtr<ULlamaComponent> WeakThis(this);
+    TArray<FInferenceEndpoint> Endpoints = GetLlamaEndpoints();
+    FString NpcId = SlotNpcId;
+    const int32 NumSlots = ServerSlots;
+    const bool bSaveState = bSaveSlotState;
+
+    FInferenceScheduler::Get().Launch(EInferenceBackend::Llama, EInferencePriority::Background, this,
+        [WeakThis, Body = MoveTemp(Body), Endpoints = MoveTemp(Endpoints), NpcId = MoveTemp(NpcId), NumSlots, bSaveState, Generation, NumToCompact, StartTimeBenchmark]() mutable
+        {
+            FString Summary;
+            bool bPostponed = false;
+
+            // The compaction rewrites the NPC's prefix right after, so its own slot is the one KV cache the summary
+            // costs nothing; while the slot is busy the summary waits for the next reply.
+            FLlamaHttpResponse Response;
+            const bool bWasSuccessful = PostToOwnSlot(Endpoints, NpcId, NumSlots, bSaveState, MoveTemp(Body), Response, bPostponed);
+
+            if (bPostponed)
+            {
+                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] The NPC's slot is busy, postponing the summary to the next reply"));
+            }
+            else if (bWasSuccessful && Response.Code == 200)
+            {
+                TSharedPtr<FJsonObject> JsonObject;
+                TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Response.Content);
+                const TArray<TSharedPtr<FJsonValue>>* Choices;
+                const TSharedPtr<FJsonObject>* MessageObj;
+                if (FJsonSerializer::Deserialize(Reader, JsonObject) && JsonObject.IsValid()
+                    && JsonObject->TryGetArrayField(TEXT("choices"), Choices) && Choices->Num() > 0
+                    && (*Choices)[0]->AsObject()->TryGetObjectField(TEXT("message"), MessageObj))
+                {
+                    (*MessageObj)->TryGetStringField(TEXT("content"), Summary);
+                }
+            }
+            else
+            {
+                UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Summary request failed (HTTP %d)"), Response.Code);
+            }
+
+            AsyncTask(ENamedThreads::GameThread, [WeakThis, Summary = Summary.TrimStartAndEnd(), bPostponed, Generation, NumToCompact, StartTimeBenchmark]()
+                {
+                    if (WeakThis.IsValid())
+                    {
+                        WeakThis->ApplyHistorySummary(Summary, bPostponed, Generation, NumToCompact, StartTimeBenchmark);
+                    }
+                });
+        });
+}
+
+bool ULlamaComponent::PostToOwnSlot(const TArray<FInferenceEndpoint>& Endpoints, const FString& NpcId, int32 NumSlots, bool bSaveState,
+    FString Body, FLlamaHttpResponse& OutResponse, bool& bOutSlotBusy)
+{
+    bOutSlotBusy = false;
+
+    FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Llama, Endpoints, NpcId);
+    if (!EndpointLease.IsValid())
+    {
+        return false;
+    }
+    ON_SCOPE_EXIT
+    {
+        EndpointLease->Release();
+    };
+    const FInferenceEndpoint Endpoint = EndpointLease->GetEndpoint();
+
+    FLlamaSlotLease SlotLease = FLlamaSlotManager::Get().AcquireSlot(Endpoint.Host, Endpoint.Port, NpcId, NumSlots, bSaveState);
+    if (NumSlots > 0 && !SlotLease.IsValid())
+    {
+        bOutSlotBusy = true;
+        return false;
+    }
+
+    FLlamaSlotManager::Get().PrepareSlot(SlotLease);
+    if (SlotLease.IsValid())
+    {
+        Body.InsertAt(1, FString::Printf(TEXT("\"id_slot\":%d,"), SlotLease.SlotId));
+    }
+
+    const double RequestStartTime = FPlatformTime::Seconds();
+    const bool bWasSuccessful = FLlamaConnectionPool::Get().Post(Endpoint.Host, Endpoint.Port, TEXT("/v1/chat/completions"), Body, OutResponse);
+    FLlamaSlotManager::Get().ReleaseSlot(SlotLease);
+
+    if (bWasSuccessful && OutResponse.Code < 500)
+    {
+        FInferenceHealthMonitor::Get().ReportSuccess(EInferenceBackend::Llama, Endpoint, (FPlatformTime::Seconds() - RequestStartTime) * 1000.0);
+    }
+    else
+    {
+        FInferenceHealthMonitor::Get().ReportFailure(EInferenceBackend::Llama, Endpoint);
+    }
+    return bWasSuccessful;
+}
+
+void ULlamaComponent::ApplyHistorySummary(const FString& Summary, bool bPostponed, int32 Generation, int32 NumToCompact, double StartTimeBenchmark)
+{
+    bSummaryInFlight = false;
+
+    if (bPostponed || Generation != HistoryGeneration || NumToCompact > ChatHistory.Num())
+    {
+        return;
+    }
+
+    if (Summary.IsEmpty())
+    {
+        // Without a summary the history keeps growing; only drop turns outright once it is far over budget.
+        if (HistoryTokenEstimate <= HistoryTokenBudget * 2)
+        {
+            return;
+        }
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Dropping the oldest %d messages without a summary"), NumToCompact);
+    }
+    else
+    {
+        ConversationSummary = Summary;
+    }
+
+    for (int32 i = 0; i < NumToCompact; ++i)
+    {
+        HistoryTokenEstimate -= EstimateTokens(ChatHistory[i]);
+    }
+    ChatHistory.RemoveAt(0, NumToCompact);
+    RequestBuilder.RemoveFirst(NumToCompact);
+    bHistoryPrefilled = false;
+    PrefillGeneration++;
+
+    double EndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Compacted %d messages in %.2f ms, history now ~%d tokens. Summary: %s"),
+        NumToCompact, EndTimeBenchmark - StartTimeBenchmark, HistoryTokenEstimate, *ConversationSummary);
+}
 
 void ULlamaComponent::HandleStreamChunk(const FString& Token, bool bDone)
 {
     FScopeLock Lock(&ChunkMutex);
 
-    AccumulatedChunk += Token;
+    StreamedResponse += Token;
+
+    // Filtering before segmenting means a span that is split across tokens or chunks never reaches text to speech,
+    // and periods inside a removed span do not end a chunk.
+    SanitizedToken.Reset();
+    StreamActionCommands.Reset();
+    Sanitizer.Append(Token, SanitizedToken, &StreamActionCommands);
+
+    for (const FString& ActionCommand : StreamActionCommands)
+    {
+        HandleNpcAction(ActionCommand);
+    }
 
     if (bDone)
     {
-		FString SanitizedChunk = SanitizeString(AccumulatedChunk);
+        Sanitizer.Flush(SanitizedToken);
+		FString SanitizedChunk = Segmenter.Flush(SanitizedToken).TrimStartAndEnd();
         if (SanitizedChunk.Len() > 1)
         {
             OnChunkReceived.Broadcast(SanitizedChunk, bDone);
@@ -500,53 +1258,15 @@ void ULlamaComponent::HandleStreamChunk(const FString& Token, bool bDone)
         {
 			OnChunkReceived.Broadcast(TEXT(""), bDone);
         }
-
-		AccumulatedChunk.Empty();
 		return;
 	}
 
-    TSet<FString> AbbreviationWhitelist = {
-    TEXT("Mr."), TEXT("Mrs."), TEXT("Ms."), TEXT("Dr."), TEXT("Jr.")
-    };
-
-    int32 LastDelimiterIndex = -1;
-
-    for (int32 i = 0; i < AccumulatedChunk.Len(); ++i)
-    {
-		TCHAR CurrentChar = AccumulatedChunk[i];
-        if (CurrentChar == '.' || CurrentChar == '!' || CurrentChar == '?' || CurrentChar == ';' || CurrentChar == '\n' || CurrentChar == '\r')
-        {
-            bool bIsAbbreviation = false;
-            if (CurrentChar == '.')
-            {
-                int32 Lookbehind = 8;
-                int32 Start = FMath::Max(0, i - Lookbehind + 1);
-                FString Sub = AccumulatedChunk.Mid(Start, i - Start + 1);
-                for (const FString& Abbr : AbbreviationWhitelist)
-                {
-                    if (Sub.EndsWith(Abbr))
-                    {
-                        bIsAbbreviation = true;
-                        break;
-                    }
-                }
-            }
-            if (!bIsAbbreviation)
-            {
-                LastDelimiterIndex = i;
-			}
-        }
-    }
-
-    if (LastDelimiterIndex == -1)
+    if (!Segmenter.Append(SanitizedToken, ChunkingSettings, SegmentedChunk))
     {
         return;
     }
 
-    FString Chunk = AccumulatedChunk.Left(LastDelimiterIndex + 1);
-    AccumulatedChunk = AccumulatedChunk.Mid(LastDelimiterIndex + 1);
-
-    Chunk = SanitizeString(Chunk);
+    FString Chunk = SegmentedChunk.TrimStartAndEnd();
 
     if (Chunk.Len() > 1)
     {
@@ -565,47 +1285,298 @@ void ULlamaComponent::HandleStreamChunk(const FString& Token, bool bDone)
 
 FString ULlamaComponent::SanitizeString(const FString& String)
 {
-    FString Result = String;
+    return FNpcAiTextSanitizer::Sanitize(String);
+}
 
-    auto RegexReplace = [](const FString& InputStr, const FString& PatternStr) -> FString
+TArray<FInferenceEndpoint> ULlamaComponent::GetLlamaEndpoints() const
+{
+    return FInferenceEndpointRouter::ResolveEndpoints(LlamaEndpoints, Port, LlamaHost);
+}
+
+TArray<FInferenceEndpoint> ULlamaComponent::GetEmbeddingEndpoints() const
+{
+    return FInferenceEndpointRouter::ResolveEndpoints(EmbeddingEndpoints, EmbeddingPort, LlamaHost);
+}
+
+TArray<FInferenceEndpoint> ULlamaComponent::GetRerankerEndpoints() const
+{
+    return FInferenceEndpointRouter::ResolveEndpoints(RerankerEndpoints, RerankerPort, LlamaHost);
+}
+
+void ULlamaComponent::BroadcastFallbackResponse()
+{
+    if (FallbackResponses.IsEmpty())
     {
-        FRegexPattern Pattern(PatternStr);
-        FString Output = InputStr;
+        OnResponseReceived.Broadcast(TEXT(""));
+        return;
+    }
 
-        FRegexMatcher Matcher(Pattern, Output);
-        while (Matcher.FindNext())
+    // Not added to the history, so the model never sees a line it did not write.
+    OnResponseReceived.Broadcast(FallbackResponses[FMath::RandRange(0, FallbackResponses.Num() - 1)]);
+}
+
+bool ULlamaComponent::IsRequestCurrent(const TWeakObjectPtr<ULlamaComponent>& WeakThis, int32 Generation)
+{
+    return WeakThis.IsValid() && WeakThis->RequestGeneration.load() == Generation;
+}
+
+void ULlamaComponent::RunOnGameThread(const TWeakObjectPtr<ULlamaComponent>& WeakThis, int32 Generation, TUniqueFunction<void()> Task)
+{
+    AsyncTask(ENamedThreads::GameThread, [WeakThis, Generation, Task = MoveTemp(Task)]()
         {
-            int32 Start = Matcher.GetMatchBeginning();
-            int32 Length = Matcher.GetMatchEnding() - Start;
-            Output.RemoveAt(Start, Length);
+            // Results of cancelled requests, and of components that are gone, are dropped instead of being broadcast.
+            if (IsRequestCurrent(WeakThis, Generation))
+            {
+                Task();
+            }
+        });
+}
+
+void ULlamaComponent::DeliverStreamTokens(double BudgetSeconds)
+{
+    const double StartTime = FPlatformTime::Seconds();
+    const int32 Generation = RequestGeneration.load();
 
-            Matcher = FRegexMatcher(Pattern, Output);
+    FString Merged;
+    bool bDone = false;
+    int32 NumTokens = 0;
+
+    FStreamToken Token;
+    while (!bDone && FPlatformTime::Seconds() - StartTime < BudgetSeconds && StreamTokenQueue.Dequeue(Token))
+    {
+        // Leftovers from a cancelled turn.
+        if (Token.Generation != Generation)
+        {
+            continue;
         }
 
-        return Output;
-    };
+        Merged.Append(Token.Text);
+        bDone = Token.bDone;
+        NumTokens++;
+    }
+
+    if (!Merged.IsEmpty())
+    {
+        UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | Llama] Delivering %d streamed tokens: %s"), NumTokens, *Merged);
+        OnStreamTokenReceived.Broadcast(Merged, false);
+    }
+    if (bDone)
+    {
+        OnStreamTokenReceived.Broadcast(TEXT(""), true);
+    }
+}
 
-    Result = RegexReplace(Result, TEXT("\\[\\[action: .*?\\]\\]"));
+void ULlamaComponent::CancelPendingRequests()
+{
+    RequestGeneration++;
+    bPendingCacheStore = false;
+
+    {
+        FScopeLock Lock(&ChunkMutex);
+        Sanitizer.Reset();
+        Segmenter.Reset();
+    }
 
-    Result = RegexReplace(Result, TEXT("\\[[^\\]]*\\]"));
+    // Close the interrupted turn with what the NPC got to say, so the history keeps alternating between user and assistant.
+    if (!ChatHistory.IsEmpty() && ChatHistory.Last().Role == TEXT("user"))
+    {
+        FChatMessage Interrupted;
+        Interrupted.Role = "assistant";
+        Interrupted.Content = PrependTurnOpener(SanitizeString(StreamedResponse).TrimEnd()) + TEXT("...");
+        AddChatMessage(Interrupted);
+    }
+    StreamedResponse.Empty();
 
-    Result = RegexReplace(Result, TEXT("\\*[^\\*]*\\*"));
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Pending requests cancelled"));
+}
 
-    Result = Result.TrimStartAndEnd();
+void ULlamaComponent::SetResponseOpener(FString Opener)
+{
+    NextResponseOpener = MoveTemp(Opener);
+}
 
-    return Result;
+FString ULlamaComponent::PrependTurnOpener(const FString& Response) const
+{
+    if (TurnOpener.IsEmpty())
+    {
+        return Response;
+    }
+    return Response.IsEmpty() ? TurnOpener : TurnOpener + TEXT(" ") + Response;
+}
+
+void ULlamaComponent::GenerateLines(const FString& Instruction, int32 Count, TUniqueFunction<void(TArray<FString>)> OnGenerated)
+{
+    FString Body = FString::Printf(TEXT("{\"temperature\":%s,\"top_p\":%s,\"max_tokens\":%d,\"cache_prompt\":false,\"messages\":["),
+        *FString::SanitizeFloat(FMath::Max(Temperature, 0.9f)), *FString::SanitizeFloat(TopP), 48 * Count);
+    if (!SystemMessage.IsEmpty())
+    {
+        FLlamaRequestBuilder::AppendMessageObject(Body, TEXT("system"), SystemMessage);
+        Body.AppendChar(TEXT(','));
+    }
+    FLlamaRequestBuilder::AppendMessageObject(Body, TEXT("user"),
+        FString::Printf(TEXT("%s Write %d different ones, each a single short sentence on its own line, in character. No numbering, no quotes, nothing else."), *Instruction, Count));
+    Body.Append(TEXT("]}"));
+
+    double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+
+    FInferenceScheduler::Get().Launch(EInferenceBackend::Llama, EInferencePriority::Background, this,
+        [Body = MoveTemp(Body), Endpoints = GetLlamaEndpoints(), NpcId = SlotNpcId, NumSlots = ServerSlots, bSaveState = bSaveSlotState, Count, StartTimeBenchmark, OnGenerated = MoveTemp(OnGenerated)]() mutable
+        {
+            FString Content;
+
+            FLlamaHttpResponse Response;
+            bool bSlotBusy = false;
+            if (PostToOwnSlot(Endpoints, NpcId, NumSlots, bSaveState, MoveTemp(Body), Response, bSlotBusy) && Response.Code == 200)
+            {
+                TSharedPtr<FJsonObject> JsonObject;
+                TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Response.Content);
+                const TArray<TSharedPtr<FJsonValue>>* Choices;
+                const TSharedPtr<FJsonObject>* MessageObj;
+                if (FJsonSerializer::Deserialize(Reader, JsonObject) && JsonObject.IsValid()
+                    && JsonObject->TryGetArrayField(TEXT("choices"), Choices) && Choices->Num() > 0
+                    && (*Choices)[0]->AsObject()->TryGetObjectField(TEXT("message"), MessageObj))
+                {
+                    (*MessageObj)->TryGetStringField(TEXT("content"), Content);
+                }
+            }
+            else if (bSlotBusy)
+            {
+                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] The NPC's slot is busy, skipping line generation"));
+            }
+            else
+            {
+                UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Line generation request failed (HTTP %d)"), Response.Code);
+            }
+
+            TArray<FString> Lines;
+            TArray<FString> RawLines;
+            Content.ParseIntoArrayLines(RawLines);
+            for (const FString& RawLine : RawLines)
+            {
+                // Models tend to number or bullet the lines and quote them anyway.
+                FStringView Line = FStringView(RawLine).TrimStartAndEnd();
+                while (!Line.IsEmpty() && (FChar::IsDigit(Line[0]) || Line[0] == TEXT('.') || Line[0] == TEXT(')') || Line[0] == TEXT('-') || Line[0] == TEXT('*') || FChar::IsWhitespace(Line[0])))
+                {
+                    Line.RightChopInline(1);
+                }
+                FString Sanitized = FNpcAiTextSanitizer::Sanitize(Line);
+                Sanitized.TrimCharInline(TEXT('"'), nullptr);
+                if (!Sanitized.IsEmpty() && Lines.Num() < Count)
+                {
+                    Lines.Add(MoveTemp(Sanitized));
+                }
+            }
+
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Generated %d lines in %.2f ms"), Lines.Num(), FPlatformTime::Seconds() * 1000.0 - StartTimeBenchmark);
+            OnGenerated(MoveTemp(Lines));
+        });
 }
 
 void ULlamaComponent::ClearChatHistory()
 {
     ChatHistory.Empty();
+    RequestBuilder.Reset();
+    ConversationSummary.Empty();
+    HistoryTokenEstimate = 0;
+    HistoryGeneration++;
+    bHistoryPrefilled = false;
+    PrefillGeneration++;
     UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Chat history cleared"));
 }
 
-TArray<float> ULlamaComponent::EmbedText(const FString& Text)
+uint32 ULlamaComponent::ComputeCacheStateHash() const
+{
+    uint32 Hash = HashCombine(GetTypeHash(SystemMessage), GetTypeHash(WorldContext));
+    Hash = HashCombine(Hash, GetTypeHash(ConversationSummary));
+    for (int32 i = FMath::Max(0, ChatHistory.Num() - ResponseCacheContextMessages); i < ChatHistory.Num(); ++i)
+    {
+        Hash = HashCombine(Hash, HashCombine(GetTypeHash(ChatHistory[i].Role), GetTypeHash(ChatHistory[i].Content)));
+    }
+    return Hash;
+}
+
+bool ULlamaComponent::RespondFromCache(const TArray<float>& Embedding, uint32 StateHash)
+{
+    if (Embedding.IsEmpty())
+    {
+        return false;
+    }
+
+    const double NowMs = FPlatformTime::Seconds() * 1000.0;
+    FString CachedResponse;
+    if (!ResponseCache.Find(Embedding, StateHash, ResponseCacheSimilarity, NowMs / 1000.0, CachedResponse))
+    {
+        PendingCacheEmbedding = Embedding;
+        PendingCacheStateHash = StateHash;
+        PendingCacheStartMs = NowMs;
+        bPendingCacheStore = true;
+        return false;
+    }
+
+    const FNpcResponseCacheStats& Stats = ResponseCache.GetStats();
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Cache] Answered from the response cache %.2f ms after the message was sent (hit rate %.0f%%, %.0f ms saved so far): %s"),
+        NowMs - TurnStartTimeBenchmark, 100.0f * Stats.HitRate, Stats.SavedMs, *CachedResponse);
+
+    OnResponseReceived.Broadcast(CachedResponse);
+
+    FChatMessage NewResponse;
+    NewResponse.Role = "assistant";
+    NewResponse.Content = PrependTurnOpener(CachedResponse);
+    AddChatMessage(NewResponse);
+    return true;
+}
+
+void ULlamaComponent::StoreInResponseCache(const FString& Response, bool bHasActions)
+{
+    if (!bPendingCacheStore)
+    {
+        return;
+    }
+    bPendingCacheStore = false;
+
+    // Replaying a reply must not replay what it did to the world. A reply that continues an opener is not complete
+    // on its own.
+    if (Response.IsEmpty() || bHasActions || bTurnTriggeredAction || !TurnOpener.IsEmpty())
+    {
+        return;
+    }
+
+    const double NowMs = FPlatformTime::Seconds() * 1000.0;
+    ResponseCache.Add(MoveTemp(PendingCacheEmbedding), PendingCacheStateHash, Response, NowMs - PendingCacheStartMs, NowMs / 1000.0,
+        ResponseCacheTtlSeconds, ResponseCacheMaxEntries);
+}
+
+FLlamaConnectionPoolStats ULlamaComponent::GetConnectionPoolStats()
+{
+    return FLlamaConnectionPool::Get().GetStats();
+}
+
+FLlamaSlotManagerStats ULlamaComponent::GetSlotManagerStats()
+{
+    return FLlamaSlotManager::Get().GetStats();
+}
+
+void ULlamaComponent::RecordPromptTimings(const FLlamaStreamTimings& Timings)
 {
-    TArray<float> EmbeddingResult;
+    // prompt_n only counts the tokens that had to be evaluated; cache_n are the ones reused from the slot's KV cache.
+    const int32 TotalTokens = Timings.PromptTokens + Timings.CachedTokens;
+
+    PromptCacheStats.Turns++;
+    PromptCacheStats.LastPromptTokens = Timings.PromptTokens;
+    PromptCacheStats.LastCachedTokens = Timings.CachedTokens;
+    PromptCacheStats.TotalPromptTokens += Timings.PromptTokens;
+    PromptCacheStats.TotalCachedTokens += Timings.CachedTokens;
+
+    const int64 SessionTokens = PromptCacheStats.TotalPromptTokens + PromptCacheStats.TotalCachedTokens;
+    PromptCacheStats.CachedRatio = SessionTokens > 0 ? static_cast<float>(static_cast<double>(PromptCacheStats.TotalCachedTokens) / SessionTokens) : 0.0f;
 
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Prefill: %d of %d prompt tokens evaluated in %.2f ms, %d reused from cache (%.1f%%). Session: %.1f%% cached over %d turns."),
+        Timings.PromptTokens, TotalTokens, Timings.PromptMs, Timings.CachedTokens, TotalTokens > 0 ? 100.0 * Timings.CachedTokens / TotalTokens : 0.0,
+        100.0 * PromptCacheStats.CachedRatio, PromptCacheStats.Turns);
+}
+
+void ULlamaComponent::EmbedText(const FString& Text, EInferencePriority Priority, TUniqueFunction<void(TArray<float>)> OnEmbedded)
+{
     TSharedPtr<FJsonObject> JsonRequest = MakeShared<FJsonObject>();
     JsonRequest->SetStringField("input", Text);
 
@@ -613,26 +1584,25 @@ TArray<float> ULlamaComponent::EmbedText(const FString& Text)
     TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&RequestString);
     FJsonSerializer::Serialize(JsonRequest.ToSharedRef(), Writer);
 
-    FString Url = FString::Printf(TEXT("http://localhost:%d/v1/embeddings"), EmbeddingPort);
-    TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
-    Request->SetURL(Url);
-    Request->SetVerb(TEXT("POST"));
-    Request->SetHeader(TEXT("Content-Type"), TEXT("application/json"));
-    Request->SetContentAsString(RequestString);
-
-    FEvent* CompletionEvent = FPlatformProcess::GetSynchEventFromPool(true);
-
 	double StartTime = FPlatformTime::Seconds() * 1000.0;
 
-    Request->OnProcessRequestComplete().BindLambda([&](FHttpRequestPtr Req, FHttpResponsePtr Res, bool bConnected)
+    // The worker may outlive the component, so it gets copies of the settings instead of touching members.
+    FInferenceScheduler::Get().Launch(EInferenceBackend::Embedding, Priority, this,
+        [RequestString = MoveTemp(RequestString), Priority, Endpoints = GetEmbeddingEndpoints(), bHedge = bHedgeShortRequests, StartTime, OnEmbedded = MoveTemp(OnEmbedded)]()
         {
+            TArray<float> EmbeddingResult;
+
+            // While the embedding server is down every lookup fails fast with an empty embedding.
+            FLlamaHttpResponse Response;
+            bool bConnected = FInferenceHedging::Get().Post(EInferenceBackend::Embedding, Priority, Endpoints, TEXT("/v1/embeddings"), RequestString, Response, bHedge);
+
 			double EndTime = FPlatformTime::Seconds() * 1000.0;
 			double Duration = EndTime - StartTime;
 
-            if (bConnected && Res.IsValid() && EHttpResponseCodes::IsOk(Res->GetResponseCode()))
+            if (bConnected && EHttpResponseCodes::IsOk(Response.Code))
             {
                 TSharedPtr<FJsonObject> JsonObject;
-				FString Content = Res->GetContentAsString();
+				const FString& Content = Response.Content;
 				TSharedRef<TJsonReader<>> JsonReader = TJsonReaderFactory<>::Create(Content);
                 if (FJsonSerializer::Deserialize(JsonReader, JsonObject) && JsonObject.IsValid())
                 {
@@ -666,106 +1636,317 @@ TArray<float> ULlamaComponent::EmbedText(const FString& Text)
             }
             else
             {
-                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Embedding request failed: %s"), Res.IsValid() ? *Res->GetContentAsString() : TEXT("No response"));
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Embedding request failed: %s"), bConnected ? *Response.Content : TEXT("No response or server unavailable"));
+            }
+
+            OnEmbedded(MoveTemp(EmbeddingResult));
+        });
+}
+
+// Chunks are embedded KnowledgeBatchSize at a time, with KnowledgeBatchesInFlight batches queued at once, and published to
+// Knowledge together once the last one is back, so the game thread never sees a half built knowledge base.
+struct ULlamaComponent::FKnowledgeBuild
+{
+    TArray<FKnowledgeEntry> Entries;
+    FKnowledgeIndexKey IndexKey;
+    FString IndexPath;
+    std::atomic<int32> NextEntry{ 0 };
+    std::atomic<int32> Remaining{ 0 };
+    int32 BatchSize = 1;
+    double StartTime = 0.0;
+    int32 NumCharacters = 0;
+};
+
+void ULlamaComponent::EmbedTexts(TArray<FString> Texts, EInferencePriority Priority, TUniqueFunction<void(TArray<TArray<float>>)> OnEmbedded)
+{
+    TArray<TSharedPtr<FJsonValue>> Inputs;
+    for (const FString& Text : Texts)
+    {
+        Inputs.Add(MakeShared<FJsonValueString>(Text));
+    }
+
+    TSharedPtr<FJsonObject> JsonRequest = MakeShared<FJsonObject>();
+    JsonRequest->SetArrayField("input", Inputs);
+
+    FString RequestString;
+    TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&RequestString);
+    FJsonSerializer::Serialize(JsonRequest.ToSharedRef(), Writer);
+
+    const int32 NumTexts = Texts.Num();
+    double StartTime = FPlatformTime::Seconds() * 1000.0;
+
+    FInferenceScheduler::Get().Launch(EInferenceBackend::Embedding, Priority, this,
+        [RequestString = MoveTemp(RequestString), Priority, Endpoints = GetEmbeddingEndpoints(), NumTexts, StartTime, OnEmbedded = MoveTemp(OnEmbedded)]()
+        {
+            TArray<TArray<float>> Embeddings;
+            Embeddings.SetNum(NumTexts);
+
+            FLlamaHttpResponse Response;
+            bool bConnected = FInferenceHedging::Get().Post(EInferenceBackend::Embedding, Priority, Endpoints, TEXT("/v1/embeddings"), RequestString, Response, false);
+
+            double Duration = FPlatformTime::Seconds() * 1000.0 - StartTime;
+
+            if (bConnected && EHttpResponseCodes::IsOk(Response.Code))
+            {
+                int32 NumEmbedded = 0;
+                TSharedPtr<FJsonObject> JsonObject;
+                TSharedRef<TJsonReader<>> JsonReader = TJsonReaderFactory<>::Create(Response.Content);
+                const TArray<TSharedPtr<FJsonValue>>* Data;
+                if (FJsonSerializer::Deserialize(JsonReader, JsonObject) && JsonObject.IsValid() && JsonObject->TryGetArrayField(TEXT("data"), Data))
+                {
+                    for (int32 i = 0; i < Data->Num(); i++)
+                    {
+                        // The server says which input each embedding belongs to; without an index they are taken in order.
+                        const TSharedPtr<FJsonObject> Item = (*Data)[i]->AsObject();
+                        const TArray<TSharedPtr<FJsonValue>>* Values;
+                        int32 Index = i;
+                        if (!Item.IsValid() || !Item->TryGetArrayField(TEXT("embedding"), Values))
+                        {
+                            continue;
+                        }
+                        Item->TryGetNumberField(TEXT("index"), Index);
+                        if (!Embeddings.IsValidIndex(Index) || !Embeddings[Index].IsEmpty())
+                        {
+                            continue;
+                        }
+
+                        Embeddings[Index].Reserve(Values->Num());
+                        for (const TSharedPtr<FJsonValue>& Value : *Values)
+                        {
+                            Embeddings[Index].Add(Value->AsNumber());
+                        }
+                        NumEmbedded++;
+                    }
+                }
+
+                if (NumEmbedded < NumTexts)
+                {
+                    UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Embedding batch returned %d of %d embeddings"), NumEmbedded, NumTexts);
+                }
+                UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | RAG] Embedded %d texts in %.2f ms."), NumEmbedded, Duration);
+            }
+            else
+            {
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Embedding batch request failed: %s"), bConnected ? *Response.Content : TEXT("No response or server unavailable"));
+            }
+
+            OnEmbedded(MoveTemp(Embeddings));
+        });
+}
+
+void ULlamaComponent::GenerateKnowledge(bool bIgnoreIndex)
+{
+    // Everything the build needs is copied here on the game thread, since the job may outlive the component, and its
+    // results only come back through the weak pointer.
+    TWeakObjectPtr<ULlamaComponent> WeakThis(this);
+    TSharedRef<FKnowledgeBuild, ESPMode::ThreadSafe> Build = MakeShared<FKnowledgeBuild, ESPMode::ThreadSafe>();
+    Build->BatchSize = FMath::Max(1, KnowledgeBatchSize);
+    Build->IndexKey.SentencesPerChunk = SentencesPerChunk;
+    Build->IndexKey.SentenceOverlap = SentenceOverlap;
+    Build->IndexKey.ModelId = EmbeddingModelId;
+    const int32 BatchesInFlight = FMath::Max(1, KnowledgeBatchesInFlight);
+
+    // Scheduled as embedding work, since it asks the embedding server for its model, so a crowd of NPCs loading
+    // their knowledge at once cannot take every pool thread from the requests of the player's conversation.
+    FInferenceScheduler::Get().Launch(EInferenceBackend::Embedding, EInferencePriority::Background, this,
+        [WeakThis, Build, BatchesInFlight, bIgnoreIndex, DocumentPath = KnowledgePath, IndexFolder = KnowledgeIndexFolder, bPersistIndex = bPersistKnowledgeIndex, Endpoints = GetEmbeddingEndpoints()]()
+        {
+            FString FileContent;
+            if (!FFileHelper::LoadFileToString(FileContent, *DocumentPath))
+            {
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Failed to read document: %s"), *DocumentPath);
+                return;
+            }
+
+            FKnowledgeIndexKey& IndexKey = Build->IndexKey;
+            FTCHARToUTF8 ConvertedContent(*FileContent);
+            FSHA1::HashBuffer(ConvertedContent.Get(), ConvertedContent.Length(), IndexKey.SourceHash.Hash);
+            if (IndexKey.ModelId.IsEmpty() && bPersistIndex)
+            {
+                IndexKey.ModelId = QueryEmbeddingModelId(Endpoints);
+            }
+
+            Build->IndexPath = bPersistIndex && !IndexKey.ModelId.IsEmpty() ? FKnowledgeIndex::GetIndexPath(IndexFolder, DocumentPath) : FString();
+            const double IndexStartTime = FPlatformTime::Seconds() * 1000.0;
+            TArray<FKnowledgeEntry> IndexedEntries;
+            if (!Build->IndexPath.IsEmpty() && !bIgnoreIndex && FKnowledgeIndex::Load(Build->IndexPath, IndexKey, IndexedEntries))
+            {
+                FKnowledgeMatrix Matrix;
+                Matrix.Build(MoveTemp(IndexedEntries));
+                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Loaded %d knowledge chunks from %s in %.2f ms."), Matrix.Num(), *Build->IndexPath, FPlatformTime::Seconds() * 1000.0 - IndexStartTime);
+                AsyncTask(ENamedThreads::GameThread, [WeakThis, Matrix = MoveTemp(Matrix)]() mutable
+                    {
+                        if (WeakThis.IsValid())
+                        {
+                            WeakThis->Knowledge = MoveTemp(Matrix);
+                            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Knowledge generation complete."));
+                        }
+                    });
+                return;
+            }
+
+            TArray<FString> Sentences;
+            FString AccumulatedSentence;
+            for (int32 i = 0; i < FileContent.Len(); ++i)
+            {
+                const TCHAR c = FileContent[i];
+                AccumulatedSentence.AppendChar(c);
+                if ((c == '.' || c == '!' || c == '?') && (i + 1 >= FileContent.Len() || FileContent[i + 1] == ' ' 
+                    || FileContent[i + 1] == '\n' || FileContent[i + 1] == '\r' || FileContent[i + 1] == '\t'))
+                {
+                    FString S = AccumulatedSentence.TrimStartAndEnd();
+                    if (!S.IsEmpty())
+                    {
+                        Sentences.Add(S);
+                    }
+                    AccumulatedSentence.Empty();
+                }
+            }
+            if (!AccumulatedSentence.TrimStartAndEnd().IsEmpty())
+            {
+                Sentences.Add(AccumulatedSentence.TrimStartAndEnd());
             }
 
-            CompletionEvent->Trigger();
-        });
+            Build->StartTime = FPlatformTime::Seconds() * 1000.0;
+            Build->NumCharacters = FileContent.Len();
+
+            int32 Step = FMath::Max(1, IndexKey.SentencesPerChunk - IndexKey.SentenceOverlap);
+            for (int32 i = 0; i < Sentences.Num(); i += Step)
+            {
+                int32 EndIdx = FMath::Min(i + IndexKey.SentencesPerChunk, Sentences.Num());
 
-    Request->ProcessRequest();
-	UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Embedding request sent to %s"), *Url);
+                FString ChunkText;
+                for (int32 j = i; j < EndIdx; j++)
+                {
+                    if (!ChunkText.IsEmpty())
+                        ChunkText += TEXT(" ");
+                    ChunkText += Sentences[j];
+                }
 
-    CompletionEvent->Wait();
-    FPlatformProcess::ReturnSynchEventToPool(CompletionEvent);
+                FKnowledgeEntry& Chunk = Build->Entries.AddDefaulted_GetRef();
+                Chunk.Text = ChunkText;
+            }
 
-    return EmbeddingResult;
+            Build->Remaining = Build->Entries.Num();
+            AsyncTask(ENamedThreads::GameThread, [WeakThis, Build, BatchesInFlight]()
+                {
+                    if (!WeakThis.IsValid())
+                    {
+                        return;
+                    }
+                    for (int32 i = 0; i < BatchesInFlight; i++)
+                    {
+                        WeakThis->EmbedNextKnowledgeBatch(Build);
+                    }
+                });
+        });
 }
 
-void ULlamaComponent::GenerateKnowledge()
+FString ULlamaComponent::QueryEmbeddingModelId(const TArray<FInferenceEndpoint>& Endpoints)
 {
-    Knowledge.Empty();
+    FString ModelId;
 
-    FString FileContent;
-    if (!FFileHelper::LoadFileToString(FileContent, *KnowledgePath))
+    FLlamaHttpResponse Response;
+    bool bWasSuccessful = false;
+    FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Embedding, Endpoints);
+    if (EndpointLease.IsValid())
     {
-        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Failed to read document: %s"), *KnowledgePath);
-        return;
-    }
+        const FInferenceEndpoint Endpoint = EndpointLease->GetEndpoint();
+        const double RequestStartTime = FPlatformTime::Seconds();
+        bWasSuccessful = FLlamaConnectionPool::Get().Fetch(Endpoint.Host, Endpoint.Port, TEXT("/v1/models"), Response);
+        EndpointLease->Release();
 
-    TArray<FString> Sentences;
-    FString AccumulatedSentence;
-    for (int32 i = 0; i < FileContent.Len(); ++i)
-    {
-        const TCHAR c = FileContent[i];
-        AccumulatedSentence.AppendChar(c);
-        if ((c == '.' || c == '!' || c == '?') && (i + 1 >= FileContent.Len() || FileContent[i + 1] == ' ' 
-            || FileContent[i + 1] == '\n' || FileContent[i + 1] == '\r' || FileContent[i + 1] == '\t'))
+        if (bWasSuccessful && Response.Code < 500)
         {
-            FString S = AccumulatedSentence.TrimStartAndEnd();
-            if (!S.IsEmpty())
-            {
-                Sentences.Add(S);
-            }
-            AccumulatedSentence.Empty();
+            FInferenceHealthMonitor::Get().ReportSuccess(EInferenceBackend::Embedding, Endpoint, (FPlatformTime::Seconds() - RequestStartTime) * 1000.0);
+        }
+        else
+        {
+            FInferenceHealthMonitor::Get().ReportFailure(EInferenceBackend::Embedding, Endpoint);
         }
     }
-    if (!AccumulatedSentence.TrimStartAndEnd().IsEmpty())
-    {
-        Sentences.Add(AccumulatedSentence.TrimStartAndEnd());
-    }
-
-	double StartTime = FPlatformTime::Seconds() * 1000.0;
 
-    int32 Step = FMath::Max(1, SentencesPerChunk - SentenceOverlap);
-    for (int32 i = 0; i < Sentences.Num(); i += Step)
+    if (bWasSuccessful && Response.Code == 200)
     {
-        int32 EndIdx = FMath::Min(i + SentencesPerChunk, Sentences.Num());
-
-        FString ChunkText;
-        for (int32 j = i; j < EndIdx; j++)
+        // llama-server lists the one model it serves, named after its alias or file.
+        TSharedPtr<FJsonObject> JsonObject;
+        TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Response.Content);
+        const TArray<TSharedPtr<FJsonValue>>* Models;
+        if (FJsonSerializer::Deserialize(Reader, JsonObject) && JsonObject.IsValid()
+            && JsonObject->TryGetArrayField(TEXT("data"), Models) && Models->Num() > 0 && (*Models)[0]->AsObject().IsValid())
         {
-            if (!ChunkText.IsEmpty())
-                ChunkText += TEXT(" ");
-            ChunkText += Sentences[j];
+            (*Models)[0]->AsObject()->TryGetStringField(TEXT("id"), ModelId);
         }
-
-        TArray<float> Emb = EmbedText(ChunkText);
-
-        FKnowledgeEntry Chunk;
-        Chunk.Text = ChunkText;
-        Chunk.Embedding = Emb;
-        Knowledge.Add(Chunk);
     }
 
-	double EndTime = FPlatformTime::Seconds() * 1000.0;
-	UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Generated knowledge in %.2f ms for document of %d characters."), EndTime - StartTime, FileContent.Len());
+    if (ModelId.IsEmpty())
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] The embedding server did not name its model (HTTP %d), not using a knowledge index. Set EmbeddingModelId to use one anyway."), Response.Code);
+    }
+    return ModelId;
 }
 
-float ULlamaComponent::ComputeCosineSimilarity(const TArray<float>& A, const TArray<float>& B)
+void ULlamaComponent::EmbedNextKnowledgeBatch(const TSharedRef<FKnowledgeBuild, ESPMode::ThreadSafe>& Build)
 {
-    if (A.Num() == 0 || B.Num() == 0 || A.Num() != B.Num())
+    const int32 First = Build->NextEntry.fetch_add(Build->BatchSize);
+    if (First >= Build->Entries.Num())
     {
-        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Invalid vectors for cosine similarity calculation"));
-        return 0;
+        return;
     }
-    double DotProduct = 0.0;
-    double NormA = 0.0;
-    double NormB = 0.0;
 
-    for (int32 i = 0; i < A.Num(); i++)
+    const int32 Count = FMath::Min(Build->BatchSize, Build->Entries.Num() - First);
+    TArray<FString> Texts;
+    Texts.Reserve(Count);
+    for (int32 i = First; i < First + Count; i++)
     {
-        DotProduct += A[i] * B[i];
-        NormA += A[i] * A[i];
-        NormB += B[i] * B[i];
+        Texts.Add(Build->Entries[i].Text);
     }
 
-    double Denom = FMath::Sqrt(NormA) * FMath::Sqrt(NormB);
-    if (Denom <= KINDA_SMALL_NUMBER)
-    {
-        return 0.0f;
-    }
+    EmbedTexts(MoveTemp(Texts), EInferencePriority::Background, [WeakThis = TWeakObjectPtr<ULlamaComponent>(this), Build, First, Count](TArray<TArray<float>> Embeddings)
+        {
+            for (int32 i = 0; i < Count; i++)
+            {
+                Build->Entries[First + i].Embedding = MoveTemp(Embeddings[i]);
+            }
+
+            // Each finished batch queues the next one from the game thread, which keeps KnowledgeBatchesInFlight batches going.
+            if ((Build->Remaining -= Count) > 0)
+            {
+                AsyncTask(ENamedThreads::GameThread, [WeakThis, Build]()
+                    {
+                        if (WeakThis.IsValid())
+                        {
+                            WeakThis->EmbedNextKnowledgeBatch(Build);
+                        }
+                    });
+                return;
+            }
+
+            if (!Build->IndexPath.IsEmpty())
+            {
+                FKnowledgeIndex::Save(Build->IndexPath, Build->IndexKey, Build->Entries);
+            }
+
+            // Normalized into the matrix here, so the game thread only has to swap it in.
+            const int32 NumChunks = Build->Entries.Num();
+            FKnowledgeMatrix Matrix;
+            Matrix.Build(MoveTemp(Build->Entries));
 
-    return static_cast<float>(DotProduct / Denom);
+            AsyncTask(ENamedThreads::GameThread, [WeakThis, Build, NumChunks, Matrix = MoveTemp(Matrix)]() mutable
+                {
+                    if (!WeakThis.IsValid())
+                    {
+                        return;
+                    }
+                    WeakThis->Knowledge = MoveTemp(Matrix);
+
+                    double EndTime = FPlatformTime::Seconds() * 1000.0;
+                    double Duration = EndTime - Build->StartTime;
+                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Generated knowledge in %.2f ms for document of %d characters: %d chunks at %.1f chunks/s."),
+                        Duration, Build->NumCharacters, NumChunks, Duration > 0.0 ? 1000.0 * NumChunks / Duration : 0.0);
+                    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Knowledge generation complete."));
+                });
+        });
 }
 
 TArray<FString> ULlamaComponent::GetTopKDocuments(const TArray<float>& QueryEmbedding)
@@ -777,46 +1958,35 @@ TArray<FString> ULlamaComponent::GetTopKDocuments(const TArray<float>& QueryEmbe
         UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] No knowledge available or query embedding is empty."));
         return TopChunks;
     }
-
-    struct FScoredChunk
-    {
-        float Score;
-        FString Text;
-    };
-
-    TArray<FScoredChunk> ScoredChunks;
-    ScoredChunks.Reserve(Knowledge.Num());
-
-    for (const FKnowledgeEntry& Entry : Knowledge)
+    if (QueryEmbedding.Num() != Knowledge.GetDimensions())
     {
-        float Similarity = ComputeCosineSimilarity(QueryEmbedding, Entry.Embedding);
-        ScoredChunks.Add({ Similarity, Entry.Text });
+        // The knowledge was embedded by another model than the one answering queries now, e.g. an index from before
+        // the embedding server was switched to a model with the same name.
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Query embedding has %d dimensions, the knowledge base %d. Embedding the knowledge again."), QueryEmbedding.Num(), Knowledge.GetDimensions());
+        Knowledge.Reset();
+        GenerateKnowledge(true);
+        return TopChunks;
     }
 
-    ScoredChunks.Sort([](const FScoredChunk& A, const FScoredChunk& B)
-        {
-            return A.Score > B.Score;
-        });
-
-    int32 Count = FMath::Min(EmbeddingTopK, ScoredChunks.Num());
-    for (int32 i = 0; i < Count; i++)
+    TArray<int32> Rows;
+    Knowledge.FindNearest(QueryEmbedding, EmbeddingTopK, Rows);
+    for (const int32 Row : Rows)
     {
-        TopChunks.Add(ScoredChunks[i].Text);
+        TopChunks.Add(Knowledge.GetText(Row));
     }
 
-    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Selected top-%d chunks out of %d knowledge entries."), Count, ScoredChunks.Num());
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Selected top-%d chunks out of %d knowledge entries."), Rows.Num(), Knowledge.Num());
 
     return TopChunks;
 }
 
-TArray<FString> ULlamaComponent::RerankDocuments(const FString& Query, const TArray<FString>& Documents)
+void ULlamaComponent::RerankDocuments(const FString& Query, TArray<FString> Documents, EInferencePriority Priority, TUniqueFunction<void(TArray<FString>)> OnReranked)
 {
-    TArray<FString> RerankedDocs;
-
     if (Documents.Num() == 0)
     {
         UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] No documents provided for reranking."));
-        return RerankedDocs;
+        OnReranked(TArray<FString>());
+        return;
     }
 
     TSharedPtr<FJsonObject> JsonRequest = MakeShared<FJsonObject>();
@@ -834,25 +2004,23 @@ TArray<FString> ULlamaComponent::RerankDocuments(const FString& Query, const TAr
     TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&RequestString);
     FJsonSerializer::Serialize(JsonRequest.ToSharedRef(), Writer);
 
-    FString Url = FString::Printf(TEXT("http://localhost:%d/v1/rerank"), RerankerPort);
-    TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
-    Request->SetURL(Url);
-    Request->SetVerb(TEXT("POST"));
-    Request->SetHeader(TEXT("Content-Type"), TEXT("application/json"));
-    Request->SetContentAsString(RequestString);
-
-    FEvent* CompletionEvent = FPlatformProcess::GetSynchEventFromPool(true);
-
     double StartTime = FPlatformTime::Seconds() * 1000.0;
 
-    Request->OnProcessRequestComplete().BindLambda([&](FHttpRequestPtr Req, FHttpResponsePtr Res, bool bConnected)
+    FInferenceScheduler::Get().Launch(EInferenceBackend::Reranker, Priority, this,
+        [RequestString = MoveTemp(RequestString), Priority, Endpoints = GetRerankerEndpoints(), bHedge = bHedgeShortRequests, TopN = RerankingTopN, Documents = MoveTemp(Documents), StartTime, OnReranked = MoveTemp(OnReranked)]()
         {
+            TArray<FString> RerankedDocs;
+
+            // While the reranker is down the embedding results are used as they are.
+            FLlamaHttpResponse Response;
+            bool bConnected = FInferenceHedging::Get().Post(EInferenceBackend::Reranker, Priority, Endpoints, TEXT("/v1/rerank"), RequestString, Response, bHedge);
+
             double EndTime = FPlatformTime::Seconds() * 1000.0;
             double Duration = EndTime - StartTime;
 
-            if (bConnected && Res.IsValid() && EHttpResponseCodes::IsOk(Res->GetResponseCode()))
+            if (bConnected && EHttpResponseCodes::IsOk(Response.Code))
             {
-                FString Content = Res->GetContentAsString();
+                const FString& Content = Response.Content;
                 TSharedPtr<FJsonObject> JsonObject;
                 TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Content);
 
@@ -880,7 +2048,7 @@ TArray<FString> ULlamaComponent::RerankDocuments(const FString& Query, const TAr
                             else
                             {
                                 UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Invalid document object in reranker response: %s"), *Content);
-							}
+                            }
                         }
 
                         ScoredDocs.Sort([](const FScoredDoc& A, const FScoredDoc& B)
@@ -888,7 +2056,7 @@ TArray<FString> ULlamaComponent::RerankDocuments(const FString& Query, const TAr
                                 return A.Score > B.Score;
                             });
 
-                        int32 Count = FMath::Min(RerankingTopN, ScoredDocs.Num());
+                        int32 Count = FMath::Min(TopN, ScoredDocs.Num());
                         for (int32 i = 0; i < Count; i++)
                         {
                             int32 DocIdx = ScoredDocs[i].Index;
@@ -899,7 +2067,7 @@ TArray<FString> ULlamaComponent::RerankDocuments(const FString& Query, const TAr
                             else
                             {
                                 UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] Document index %d out of bounds for reranked documents."), DocIdx);
-							}
+                            }
                         }
 
                         UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Reranked %d documents in %.2f ms."), Count, Duration);
@@ -916,67 +2084,48 @@ TArray<FString> ULlamaComponent::RerankDocuments(const FString& Query, const TAr
             }
             else
             {
-                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Rerank request failed: %s"), Res.IsValid() ? *Res->GetContentAsString() : TEXT("No response"));
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | RAG] Rerank request failed: %s"), bConnected ? *Response.Content : TEXT("No response or server unavailable"));
             }
 
-            CompletionEvent->Trigger();
-        });
-
-    Request->ProcessRequest();
-    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | RAG] Rerank request sent to %s"), *Url);
-
-    CompletionEvent->Wait();
-    FPlatformProcess::ReturnSynchEventToPool(CompletionEvent);
-
-    if (RerankedDocs.Num() == 0)
-    {
-		UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] No documents returned from reranker. Returning embedding mode results."));
-        for (int i = 0; i < FMath::Min(RerankingTopN, Documents.Num()); i++)
-        {
-            RerankedDocs.Add(Documents[i]);
-		}
-    }
+            if (RerankedDocs.Num() == 0)
+            {
+				UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | RAG] No documents returned from reranker. Returning embedding mode results."));
+                for (int i = 0; i < FMath::Min(TopN, Documents.Num()); i++)
+                {
+                    RerankedDocs.Add(Documents[i]);
+				}
+            }
 
-    return RerankedDocs;
+            OnReranked(MoveTemp(RerankedDocs));
+        });
 }
 
 void ULlamaComponent::HandleNpcAction(const FString& ActionCommand)
 {
-    FString Action;
-    FString Object;
+    bTurnTriggeredAction = true;
 
-    FNpcAction* FoundAction = nullptr;
-    for (FNpcAction& A : KnownActions)
-    {
-        if (ActionCommand.StartsWith(A.Name, ESearchCase::IgnoreCase))
-        {
-            if (!FoundAction || A.Name.Len() > FoundAction->Name.Len())
-            {
-                FoundAction = &A;
-            }
-        }
-    }
+    int32 NameLength = 0;
+    const int32 ActionIndex = ActionMatcher.MatchAction(ActionCommand, NameLength);
 
-    if (FoundAction)
+    if (KnownActions.IsValidIndex(ActionIndex))
     {
-        if (FoundAction->bHasTargetObject)
+        const FNpcAction& FoundAction = KnownActions[ActionIndex];
+        if (FoundAction.bHasTargetObject)
         {
-            Object = ActionCommand.Mid(FoundAction->Name.Len()).TrimStartAndEnd();
+            const int32 ObjectIndex = ActionMatcher.FindObject(ActionCommand.Mid(NameLength).TrimStartAndEnd());
 
-            FNpcObject* FoundObject = KnownObjects.FindByPredicate(
-                [&](const FNpcObject& O) { return O.Name.Equals(Object, ESearchCase::IgnoreCase); });
-
-            if (FoundObject)
+            if (KnownObjects.IsValidIndex(ObjectIndex))
             {
-                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Executing action \"%s\" on object \"%s\""), *FoundAction->Name, *FoundObject->Name);
-                OnActionReceived.Broadcast(FoundAction->Name, FoundObject->ActorRef);
+                const FNpcObject& FoundObject = KnownObjects[ObjectIndex];
+                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Executing action \"%s\" on object \"%s\""), *FoundAction.Name, *FoundObject.Name);
+                OnActionReceived.Broadcast(FoundAction.Name, FoundObject.ActorRef);
                 return;
             }
         }
         else
         {
-            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Executing action \"%s\""), *FoundAction->Name);
-            OnActionReceived.Broadcast(FoundAction->Name, nullptr);
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Executing action \"%s\""), *FoundAction.Name);
+            OnActionReceived.Broadcast(FoundAction.Name, nullptr);
             return;
         }
     }
@@ -984,10 +2133,48 @@ void ULlamaComponent::HandleNpcAction(const FString& ActionCommand)
     UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Actions] Unknown action command: %s"), *ActionCommand);
 }
 
+void ULlamaComponent::BuildActionMatcher()
+{
+    ActionMatcher.Reset();
+    for (int32 i = 0; i < KnownActions.Num(); ++i)
+    {
+        ActionMatcher.AddAction(KnownActions[i].Name, i);
+    }
+    for (int32 i = 0; i < KnownObjects.Num(); ++i)
+    {
+        ActionMatcher.AddObject(KnownObjects[i].Name, i);
+    }
+}
 
-FString ULlamaComponent::BuildActionsSystemMessage()
+FString ULlamaComponent::BuildActionsSystemMessage(ELlamaActionOutputMode Mode) const
 {
     FString Message;
+
+    if (Mode == ELlamaActionOutputMode::ToolCalls)
+    {
+        // Names, descriptions and valid objects are all part of the tool definitions.
+        return TEXT("You can act by calling the provided tools while you talk, whenever it suits the conversation.");
+    }
+
+    if (Mode == ELlamaActionOutputMode::Grammar)
+    {
+        // The grammar enforces the tag format and the valid names, so the model only needs to know what they mean.
+        Message += TEXT("You can act by writing [[action: <action> <object>]] in your reply.\nActions:\n");
+        for (const auto& Action : KnownActions)
+        {
+            Message += FString::Printf(TEXT("- %s%s: %s\n"), *Action.Name, Action.bHasTargetObject ? TEXT(" <object>") : TEXT(""), *Action.Description);
+        }
+        if (!KnownObjects.IsEmpty())
+        {
+            Message += TEXT("Objects:\n");
+            for (const auto& Object : KnownObjects)
+            {
+                Message += FString::Printf(TEXT("- %s: %s\n"), *Object.Name, *Object.Description);
+            }
+        }
+        return Message;
+    }
+
     Message += TEXT("You can do two things:\n");
     Message += TEXT("1. Speak normally as dialogue with the user.\n");
     Message += TEXT("2. Perform actions by inserting action tags directly into your dialogue, if suitable in the current context.\n\n");
@@ -1019,25 +2206,348 @@ FString ULlamaComponent::BuildActionsSystemMessage()
     return Message;
 }
 
+FString ULlamaComponent::BuildActionGrammar() const
+{
+    auto AppendLiteral = [](FString& Out, const FString& Text)
+        {
+            Out.AppendChar(TEXT('"'));
+            for (const TCHAR Char : Text)
+            {
+                if (Char == TEXT('"') || Char == TEXT('\\'))
+                {
+                    Out.AppendChar(TEXT('\\'));
+                }
+                Out.AppendChar(Char == TEXT('\n') ? TEXT(' ') : Char);
+            }
+            Out.AppendChar(TEXT('"'));
+        };
+
+    FString Commands;
+    for (const FNpcAction& Action : KnownActions)
+    {
+        // An action that needs an object cannot be written without any objects to name.
+        if (Action.Name.IsEmpty() || (Action.bHasTargetObject && KnownObjects.IsEmpty()))
+        {
+            continue;
+        }
+
+        Commands += Commands.IsEmpty() ? TEXT("") : TEXT(" | ");
+        AppendLiteral(Commands, Action.Name);
+        if (Action.bHasTargetObject)
+        {
+            Commands += TEXT(" \" \" object");
+        }
+    }
+
+    if (Commands.IsEmpty())
+    {
+        return FString();
+    }
+
+    // Dialogue is free text without square brackets; brackets only ever open a complete, valid action tag.
+    FString Grammar = TEXT("root ::= text? (action text?)*\n");
+    Grammar += TEXT("text ::= [^\\[\\]]+\n");
+    Grammar += TEXT("action ::= \"[[action: \" command \"]]\"\n");
+    Grammar += TEXT("command ::= ") + Commands + TEXT("\n");
+
+    if (!KnownObjects.IsEmpty())
+    {
+        Grammar += TEXT("object ::= ");
+        for (int32 i = 0; i < KnownObjects.Num(); ++i)
+        {
+            Grammar += i > 0 ? TEXT(" | ") : TEXT("");
+            AppendLiteral(Grammar, KnownObjects[i].Name);
+        }
+        Grammar += TEXT("\n");
+    }
+
+    return Grammar;
+}
+
+void ULlamaComponent::BuildActionTools()
+{
+    ActionToolsJson.Reset();
+    ToolNameToAction.Reset();
+
+    FString ObjectEnum;
+    FString ObjectDescriptions;
+    for (const FNpcObject& Object : KnownObjects)
+    {
+        ObjectEnum += ObjectEnum.IsEmpty() ? TEXT("") : TEXT(",");
+        FLlamaRequestBuilder::AppendJsonString(ObjectEnum, Object.Name);
+        ObjectDescriptions += FString::Printf(TEXT("%s%s: %s"), ObjectDescriptions.IsEmpty() ? TEXT("") : TEXT("; "), *Object.Name, *Object.Description);
+    }
+
+    for (int32 i = 0; i < KnownActions.Num(); ++i)
+    {
+        const FNpcAction& Action = KnownActions[i];
+        if (Action.Name.IsEmpty() || (Action.bHasTargetObject && KnownObjects.IsEmpty()))
+        {
+            continue;
+        }
+
+        // Function names may only use letters, digits, '_' and '-'.
+        FString ToolName = Action.Name.Left(64);
+        for (TCHAR& Char : ToolName)
+        {
+            if (!FChar::IsAlnum(Char) && Char != TEXT('_') && Char != TEXT('-'))
+            {
+                Char = TEXT('_');
+            }
+        }
+        if (ToolNameToAction.Contains(ToolName))
+        {
+            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Actions] Action \"%s\" has the same tool name as an earlier action and is skipped"), *Action.Name);
+            continue;
+        }
+        ToolNameToAction.Add(ToolName, i);
+
+        ActionToolsJson += ActionToolsJson.IsEmpty() ? TEXT("[") : TEXT(",");
+        ActionToolsJson += TEXT("{\"type\":\"function\",\"function\":{\"name\":");
+        FLlamaRequestBuilder::AppendJsonString(ActionToolsJson, ToolName);
+        ActionToolsJson += TEXT(",\"description\":");
+        FLlamaRequestBuilder::AppendJsonString(ActionToolsJson, Action.Description);
+        ActionToolsJson += TEXT(",\"parameters\":{\"type\":\"object\",\"properties\":{");
+        if (Action.bHasTargetObject)
+        {
+            ActionToolsJson += TEXT("\"object\":{\"type\":\"string\",\"enum\":[") + ObjectEnum + TEXT("],\"description\":");
+            FLlamaRequestBuilder::AppendJsonString(ActionToolsJson, ObjectDescriptions);
+            ActionToolsJson += TEXT("}},\"required\":[\"object\"]}}}");
+        }
+        else
+        {
+            ActionToolsJson += TEXT("}}}}");
+        }
+    }
+
+    if (!ActionToolsJson.IsEmpty())
+    {
+        ActionToolsJson += TEXT("]");
+    }
+}
+
+void ULlamaComponent::HandleToolCall(const FLlamaToolCall& ToolCall)
+{
+    bTurnTriggeredAction = true;
+
+    const int32* ActionIndex = ToolNameToAction.Find(ToolCall.Name);
+    if (!ActionIndex || !KnownActions.IsValidIndex(*ActionIndex))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Actions] Unknown tool call: %s(%s)"), *ToolCall.Name, *ToolCall.Arguments);
+        TurnToolResults.Add(TEXT("Unknown action."));
+        return;
+    }
+
+    const FNpcAction& FoundAction = KnownActions[*ActionIndex];
+    if (!FoundAction.bHasTargetObject)
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Executing action \"%s\""), *FoundAction.Name);
+        OnActionReceived.Broadcast(FoundAction.Name, nullptr);
+        TurnToolResults.Add(TEXT("Done."));
+        return;
+    }
+
+    FString ObjectName;
+    TSharedPtr<FJsonObject> Arguments;
+    TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(ToolCall.Arguments);
+    if (FJsonSerializer::Deserialize(Reader, Arguments) && Arguments.IsValid())
+    {
+        Arguments->TryGetStringField(TEXT("object"), ObjectName);
+    }
+
+    const int32 ObjectIndex = ActionMatcher.FindObject(ObjectName.TrimStartAndEnd());
+    if (!KnownObjects.IsValidIndex(ObjectIndex))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Actions] Tool call \"%s\" names no known object: %s"), *ToolCall.Name, *ToolCall.Arguments);
+        TurnToolResults.Add(TEXT("No such object."));
+        return;
+    }
+
+    const FNpcObject& FoundObject = KnownObjects[ObjectIndex];
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Executing action \"%s\" on object \"%s\""), *FoundAction.Name, *FoundObject.Name);
+    OnActionReceived.Broadcast(FoundAction.Name, FoundObject.ActorRef);
+    TurnToolResults.Add(TEXT("Done."));
+}
+
+void ULlamaComponent::AddToolResultMessages(TConstArrayView<FLlamaToolCall> ToolCalls)
+{
+    // Chat templates expect every call of an assistant message to be answered by a tool message before the next turn.
+    for (int32 i = 0; i < ToolCalls.Num(); i++)
+    {
+        FChatMessage ToolResult;
+        ToolResult.Role = "tool";
+        ToolResult.Content = TurnToolResults.IsValidIndex(i) ? TurnToolResults[i] : TEXT("Not carried out.");
+        ToolResult.ToolCallId = ToolCalls[i].Id;
+        AddChatMessage(ToolResult);
+    }
+    TurnToolResults.Reset();
+}
+
+void ULlamaComponent::MeasureActionPromptTokens(const FString& BaseSystemMessage)
+{
+    // The same system message once with the full action tag instructions and once with the tools, rendered by the
+    // server's chat template so the tool definitions are counted the way the model actually sees them.
+    auto BuildTemplateRequest = [&BaseSystemMessage](const FString& ActionsMessage, const FString& Tools)
+        {
+            FString Body = TEXT("{\"messages\":[");
+            FLlamaRequestBuilder::AppendMessageObject(Body, TEXT("system"), BaseSystemMessage + TEXT("\n\n") + ActionsMessage);
+            Body += TEXT("]");
+            if (!Tools.IsEmpty())
+            {
+                Body += TEXT(",\"tools\":") + Tools;
+            }
+            Body += TEXT("}");
+            return Body;
+        };
+
+    FString InstructionRequest = BuildTemplateRequest(BuildActionsSystemMessage(ELlamaActionOutputMode::PromptInstructions), FString());
+    FString ToolRequest = BuildTemplateRequest(BuildActionsSystemMessage(ELlamaActionOutputMode::ToolCalls), ActionToolsJson);
+
+    FInferenceScheduler::Get().Launch(EInferenceBackend::Llama, EInferencePriority::Background, this,
+        [WeakThis = TWeakObjectPtr<ULlamaComponent>(this), Endpoints = GetLlamaEndpoints(), InstructionRequest = MoveTemp(InstructionRequest), ToolRequest = MoveTemp(ToolRequest)]()
+        {
+            FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Llama, Endpoints);
+            if (!EndpointLease.IsValid())
+            {
+                return;
+            }
+            const FInferenceEndpoint& Endpoint = EndpointLease->GetEndpoint();
+
+            auto CountPromptTokens = [&Endpoint](const FString& TemplateRequest) -> int32
+                {
+                    FLlamaHttpResponse Response;
+                    TSharedPtr<FJsonObject> JsonObject;
+                    FString Prompt;
+                    if (!FLlamaConnectionPool::Get().Post(Endpoint.Host, Endpoint.Port, TEXT("/apply-template"), TemplateRequest, Response) || Response.Code != 200
+                        || !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Response.Content), JsonObject) || !JsonObject.IsValid()
+                        || !JsonObject->TryGetStringField(TEXT("prompt"), Prompt))
+                    {
+                        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Actions] Could not render the prompt (HTTP %d): %s"), Response.Code, *Response.Content);
+                        return INDEX_NONE;
+                    }
+
+                    FString TokenizeRequest = TEXT("{\"content\":");
+                    FLlamaRequestBuilder::AppendJsonString(TokenizeRequest, Prompt);
+                    TokenizeRequest += TEXT("}");
+
+                    const TArray<TSharedPtr<FJsonValue>>* Tokens;
+                    if (!FLlamaConnectionPool::Get().Post(Endpoint.Host, Endpoint.Port, TEXT("/tokenize"), TokenizeRequest, Response) || Response.Code != 200
+                        || !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Response.Content), JsonObject) || !JsonObject.IsValid()
+                        || !JsonObject->TryGetArrayField(TEXT("tokens"), Tokens))
+                    {
+                        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Actions] Could not tokenize the prompt (HTTP %d)"), Response.Code);
+                        return INDEX_NONE;
+                    }
+                    return Tokens->Num();
+                };
+
+            const int32 InstructionTokens = CountPromptTokens(InstructionRequest);
+            const int32 ToolTokens = CountPromptTokens(ToolRequest);
+            if (InstructionTokens == INDEX_NONE || ToolTokens == INDEX_NONE)
+            {
+                return;
+            }
+
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Actions as tools: %d prompt tokens instead of %d with action tag instructions (%d saved per request)"),
+                ToolTokens, InstructionTokens, InstructionTokens - ToolTokens);
+
+            AsyncTask(ENamedThreads::GameThread, [WeakThis, InstructionTokens, ToolTokens]()
+                {
+                    if (WeakThis.IsValid())
+                    {
+                        WeakThis->ActionPromptStats.InstructionTokens = InstructionTokens;
+                        WeakThis->ActionPromptStats.ToolTokens = ToolTokens;
+                        WeakThis->ActionPromptStats.SavedTokens = InstructionTokens - ToolTokens;
+                    }
+                });
+        });
+}
+
 
 void ULlamaComponent::BeginPlay()
 {
     Super::BeginPlay();
 
+    SlotNpcId = FString::Printf(TEXT("%s_%08x"), *GetOwner()->GetName(), GetTypeHash(GetPathName()));
+
+    if (ServerSlots > 0)
+    {
+        FInferenceScheduler::Get().EnsureConcurrencyLimit(EInferenceBackend::Llama, ServerSlots * GetLlamaEndpoints().Num());
+    }
+
     if (RagMode != ERagMode::Disabled)
     {
 		UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] RAG mode enabled, generating knowledge..."));
-        
-        Async(EAsyncExecution::Thread, [this]()
-            {
-                GenerateKnowledge();
-                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] Knowledge generation complete."));
-            });
+
+        GenerateKnowledge();
+    }
+
+    BuildActionMatcher();
+
+    // Modes that have nothing to constrain or declare fall back to explaining the action tags in the prompt.
+    ELlamaActionOutputMode InstructionMode = ELlamaActionOutputMode::PromptInstructions;
+    if (ActionOutputMode == ELlamaActionOutputMode::Grammar)
+    {
+        ActionGrammar = BuildActionGrammar();
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Constraining output with grammar:\n%s"), *ActionGrammar);
+        InstructionMode = ActionGrammar.IsEmpty() ? InstructionMode : ELlamaActionOutputMode::Grammar;
+    }
+    else if (ActionOutputMode == ELlamaActionOutputMode::ToolCalls)
+    {
+        BuildActionTools();
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Actions] Declaring %d actions as tools"), ToolNameToAction.Num());
+        InstructionMode = ActionToolsJson.IsEmpty() ? InstructionMode : ELlamaActionOutputMode::ToolCalls;
     }
 
     if (!KnownActions.IsEmpty())
     {
-		SystemMessage += TEXT("\n\n") + BuildActionsSystemMessage();
+        const FString BaseSystemMessage = SystemMessage;
+		SystemMessage += TEXT("\n\n") + BuildActionsSystemMessage(InstructionMode);
 		UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Llama] SystemMessage updated with known actions and objects."));
+
+        if (InstructionMode == ELlamaActionOutputMode::ToolCalls)
+        {
+            MeasureActionPromptTokens(BaseSystemMessage);
+        }
+    }
+}
+
+bool ULlamaComponent::IsReadyForFinishDestroy()
+{
+    // A cancelled stream notices within one socket wait, so this holds up destruction for a moment at most.
+    return Super::IsReadyForFinishDestroy() && ActiveStreams.load() == 0;
+}
+
+void ULlamaComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+    Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+    DeliverStreamTokens(StreamDeliveryBudgetMs / 1000.0);
+
+    if (ActiveStreams.load() == 0 && StreamTokenQueue.IsEmpty())
+    {
+        SetComponentTickEnabled(false);
+    }
+}
+
+void ULlamaComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+    // Queued jobs are dropped and running requests give up at their next check, so the slots are free again before they are forgotten.
+    CancelPendingRequests();
+    FInferenceScheduler::Get().CancelJobs(this);
+
+    Super::EndPlay(EndPlayReason);
+
+    for (const FInferenceEndpoint& Endpoint : GetLlamaEndpoints())
+    {
+        FLlamaSlotManager::Get().Forget(Endpoint.Host, Endpoint.Port, SlotNpcId);
     }
-}
\ No newline at end of file
+    FInferenceEndpointRouter::Get().Unbind(EInferenceBackend::Llama, SlotNpcId);
+
+    if (bUseResponseCache)
+    {
+        const FNpcResponseCacheStats& Stats = ResponseCache.GetStats();
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Cache] Response cache: %d of %d messages answered from the cache (%.0f%%), %.0f ms of generation saved."),
+            Stats.Hits, Stats.Lookups, 100.0f * Stats.HitRate, Stats.SavedMs);
+    }
+}
@@ -0,0 +1,312 @@
+#include "LlamaConnectionPool.h"
+#include "LlamaStreamParser.h"
+#include "SocketSubsystem.h"
+#include "Sockets.h"
+#include "IPAddress.h"
+
+FLlamaConnectionPool& FLlamaConnectionPool::Get()
+{
+    static FLlamaConnectionPool Instance;
+    return Instance;
+}
+
+FLlamaConnection FLlamaConnectionPool::Lease(const FString& Host, int32 Port)
+{
+    const FString Key = FString::Printf(TEXT("%s:%d"), *Host, Port);
+    const double Now = FPlatformTime::Seconds();
+
+    {
+        FScopeLock ScopeLock(&Lock);
+
+        TArray<FLlamaConnection>* Idle = IdleConnections.Find(Key);
+        while (Idle && Idle->Num() > 0)
+        {
+            FLlamaConnection Connection = Idle->Pop(EAllowShrinking::No);
+            if (Now - Connection.LastUsedTime > IdleTimeoutSeconds || !IsIdleSocketUsable(Connection.Socket))
+            {
+                UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | ConnectionPool] Dropping stale connection to %s"), *Key);
+                DestroySocket(Connection.Socket);
+                continue;
+            }
+
+            Connection.bReused = true;
+            LeasedCount++;
+            TotalLeases++;
+            ReusedLeases++;
+            return Connection;
+        }
+    }
+
+    FLlamaConnection Connection;
+    Connection.Host = Host;
+    Connection.Port = Port;
+    Connection.Socket = Connect(Host, Port);
+
+    if (Connection.IsValid())
+    {
+        FScopeLock ScopeLock(&Lock);
+        LeasedCount++;
+        TotalLeases++;
+    }
+
+    return Connection;
+}
+
+void FLlamaConnectionPool::Release(FLlamaConnection& Connection, bool bKeepAlive)
+{
+    if (!Connection.IsValid())
+    {
+        return;
+    }
+
+    FScopeLock ScopeLock(&Lock);
+    LeasedCount = FMath::Max(0, LeasedCount - 1);
+
+    const FString Key = FString::Printf(TEXT("%s:%d"), *Connection.Host, Connection.Port);
+    TArray<FLlamaConnection>& Idle = IdleConnections.FindOrAdd(Key);
+
+    if (bKeepAlive && Idle.Num() < MaxIdlePerEndpoint)
+    {
+        Connection.LastUsedTime = FPlatformTime::Seconds();
+        Connection.bReused = false;
+        Idle.Add(Connection);
+    }
+    else
+    {
+        DestroySocket(Connection.Socket);
+    }
+
+    Connection.Socket = nullptr;
+}
+
+void FLlamaConnectionPool::NotifyReconnect()
+{
+    FScopeLock ScopeLock(&Lock);
+    Reconnects++;
+}
+
+bool FLlamaConnectionPool::Post(const FString& Host, int32 Port, const FString& Path, const FString& Body, FLlamaHttpResponse& OutResponse, double TimeoutSeconds,
+    TFunction<bool()> ShouldCancel)
+{
+    return SendRequest(TEXT("POST"), Host, Port, Path, Body, OutResponse, TimeoutSeconds, ShouldCancel);
+}
+
+bool FLlamaConnectionPool::Fetch(const FString& Host, int32 Port, const FString& Path, FLlamaHttpResponse& OutResponse, double TimeoutSeconds)
+{
+    return SendRequest(TEXT("GET"), Host, Port, Path, FString(), OutResponse, TimeoutSeconds, nullptr);
+}
+
+bool FLlamaConnectionPool::SendRequest(const TCHAR* Verb, const FString& Host, int32 Port, const FString& Path, const FString& Body, FLlamaHttpResponse& OutResponse,
+    double TimeoutSeconds, const TFunction<bool()>& ShouldCancel)
+{
+    FTCHARToUTF8 ConvertedBody(*Body);
+    FTCHARToUTF8 ConvertedHeaders(*BuildRequestHeaders(Host, Port, Path, ConvertedBody.Length(), TEXT("application/json"), Verb));
+
+    for (int32 Attempt = 0; Attempt < 2; ++Attempt)
+    {
+        FLlamaConnection Connection = Lease(Host, Port);
+        if (!Connection.IsValid())
+        {
+            UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | ConnectionPool] Failed to connect to %s:%d"), *Host, Port);
+            return false;
+        }
+
+        bool bKeepAlive = false;
+        bool bReceivedAny = false;
+        if (SendAll(Connection.Socket, (const uint8*)ConvertedHeaders.Get(), ConvertedHeaders.Length())
+            && SendAll(Connection.Socket, (const uint8*)ConvertedBody.Get(), ConvertedBody.Length())
+            && ReadResponse(Connection.Socket, OutResponse, bKeepAlive, bReceivedAny, TimeoutSeconds, ShouldCancel))
+        {
+            Release(Connection, bKeepAlive);
+            return true;
+        }
+
+        const bool bWasReused = Connection.bReused;
+        Release(Connection, false);
+
+        if (ShouldCancel && ShouldCancel())
+        {
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | ConnectionPool] Request to %s:%d%s cancelled"), *Host, Port, *Path);
+            return false;
+        }
+
+        if (!bWasReused || bReceivedAny)
+        {
+            UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | ConnectionPool] Request to %s:%d%s failed"), *Host, Port, *Path);
+            return false;
+        }
+
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | ConnectionPool] Reused connection to %s:%d was closed by the server, reconnecting"), *Host, Port);
+        NotifyReconnect();
+    }
+
+    return false;
+}
+
+FString FLlamaConnectionPool::BuildRequestHeaders(const FString& Host, int32 Port, const FString& Path, int32 ContentLength, const TCHAR* Accept, const TCHAR* Verb)
+{
+    return FString::Printf(
+        TEXT("%s %s HTTP/1.1\r\n")
+        TEXT("Host: %s:%d\r\n")
+        TEXT("Content-Type: application/json\r\n")
+        TEXT("Accept: %s\r\n")
+        TEXT("Content-Length: %d\r\n")
+        TEXT("Connection: keep-alive\r\n\r\n"),
+        Verb, *Path, *Host, Port, Accept, ContentLength);
+}
+
+bool FLlamaConnectionPool::SendAll(FSocket* Socket, const uint8* Data, int32 Length)
+{
+    int32 TotalSent = 0;
+    while (TotalSent < Length)
+    {
+        int32 BytesSent = 0;
+        if (!Socket->Send(Data + TotalSent, Length - TotalSent, BytesSent) || BytesSent <= 0)
+        {
+            return false;
+        }
+        TotalSent += BytesSent;
+    }
+    return true;
+}
+
+FLlamaConnectionPoolStats FLlamaConnectionPool::GetStats() const
+{
+    FScopeLock ScopeLock(&Lock);
+
+    FLlamaConnectionPoolStats Stats;
+    for (const TPair<FString, TArray<FLlamaConnection>>& Pair : IdleConnections)
+    {
+        Stats.IdleConnections += Pair.Value.Num();
+    }
+    Stats.LeasedConnections = LeasedCount;
+    Stats.TotalLeases = TotalLeases;
+    Stats.ReusedLeases = ReusedLeases;
+    Stats.Reconnects = Reconnects;
+    Stats.ReuseRate = TotalLeases > 0 ? static_cast<float>(ReusedLeases) / TotalLeases : 0.0f;
+
+    return Stats;
+}
+
+void FLlamaConnectionPool::Shutdown()
+{
+    FScopeLock ScopeLock(&Lock);
+
+    for (TPair<FString, TArray<FLlamaConnection>>& Pair : IdleConnections)
+    {
+        for (FLlamaConnection& Connection : Pair.Value)
+        {
+            DestroySocket(Connection.Socket);
+        }
+    }
+    IdleConnections.Empty();
+}
+
+FSocket* FLlamaConnectionPool::Connect(const FString& Host, int32 Port)
+{
+    ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+    if (!SocketSubsystem)
+    {
+        return nullptr;
+    }
+
+    TSharedPtr<FInternetAddr> Addr = SocketSubsystem->GetAddressFromString(Host);
+    if (!Addr.IsValid())
+    {
+        FAddressInfoResult Result = SocketSubsystem->GetAddressInfo(*Host, nullptr, EAddressInfoFlags::Default, NAME_None, ESocketType::SOCKTYPE_Streaming);
+        if (Result.ReturnCode != SE_NO_ERROR || Result.Results.Num() == 0)
+        {
+            UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | ConnectionPool] Failed to resolve host %s"), *Host);
+            return nullptr;
+        }
+        Addr = Result.Results[0].Address->Clone();
+    }
+    Addr->SetPort(Port);
+
+    FSocket* Socket = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("LlamaPooledSocket"), Addr->GetProtocolType());
+    if (!Socket)
+    {
+        return nullptr;
+    }
+
+    Socket->SetNoDelay(true);
+
+    if (!Socket->Connect(*Addr))
+    {
+        DestroySocket(Socket);
+        return nullptr;
+    }
+
+    return Socket;
+}
+
+void FLlamaConnectionPool::DestroySocket(FSocket* Socket)
+{
+    if (Socket)
+    {
+        Socket->Close();
+        ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+    }
+}
+
+bool FLlamaConnectionPool::IsIdleSocketUsable(FSocket* Socket)
+{
+    if (!Socket || Socket->GetConnectionState() != SCS_Connected)
+    {
+        return false;
+    }
+
+    // An idle keep-alive socket should have nothing to read. Readability here means the server sent a FIN or stray bytes.
+    return !Socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::Zero());
+}
+
+bool FLlamaConnectionPool::ReadResponse(FSocket* Socket, FLlamaHttpResponse& OutResponse, bool& bOutKeepAlive, bool& bOutReceivedAny, double TimeoutSeconds, const TFunction<bool()>& ShouldCancel)
+{
+    constexpr int32 BufferSize = 8192;
+    uint8 Buffer[BufferSize];
+
+    FLlamaStreamParser Parser(true);
+    auto IgnoreEvent = [](const FLlamaSseEvent&) {};
+
+    const double StartTime = FPlatformTime::Seconds();
+
+    while (!Parser.IsMessageComplete() && !Parser.HasError() && (FPlatformTime::Seconds() - StartTime) < TimeoutSeconds)
+    {
+        if (ShouldCancel && ShouldCancel())
+        {
+            return false;
+        }
+
+        if (!Socket->Wait(ESocketWaitConditions::WaitForRead, FTimespan::FromMilliseconds(20.0)))
+        {
+            continue;
+        }
+
+        int32 BytesRead = 0;
+        if (!Socket->Recv(Buffer, BufferSize, BytesRead) || BytesRead <= 0)
+        {
+            Parser.NotifyConnectionClosed(IgnoreEvent);
+            break;
+        }
+
+        bOutReceivedAny = true;
+        Parser.Feed(Buffer, BytesRead, IgnoreEvent);
+    }
+
+    if (!Parser.IsMessageComplete())
+    {
+        if (!Parser.HasError() && (FPlatformTime::Seconds() - StartTime) >= TimeoutSeconds)
+        {
+            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | ConnectionPool] Response timed out after %.2f seconds"), TimeoutSeconds);
+        }
+        return false;
+    }
+
+    const TArray<uint8>& Body = Parser.GetBody();
+    auto ConvertedBody = StringCast<TCHAR>((const UTF8CHAR*)Body.GetData(), Body.Num());
+    OutResponse.Code = Parser.GetStatusCode();
+    OutResponse.Content = FString(ConvertedBody.Length(), ConvertedBody.Get());
+    bOutKeepAlive = Parser.IsKeepAlive();
+
+    return true;
+}
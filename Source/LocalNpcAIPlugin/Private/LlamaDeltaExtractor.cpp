@@ -0,0 +1,539 @@
+#include "LlamaDeltaExtractor.h"
+
+namespace
+{
+    constexpr int32 MaxSkipDepth = 32;
+
+    struct FJsonCursor
+    {
+        const UTF8CHAR* Ptr;
+        const UTF8CHAR* End;
+
+        void SkipWhitespace()
+        {
+            while (Ptr < End && (*Ptr == ' ' || *Ptr == '\t' || *Ptr == '\n' || *Ptr == '\r'))
+            {
+                ++Ptr;
+            }
+        }
+
+        bool Consume(UTF8CHAR Expected)
+        {
+            SkipWhitespace();
+            if (Ptr < End && *Ptr == Expected)
+            {
+                ++Ptr;
+                return true;
+            }
+            return false;
+        }
+
+        bool Peek(UTF8CHAR Expected)
+        {
+            SkipWhitespace();
+            return Ptr < End && *Ptr == Expected;
+        }
+
+        // Returns the raw bytes between the quotes. Escapes are left in place and reported through bOutHasEscapes.
+        bool ParseString(FUtf8StringView& OutRaw, bool& bOutHasEscapes)
+        {
+            if (!Consume('"'))
+            {
+                return false;
+            }
+
+            bOutHasEscapes = false;
+            const UTF8CHAR* Start = Ptr;
+            while (Ptr < End)
+            {
+                const UTF8CHAR C = *Ptr;
+                if (C == '"')
+                {
+                    OutRaw = FUtf8StringView(Start, static_cast<int32>(Ptr - Start));
+                    ++Ptr;
+                    return true;
+                }
+                if (C == '\\')
+                {
+                    bOutHasEscapes = true;
+                    Ptr += 2;
+                    continue;
+                }
+                ++Ptr;
+            }
+            return false;
+        }
+
+        bool ParseKey(FUtf8StringView& OutKey)
+        {
+            bool bHasEscapes = false;
+            return ParseString(OutKey, bHasEscapes) && !bHasEscapes && Consume(':');
+        }
+
+        bool ParseLiteral(const ANSICHAR* Literal)
+        {
+            SkipWhitespace();
+            const int32 Length = FCStringAnsi::Strlen(Literal);
+            if (End - Ptr < Length || FMemory::Memcmp(Ptr, Literal, Length) != 0)
+            {
+                return false;
+            }
+            Ptr += Length;
+            return true;
+        }
+
+        bool ParseNumber(double& OutValue)
+        {
+            SkipWhitespace();
+            ANSICHAR Digits[64];
+            int32 Count = 0;
+            while (Ptr < End && Count < UE_ARRAY_COUNT(Digits) - 1)
+            {
+                const UTF8CHAR C = *Ptr;
+                if ((C >= '0' && C <= '9') || C == '-' || C == '+' || C == '.' || C == 'e' || C == 'E')
+                {
+                    Digits[Count++] = static_cast<ANSICHAR>(C);
+                    ++Ptr;
+                }
+                else
+                {
+                    break;
+                }
+            }
+            if (Count == 0)
+            {
+                return false;
+            }
+            Digits[Count] = '\0';
+            OutValue = FCStringAnsi::Atod(Digits);
+            return true;
+        }
+
+        bool SkipValue(int32 Depth = 0)
+        {
+            if (Depth > MaxSkipDepth)
+            {
+                return false;
+            }
+
+            SkipWhitespace();
+            if (Ptr >= End)
+            {
+                return false;
+            }
+
+            switch (*Ptr)
+            {
+                case '"':
+                {
+                    FUtf8StringView Ignored;
+                    bool bHasEscapes = false;
+                    return ParseString(Ignored, bHasEscapes);
+                }
+                case '{':
+                {
+                    ++Ptr;
+                    if (Consume('}'))
+                    {
+                        return true;
+                    }
+                    do
+                    {
+                        FUtf8StringView Key;
+                        bool bHasEscapes = false;
+                        if (!ParseString(Key, bHasEscapes) || !Consume(':') || !SkipValue(Depth + 1))
+                        {
+                            return false;
+                        }
+                    } while (Consume(','));
+                    return Consume('}');
+                }
+                case '[':
+                {
+                    ++Ptr;
+                    if (Consume(']'))
+                    {
+                        return true;
+                    }
+                    do
+                    {
+                        if (!SkipValue(Depth + 1))
+                        {
+                            return false;
+                        }
+                    } while (Consume(','));
+                    return Consume(']');
+                }
+                case 't':
+                    return ParseLiteral("true");
+                case 'f':
+                    return ParseLiteral("false");
+                case 'n':
+                    return ParseLiteral("null");
+                default:
+                {
+                    double Ignored;
+                    return ParseNumber(Ignored);
+                }
+            }
+        }
+    };
+
+    int32 ParseHex4(const UTF8CHAR* Ptr)
+    {
+        int32 Value = 0;
+        for (int32 i = 0; i < 4; ++i)
+        {
+            const UTF8CHAR C = Ptr[i];
+            if (!FCharAnsi::IsHexDigit(static_cast<ANSICHAR>(C)))
+            {
+                return -1;
+            }
+            Value = Value * 16 + FParse::HexDigit(static_cast<TCHAR>(C));
+        }
+        return Value;
+    }
+
+    void AppendCodepoint(TArray<UTF8CHAR>& Out, uint32 Codepoint)
+    {
+        if (Codepoint < 0x80)
+        {
+            Out.Add(static_cast<UTF8CHAR>(Codepoint));
+        }
+        else if (Codepoint < 0x800)
+        {
+            Out.Add(static_cast<UTF8CHAR>(0xC0 | (Codepoint >> 6)));
+            Out.Add(static_cast<UTF8CHAR>(0x80 | (Codepoint & 0x3F)));
+        }
+        else if (Codepoint < 0x10000)
+        {
+            Out.Add(static_cast<UTF8CHAR>(0xE0 | (Codepoint >> 12)));
+            Out.Add(static_cast<UTF8CHAR>(0x80 | ((Codepoint >> 6) & 0x3F)));
+            Out.Add(static_cast<UTF8CHAR>(0x80 | (Codepoint & 0x3F)));
+        }
+        else
+        {
+            Out.Add(static_cast<UTF8CHAR>(0xF0 | (Codepoint >> 18)));
+            Out.Add(static_cast<UTF8CHAR>(0x80 | ((Codepoint >> 12) & 0x3F)));
+            Out.Add(static_cast<UTF8CHAR>(0x80 | ((Codepoint >> 6) & 0x3F)));
+            Out.Add(static_cast<UTF8CHAR>(0x80 | (Codepoint & 0x3F)));
+        }
+    }
+
+    bool Unescape(FUtf8StringView Raw, TArray<UTF8CHAR>& Out)
+    {
+        Out.Reset();
+        const UTF8CHAR* Ptr = Raw.GetData();
+        const UTF8CHAR* End = Ptr + Raw.Len();
+
+        while (Ptr < End)
+        {
+            if (*Ptr != '\\')
+            {
+                Out.Add(*Ptr++);
+                continue;
+            }
+
+            if (End - Ptr < 2)
+            {
+                return false;
+            }
+
+            const UTF8CHAR Escape = Ptr[1];
+            Ptr += 2;
+            switch (Escape)
+            {
+                case '"':  AppendCodepoint(Out, '"');  break;
+                case '\\': AppendCodepoint(Out, '\\'); break;
+                case '/':  AppendCodepoint(Out, '/');  break;
+                case 'b':  AppendCodepoint(Out, '\b'); break;
+                case 'f':  AppendCodepoint(Out, '\f'); break;
+                case 'n':  AppendCodepoint(Out, '\n'); break;
+                case 'r':  AppendCodepoint(Out, '\r'); break;
+                case 't':  AppendCodepoint(Out, '\t'); break;
+                case 'u':
+                {
+                    if (End - Ptr < 4)
+                    {
+                        return false;
+                    }
+                    int32 Codepoint = ParseHex4(Ptr);
+                    if (Codepoint < 0)
+                    {
+                        return false;
+                    }
+                    Ptr += 4;
+
+                    if (Codepoint >= 0xD800 && Codepoint <= 0xDBFF)
+                    {
+                        if (End - Ptr < 6 || Ptr[0] != '\\' || Ptr[1] != 'u')
+                        {
+                            return false;
+                        }
+                        const int32 Low = ParseHex4(Ptr + 2);
+                        if (Low < 0xDC00 || Low > 0xDFFF)
+                        {
+                            return false;
+                        }
+                        Ptr += 6;
+                        Codepoint = 0x10000 + ((Codepoint - 0xD800) << 10) + (Low - 0xDC00);
+                    }
+                    AppendCodepoint(Out, Codepoint);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool ParseDelta(FJsonCursor& Cursor, FLlamaStreamDelta& OutDelta)
+    {
+        if (!Cursor.Consume('{'))
+        {
+            return false;
+        }
+        if (Cursor.Consume('}'))
+        {
+            return true;
+        }
+
+        do
+        {
+            FUtf8StringView Key;
+            if (!Cursor.ParseKey(Key))
+            {
+                return false;
+            }
+
+            if (Key.Equals(UTF8TEXT("content")))
+            {
+                if (Cursor.Peek('"'))
+                {
+                    FUtf8StringView Raw;
+                    bool bHasEscapes = false;
+                    if (!Cursor.ParseString(Raw, bHasEscapes))
+                    {
+                        return false;
+                    }
+                    if (bHasEscapes)
+                    {
+                        if (!Unescape(Raw, OutDelta.ContentBuffer))
+                        {
+                            return false;
+                        }
+                        OutDelta.Content = FUtf8StringView(OutDelta.ContentBuffer.GetData(), OutDelta.ContentBuffer.Num());
+                    }
+                    else
+                    {
+                        OutDelta.Content = Raw;
+                    }
+                    OutDelta.bHasContent = true;
+                }
+                else if (!Cursor.ParseLiteral("null"))
+                {
+                    return false;
+                }
+            }
+            else if (Key.Equals(UTF8TEXT("tool_calls")))
+            {
+                // Tool call deltas are rare and nested, so they go through the JSON DOM.
+                if (!Cursor.ParseLiteral("null"))
+                {
+                    return false;
+                }
+            }
+            else if (!Cursor.SkipValue())
+            {
+                return false;
+            }
+        } while (Cursor.Consume(','));
+
+        return Cursor.Consume('}');
+    }
+
+    bool ParseChoice(FJsonCursor& Cursor, FLlamaStreamDelta& OutDelta, bool& bOutHasDelta)
+    {
+        if (!Cursor.Consume('{'))
+        {
+            return false;
+        }
+        if (Cursor.Consume('}'))
+        {
+            return true;
+        }
+
+        do
+        {
+            FUtf8StringView Key;
+            if (!Cursor.ParseKey(Key))
+            {
+                return false;
+            }
+
+            if (Key.Equals(UTF8TEXT("delta")))
+            {
+                if (!ParseDelta(Cursor, OutDelta))
+                {
+                    return false;
+                }
+                bOutHasDelta = true;
+            }
+            else if (Key.Equals(UTF8TEXT("finish_reason")))
+            {
+                if (Cursor.Peek('"'))
+                {
+                    bool bHasEscapes = false;
+                    if (!Cursor.ParseString(OutDelta.FinishReason, bHasEscapes) || bHasEscapes)
+                    {
+                        return false;
+                    }
+                    OutDelta.bHasFinishReason = true;
+                }
+                else if (!Cursor.ParseLiteral("null"))
+                {
+                    return false;
+                }
+            }
+            else if (!Cursor.SkipValue())
+            {
+                return false;
+            }
+        } while (Cursor.Consume(','));
+
+        return Cursor.Consume('}');
+    }
+
+    bool ParseTimings(FJsonCursor& Cursor, FLlamaStreamTimings& OutTimings)
+    {
+        if (!Cursor.Consume('{'))
+        {
+            return false;
+        }
+        if (Cursor.Consume('}'))
+        {
+            return true;
+        }
+
+        do
+        {
+            FUtf8StringView Key;
+            if (!Cursor.ParseKey(Key))
+            {
+                return false;
+            }
+
+            double Value = 0.0;
+            if (Key.Equals(UTF8TEXT("cache_n")) && Cursor.ParseNumber(Value))
+            {
+                OutTimings.CachedTokens = static_cast<int32>(Value);
+            }
+            else if (Key.Equals(UTF8TEXT("prompt_n")) && Cursor.ParseNumber(Value))
+            {
+                OutTimings.PromptTokens = static_cast<int32>(Value);
+            }
+            else if (Key.Equals(UTF8TEXT("prompt_ms")) && Cursor.ParseNumber(Value))
+            {
+                OutTimings.PromptMs = Value;
+            }
+            else if (Key.Equals(UTF8TEXT("predicted_n")) && Cursor.ParseNumber(Value))
+            {
+                OutTimings.PredictedTokens = static_cast<int32>(Value);
+            }
+            else if (Key.Equals(UTF8TEXT("predicted_ms")) && Cursor.ParseNumber(Value))
+            {
+                OutTimings.PredictedMs = Value;
+            }
+            else if (!Cursor.SkipValue())
+            {
+                return false;
+            }
+        } while (Cursor.Consume(','));
+
+        return Cursor.Consume('}');
+    }
+}
+
+void FLlamaStreamDelta::Reset()
+{
+    Content = FUtf8StringView();
+    bHasContent = false;
+    FinishReason = FUtf8StringView();
+    bHasFinishReason = false;
+    Timings = FLlamaStreamTimings();
+    bHasTimings = false;
+    ContentBuffer.Reset();
+}
+
+FString FLlamaStreamDelta::GetContent() const
+{
+    auto Converted = StringCast<TCHAR>(Content.GetData(), Content.Len());
+    return FString(Converted.Length(), Converted.Get());
+}
+
+FString FLlamaStreamDelta::GetFinishReason() const
+{
+    auto Converted = StringCast<TCHAR>(FinishReason.GetData(), FinishReason.Len());
+    return FString(Converted.Length(), Converted.Get());
+}
+
+bool FLlamaDeltaExtractor::Extract(FUtf8StringView Payload, FLlamaStreamDelta& OutDelta)
+{
+    OutDelta.Reset();
+
+    FJsonCursor Cursor{ Payload.GetData(), Payload.GetData() + Payload.Len() };
+    bool bHasDelta = false;
+
+    if (!Cursor.Consume('{'))
+    {
+        return false;
+    }
+    if (Cursor.Consume('}'))
+    {
+        return false;
+    }
+
+    do
+    {
+        FUtf8StringView Key;
+        if (!Cursor.ParseKey(Key))
+        {
+            return false;
+        }
+
+        if (Key.Equals(UTF8TEXT("choices")))
+        {
+            if (!Cursor.Consume('[') || !ParseChoice(Cursor, OutDelta, bHasDelta))
+            {
+                return false;
+            }
+            while (Cursor.Consume(','))
+            {
+                if (!Cursor.SkipValue())
+                {
+                    return false;
+                }
+            }
+            if (!Cursor.Consume(']'))
+            {
+                return false;
+            }
+        }
+        else if (Key.Equals(UTF8TEXT("timings")))
+        {
+            if (!ParseTimings(Cursor, OutDelta.Timings))
+            {
+                return false;
+            }
+            OutDelta.bHasTimings = true;
+        }
+        else if (!Cursor.SkipValue())
+        {
+            return false;
+        }
+    } while (Cursor.Consume(','));
+
+    return Cursor.Consume('}') && bHasDelta;
+}
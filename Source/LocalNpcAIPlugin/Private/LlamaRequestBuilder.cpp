@@ -0,0 +1,110 @@
+#include "LlamaRequestBuilder.h"
+
+void FLlamaRequestBuilder::AppendMessage(const FString& Role, const FString& Content, FStringView ToolCalls, FStringView ToolCallId)
+{
+    if (!MessageOffsets.IsEmpty())
+    {
+        SerializedMessages.AppendChar(TEXT(','));
+    }
+    MessageOffsets.Add(SerializedMessages.Len());
+    AppendMessageObject(SerializedMessages, Role, Content, ToolCalls, ToolCallId);
+}
+
+void FLlamaRequestBuilder::RemoveFirst(int32 Count)
+{
+    if (Count >= MessageOffsets.Num())
+    {
+        Reset();
+        return;
+    }
+    if (Count <= 0)
+    {
+        return;
+    }
+
+    const int32 RemovedLength = MessageOffsets[Count];
+    SerializedMessages.RemoveAt(0, RemovedLength, EAllowShrinking::No);
+    MessageOffsets.RemoveAt(0, Count, EAllowShrinking::No);
+    for (int32& Offset : MessageOffsets)
+    {
+        Offset -= RemovedLength;
+    }
+}
+
+void FLlamaRequestBuilder::Reset()
+{
+    SerializedMessages.Reset();
+    MessageOffsets.Reset();
+}
+
+void FLlamaRequestBuilder::AppendMessages(FString& Out, int32 Count) const
+{
+    Count = FMath::Min(Count, MessageOffsets.Num());
+    if (Count <= 0)
+    {
+        return;
+    }
+
+    // Offsets point at the start of each message, so the one after the last wanted message sits right after its comma.
+    const int32 Length = Count < MessageOffsets.Num() ? MessageOffsets[Count] - 1 : SerializedMessages.Len();
+    Out.Append(*SerializedMessages, Length);
+}
+
+void FLlamaRequestBuilder::AppendMessageObject(FString& Out, FStringView Role, FStringView Content, FStringView ToolCalls, FStringView ToolCallId)
+{
+    Out.Append(TEXT("{\"role\":"));
+    AppendJsonString(Out, Role);
+    Out.Append(TEXT(",\"content\":"));
+    AppendJsonString(Out, Content);
+    if (!ToolCalls.IsEmpty())
+    {
+        Out.Append(TEXT(",\"tool_calls\":"));
+        Out.Append(ToolCalls);
+    }
+    if (!ToolCallId.IsEmpty())
+    {
+        Out.Append(TEXT(",\"tool_call_id\":"));
+        AppendJsonString(Out, ToolCallId);
+    }
+    Out.AppendChar(TEXT('}'));
+}
+
+void FLlamaRequestBuilder::AppendJsonString(FString& Out, FStringView Value)
+{
+    Out.Reserve(Out.Len() + Value.Len() + 2);
+    Out.AppendChar(TEXT('"'));
+
+    const TCHAR* Data = Value.GetData();
+    const int32 Length = Value.Len();
+    int32 RunStart = 0;
+
+    for (int32 i = 0; i < Length; ++i)
+    {
+        const TCHAR C = Data[i];
+        if (C != TEXT('"') && C != TEXT('\\') && static_cast<uint32>(C) >= 0x20)
+        {
+            continue;
+        }
+
+        // Copy the unescaped run in one go, then the escape sequence.
+        Out.Append(Data + RunStart, i - RunStart);
+        RunStart = i + 1;
+
+        switch (C)
+        {
+            case TEXT('"'):  Out.Append(TEXT("\\\"")); break;
+            case TEXT('\\'): Out.Append(TEXT("\\\\")); break;
+            case TEXT('\n'): Out.Append(TEXT("\\n"));  break;
+            case TEXT('\r'): Out.Append(TEXT("\\r"));  break;
+            case TEXT('\t'): Out.Append(TEXT("\\t"));  break;
+            case TEXT('\b'): Out.Append(TEXT("\\b"));  break;
+            case TEXT('\f'): Out.Append(TEXT("\\f"));  break;
+            default:
+                Out.Appendf(TEXT("\\u%04x"), static_cast<uint32>(C));
+                break;
+        }
+    }
+
+    Out.Append(Data + RunStart, Length - RunStart);
+    Out.AppendChar(TEXT('"'));
+}
@@ -0,0 +1,101 @@
+#include "LlamaSentenceSegmenter.h"
+
+namespace
+{
+    // The same titles the chunker always knew. Unlike its old EndsWith check they only match whole words, so a
+    // sentence ending in e.g. "items." is no longer held back as if it ended in "Ms.".
+    constexpr FStringView Abbreviations[] =
+    {
+        TEXTVIEW("Mr."), TEXTVIEW("Mrs."), TEXTVIEW("Ms."), TEXTVIEW("Dr."), TEXTVIEW("Jr."),
+        LOCALNPCAI_EXTRA_ABBREVIATIONS
+    };
+
+    bool IsSentenceEnd(TCHAR Char)
+    {
+        return Char == TEXT('.') || Char == TEXT('!') || Char == TEXT('?') || Char == TEXT(';') || Char == TEXT('\n') || Char == TEXT('\r');
+    }
+
+    bool IsClauseEnd(TCHAR Char)
+    {
+        return Char == TEXT(',') || Char == TEXT(':') || Char == TEXT(')') || Char == 0x2013 || Char == 0x2014;
+    }
+}
+
+bool FLlamaSentenceSegmenter::IsAbbreviation(FStringView Text, int32 PeriodIndex)
+{
+    for (const FStringView& Abbreviation : Abbreviations)
+    {
+        const int32 Start = PeriodIndex + 1 - Abbreviation.Len();
+        if (Start < 0)
+        {
+            continue;
+        }
+
+        // Only whole words count, so "Hmm." is not mistaken for "Mm.".
+        if ((Start == 0 || !FChar::IsAlpha(Text[Start - 1])) && Text.Mid(Start, Abbreviation.Len()).Equals(Abbreviation, ESearchCase::IgnoreCase))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FLlamaSentenceSegmenter::Append(FStringView Text, const FLlamaChunkingSettings& Settings, FString& OutChunk)
+{
+    Pending.Append(Text);
+
+    for (; ScanPos < Pending.Len(); ++ScanPos)
+    {
+        const TCHAR Char = Pending[ScanPos];
+        if (IsSentenceEnd(Char))
+        {
+            if (Char != TEXT('.') || !IsAbbreviation(Pending, ScanPos))
+            {
+                LastSentenceEnd = ScanPos + 1;
+            }
+        }
+        else if (IsClauseEnd(Char))
+        {
+            LastClauseEnd = ScanPos + 1;
+        }
+    }
+
+    const bool bAggressive = bFirstChunk && Settings.bAggressiveFirstChunk;
+    const int32 MinCharacters = FMath::Max(1, bAggressive ? Settings.FirstChunkMinCharacters : Settings.MinCharacters);
+
+    int32 Split = LastSentenceEnd;
+    if (Settings.bSplitOnClauses || bAggressive)
+    {
+        Split = FMath::Max(Split, LastClauseEnd);
+    }
+
+    if (Split == INDEX_NONE || Split < MinCharacters)
+    {
+        return false;
+    }
+
+    OutChunk = Pending.Left(Split);
+    Pending.RightChopInline(Split, EAllowShrinking::No);
+    ScanPos -= Split;
+    LastSentenceEnd = INDEX_NONE;
+    LastClauseEnd = INDEX_NONE;
+    bFirstChunk = false;
+    return true;
+}
+
+FString FLlamaSentenceSegmenter::Flush(FStringView Text)
+{
+    Pending.Append(Text);
+    FString Rest = MoveTemp(Pending);
+    Reset();
+    return Rest;
+}
+
+void FLlamaSentenceSegmenter::Reset()
+{
+    Pending.Reset();
+    ScanPos = 0;
+    LastSentenceEnd = INDEX_NONE;
+    LastClauseEnd = INDEX_NONE;
+    bFirstChunk = true;
+}
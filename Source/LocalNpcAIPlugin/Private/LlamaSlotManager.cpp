@@ -0,0 +1,227 @@
+#include "LlamaSlotManager.h"
+#include "LlamaConnectionPool.h"
+
+FLlamaSlotManager& FLlamaSlotManager::Get()
+{
+    static FLlamaSlotManager Instance;
+    return Instance;
+}
+
+FLlamaSlotLease FLlamaSlotManager::AcquireSlot(const FString& Host, int32 Port, const FString& NpcId, int32 NumSlots, bool bSaveState)
+{
+    FLlamaSlotLease Lease;
+    Lease.Host = Host;
+    Lease.Port = Port;
+    Lease.NpcId = NpcId;
+    Lease.bSaveState = bSaveState;
+
+    if (NumSlots <= 0 || NpcId.IsEmpty())
+    {
+        return Lease;
+    }
+
+    const FString Key = FString::Printf(TEXT("%s:%d"), *Host, Port);
+    const double Now = FPlatformTime::Seconds();
+
+    FScopeLock ScopeLock(&Lock);
+
+    FEndpoint& Endpoint = Endpoints.FindOrAdd(Key);
+    if (Endpoint.Slots.Num() < NumSlots)
+    {
+        Endpoint.Slots.SetNum(NumSlots);
+    }
+
+    Acquisitions++;
+
+    int32 FreeSlot = INDEX_NONE;
+    int32 LruSlot = INDEX_NONE;
+    for (int32 i = 0; i < Endpoint.Slots.Num(); ++i)
+    {
+        const FSlot& Slot = Endpoint.Slots[i];
+        if (Slot.OwnerNpcId == NpcId)
+        {
+            if (Slot.bBusy)
+            {
+                // The NPC already has a request in flight on its slot; let the server pick rather than queue behind it.
+                Unpinned++;
+                return Lease;
+            }
+
+            Endpoint.Slots[i].bBusy = true;
+            Endpoint.Slots[i].LastUsedTime = Now;
+            AffinityHits++;
+            Lease.SlotId = i;
+            return Lease;
+        }
+
+        if (Slot.bBusy)
+        {
+            continue;
+        }
+
+        if (Slot.OwnerNpcId.IsEmpty())
+        {
+            if (FreeSlot == INDEX_NONE)
+            {
+                FreeSlot = i;
+            }
+        }
+        else if (LruSlot == INDEX_NONE || Slot.LastUsedTime < Endpoint.Slots[LruSlot].LastUsedTime)
+        {
+            LruSlot = i;
+        }
+    }
+
+    const int32 SlotIndex = FreeSlot != INDEX_NONE ? FreeSlot : LruSlot;
+    if (SlotIndex == INDEX_NONE)
+    {
+        UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | SlotManager] All %d slots on %s are busy, sending %s unpinned"), Endpoint.Slots.Num(), *Key, *NpcId);
+        Unpinned++;
+        return Lease;
+    }
+
+    FSlot& Slot = Endpoint.Slots[SlotIndex];
+    if (!Slot.OwnerNpcId.IsEmpty())
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | SlotManager] Slot %d on %s moves from %s to %s"), SlotIndex, *Key, *Slot.OwnerNpcId, *NpcId);
+        Evictions++;
+
+        if (bSaveState)
+        {
+            Lease.EvictedNpcId = Slot.OwnerNpcId;
+            Lease.SaveFileName = GetSaveFileName(Slot.OwnerNpcId);
+        }
+    }
+
+    if (bSaveState && Endpoint.SavedNpcs.Contains(NpcId))
+    {
+        Lease.RestoreFileName = GetSaveFileName(NpcId);
+    }
+
+    Slot.OwnerNpcId = NpcId;
+    Slot.LastUsedTime = Now;
+    Slot.bBusy = true;
+    Lease.SlotId = SlotIndex;
+
+    return Lease;
+}
+
+void FLlamaSlotManager::PrepareSlot(const FLlamaSlotLease& Lease)
+{
+    if (!Lease.IsValid() || (Lease.SaveFileName.IsEmpty() && Lease.RestoreFileName.IsEmpty()))
+    {
+        return;
+    }
+
+    FLlamaConnectionPool& Pool = FLlamaConnectionPool::Get();
+    const FString Key = FString::Printf(TEXT("%s:%d"), *Lease.Host, Lease.Port);
+
+    if (!Lease.SaveFileName.IsEmpty())
+    {
+        double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+
+        FLlamaHttpResponse Response;
+        const FString Path = FString::Printf(TEXT("/slots/%d?action=save"), Lease.SlotId);
+        const FString Body = FString::Printf(TEXT("{\"filename\":\"%s\"}"), *Lease.SaveFileName);
+        const bool bSaved = Pool.Post(Lease.Host, Lease.Port, Path, Body, Response) && Response.Code == 200;
+
+        FScopeLock ScopeLock(&Lock);
+        if (bSaved)
+        {
+            Saves++;
+            Endpoints.FindOrAdd(Key).SavedNpcs.Add(Lease.EvictedNpcId);
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | SlotManager] Saved slot %d to %s in %.2f ms"), Lease.SlotId, *Lease.SaveFileName, FPlatformTime::Seconds() * 1000.0 - StartTimeBenchmark);
+        }
+        else
+        {
+            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | SlotManager] Failed to save slot %d (HTTP %d), is llama-server running with --slot-save-path? %s"),
+                Lease.SlotId, Response.Code, *Response.Content);
+        }
+    }
+
+    if (!Lease.RestoreFileName.IsEmpty())
+    {
+        double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
+
+        FLlamaHttpResponse Response;
+        const FString Path = FString::Printf(TEXT("/slots/%d?action=restore"), Lease.SlotId);
+        const FString Body = FString::Printf(TEXT("{\"filename\":\"%s\"}"), *Lease.RestoreFileName);
+        const bool bRestored = Pool.Post(Lease.Host, Lease.Port, Path, Body, Response) && Response.Code == 200;
+
+        FScopeLock ScopeLock(&Lock);
+        if (bRestored)
+        {
+            Restores++;
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | SlotManager] Restored %s into slot %d in %.2f ms"), *Lease.RestoreFileName, Lease.SlotId, FPlatformTime::Seconds() * 1000.0 - StartTimeBenchmark);
+        }
+        else
+        {
+            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | SlotManager] Failed to restore slot %d (HTTP %d): %s"), Lease.SlotId, Response.Code, *Response.Content);
+        }
+    }
+}
+
+void FLlamaSlotManager::ReleaseSlot(const FLlamaSlotLease& Lease)
+{
+    if (!Lease.IsValid())
+    {
+        return;
+    }
+
+    FScopeLock ScopeLock(&Lock);
+
+    FEndpoint* Endpoint = Endpoints.Find(FString::Printf(TEXT("%s:%d"), *Lease.Host, Lease.Port));
+    if (Endpoint && Endpoint->Slots.IsValidIndex(Lease.SlotId))
+    {
+        FSlot& Slot = Endpoint->Slots[Lease.SlotId];
+        Slot.bBusy = false;
+        Slot.LastUsedTime = FPlatformTime::Seconds();
+    }
+}
+
+void FLlamaSlotManager::Forget(const FString& Host, int32 Port, const FString& NpcId)
+{
+    FScopeLock ScopeLock(&Lock);
+
+    FEndpoint* Endpoint = Endpoints.Find(FString::Printf(TEXT("%s:%d"), *Host, Port));
+    if (!Endpoint)
+    {
+        return;
+    }
+
+    for (FSlot& Slot : Endpoint->Slots)
+    {
+        if (Slot.OwnerNpcId == NpcId && !Slot.bBusy)
+        {
+            Slot.OwnerNpcId.Empty();
+            Slot.LastUsedTime = 0.0;
+        }
+    }
+    Endpoint->SavedNpcs.Remove(NpcId);
+}
+
+FLlamaSlotManagerStats FLlamaSlotManager::GetStats() const
+{
+    FScopeLock ScopeLock(&Lock);
+
+    FLlamaSlotManagerStats Stats;
+    for (const TPair<FString, FEndpoint>& Pair : Endpoints)
+    {
+        for (const FSlot& Slot : Pair.Value.Slots)
+        {
+            Stats.PinnedNpcs += Slot.OwnerNpcId.IsEmpty() ? 0 : 1;
+        }
+    }
+    Stats.Acquisitions = Acquisitions;
+    Stats.AffinityHits = AffinityHits;
+    Stats.Evictions = Evictions;
+    Stats.Saves = Saves;
+    Stats.Restores = Restores;
+    Stats.Unpinned = Unpinned;
+    return Stats;
+}
+
+FString FLlamaSlotManager::GetSaveFileName(const FString& NpcId)
+{
+    return FString::Printf(TEXT("npc_%s.bin"), *NpcId);
+}
@@ -0,0 +1,449 @@
+#include "LlamaStreamParser.h"
+
+namespace
+{
+    const uint8* FindByte(const uint8* Data, int32 Length, uint8 Byte)
+    {
+        return static_cast<const uint8*>(memchr(Data, Byte, Length));
+    }
+
+    bool EqualsIgnoreCase(const uint8* Data, int32 Length, const ANSICHAR* Literal)
+    {
+        const int32 LiteralLength = FCStringAnsi::Strlen(Literal);
+        if (Length != LiteralLength)
+        {
+            return false;
+        }
+        for (int32 i = 0; i < Length; ++i)
+        {
+            if (FCharAnsi::ToLower(Data[i]) != FCharAnsi::ToLower(Literal[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ContainsIgnoreCase(const uint8* Data, int32 Length, const ANSICHAR* Literal)
+    {
+        const int32 LiteralLength = FCStringAnsi::Strlen(Literal);
+        for (int32 i = 0; i + LiteralLength <= Length; ++i)
+        {
+            if (EqualsIgnoreCase(Data + i, LiteralLength, Literal))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TrimSpaces(const uint8*& Data, int32& Length)
+    {
+        while (Length > 0 && (Data[0] == ' ' || Data[0] == '\t'))
+        {
+            ++Data;
+            --Length;
+        }
+        while (Length > 0 && (Data[Length - 1] == ' ' || Data[Length - 1] == '\t'))
+        {
+            --Length;
+        }
+    }
+}
+
+FLlamaStreamParser::FLlamaStreamParser(bool bInCollectBody)
+    : bCollectBody(bInCollectBody)
+{
+    LineBuffer.Reserve(256);
+    SseLineBuffer.Reserve(1024);
+    EventData.Reserve(1024);
+}
+
+void FLlamaStreamParser::Reset()
+{
+    State = EState::StatusLine;
+    StatusCode = 0;
+    ContentLength = -1;
+    RemainingBytes = 0;
+    bChunked = false;
+    bConnectionClose = false;
+    bEventHasData = false;
+    bEventIsError = false;
+
+    LineBuffer.Reset();
+    SseLineBuffer.Reset();
+    EventData.Reset();
+    Body.Reset();
+}
+
+bool FLlamaStreamParser::Feed(const uint8* Data, int32 Length, TFunctionRef<void(const FLlamaSseEvent&)> OnEvent)
+{
+    int32 Pos = 0;
+
+    while (Pos < Length && State != EState::Error)
+    {
+        switch (State)
+        {
+            case EState::StatusLine:
+            case EState::Headers:
+            case EState::ChunkSize:
+            case EState::ChunkDataEnd:
+            case EState::Trailers:
+            {
+                const uint8* LineStart = Data + Pos;
+                const uint8* NewLine = FindByte(LineStart, Length - Pos, '\n');
+                const int32 SegmentLength = NewLine ? static_cast<int32>(NewLine - LineStart) : Length - Pos;
+
+                if (LineBuffer.Num() + SegmentLength > MaxHeaderLineLength)
+                {
+                    State = EState::Error;
+                    break;
+                }
+
+                LineBuffer.Append(LineStart, SegmentLength);
+                Pos += SegmentLength;
+
+                if (!NewLine)
+                {
+                    break;
+                }
+                ++Pos;
+
+                int32 LineLength = LineBuffer.Num();
+                if (LineLength > 0 && LineBuffer[LineLength - 1] == '\r')
+                {
+                    --LineLength;
+                }
+                const uint8* Line = LineBuffer.GetData();
+
+                if (State == EState::StatusLine)
+                {
+                    // "HTTP/1.1 200 OK"
+                    int32 i = 0;
+                    while (i < LineLength && Line[i] != ' ')
+                    {
+                        ++i;
+                    }
+                    StatusCode = 0;
+                    for (++i; i < LineLength && FCharAnsi::IsDigit(Line[i]); ++i)
+                    {
+                        StatusCode = StatusCode * 10 + (Line[i] - '0');
+                    }
+                    State = StatusCode > 0 ? EState::Headers : EState::Error;
+                }
+                else if (State == EState::Headers)
+                {
+                    if (LineLength == 0)
+                    {
+                        BeginBody();
+                    }
+                    else
+                    {
+                        ProcessHeaderLine(Line, LineLength);
+                    }
+                }
+                else if (State == EState::ChunkSize)
+                {
+                    int64 ChunkSize = 0;
+                    int32 Digits = 0;
+                    for (int32 i = 0; i < LineLength && FCharAnsi::IsHexDigit(Line[i]); ++i, ++Digits)
+                    {
+                        ChunkSize = ChunkSize * 16 + FParse::HexDigit(Line[i]);
+                    }
+
+                    if (Digits == 0 || Digits > 15)
+                    {
+                        State = EState::Error;
+                    }
+                    else if (ChunkSize == 0)
+                    {
+                        State = EState::Trailers;
+                    }
+                    else
+                    {
+                        RemainingBytes = ChunkSize;
+                        State = EState::ChunkData;
+                    }
+                }
+                else if (State == EState::ChunkDataEnd)
+                {
+                    State = LineLength == 0 ? EState::ChunkSize : EState::Error;
+                }
+                else if (State == EState::Trailers && LineLength == 0)
+                {
+                    FlushPendingEvent(OnEvent);
+                    if (State != EState::Error)
+                    {
+                        State = EState::Complete;
+                    }
+                }
+
+                LineBuffer.Reset();
+                break;
+            }
+
+            case EState::ChunkData:
+            {
+                const int32 Count = static_cast<int32>(FMath::Min<int64>(RemainingBytes, Length - Pos));
+                ProcessBody(Data + Pos, Count, OnEvent);
+                if (State == EState::Error)
+                {
+                    break;
+                }
+                Pos += Count;
+                RemainingBytes -= Count;
+
+                if (RemainingBytes == 0)
+                {
+                    State = EState::ChunkDataEnd;
+                }
+                break;
+            }
+
+            case EState::IdentityBody:
+            {
+                int32 Count = Length - Pos;
+                if (ContentLength >= 0)
+                {
+                    Count = static_cast<int32>(FMath::Min<int64>(RemainingBytes, Count));
+                }
+                ProcessBody(Data + Pos, Count, OnEvent);
+                if (State == EState::Error)
+                {
+                    break;
+                }
+                Pos += Count;
+
+                if (ContentLength >= 0)
+                {
+                    RemainingBytes -= Count;
+                    if (RemainingBytes == 0)
+                    {
+                        FlushPendingEvent(OnEvent);
+                        if (State != EState::Error)
+                        {
+                            State = EState::Complete;
+                        }
+                    }
+                }
+                break;
+            }
+
+            case EState::Complete:
+            {
+                // The server sent bytes past the end of the response, so this connection can no longer be trusted.
+                bConnectionClose = true;
+                State = EState::Error;
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    return State != EState::Error;
+}
+
+void FLlamaStreamParser::NotifyConnectionClosed(TFunctionRef<void(const FLlamaSseEvent&)> OnEvent)
+{
+    bConnectionClose = true;
+
+    if (State == EState::IdentityBody && ContentLength < 0)
+    {
+        FlushPendingEvent(OnEvent);
+        if (State != EState::Error)
+        {
+            State = EState::Complete;
+        }
+    }
+    else if (State != EState::Complete)
+    {
+        State = EState::Error;
+    }
+}
+
+void FLlamaStreamParser::ProcessHeaderLine(const uint8* Line, int32 Length)
+{
+    const uint8* Colon = FindByte(Line, Length, ':');
+    if (!Colon)
+    {
+        return;
+    }
+
+    const uint8* Name = Line;
+    int32 NameLength = static_cast<int32>(Colon - Line);
+    const uint8* Value = Colon + 1;
+    int32 ValueLength = Length - NameLength - 1;
+    TrimSpaces(Name, NameLength);
+    TrimSpaces(Value, ValueLength);
+
+    if (EqualsIgnoreCase(Name, NameLength, "Content-Length"))
+    {
+        ContentLength = 0;
+        for (int32 i = 0; i < ValueLength && FCharAnsi::IsDigit(Value[i]); ++i)
+        {
+            ContentLength = ContentLength * 10 + (Value[i] - '0');
+        }
+    }
+    else if (EqualsIgnoreCase(Name, NameLength, "Transfer-Encoding"))
+    {
+        bChunked = ContainsIgnoreCase(Value, ValueLength, "chunked");
+    }
+    else if (EqualsIgnoreCase(Name, NameLength, "Connection"))
+    {
+        bConnectionClose = ContainsIgnoreCase(Value, ValueLength, "close");
+    }
+}
+
+void FLlamaStreamParser::BeginBody()
+{
+    if (bChunked)
+    {
+        State = EState::ChunkSize;
+    }
+    else if (ContentLength == 0)
+    {
+        State = EState::Complete;
+    }
+    else
+    {
+        RemainingBytes = ContentLength;
+        State = EState::IdentityBody;
+
+        if (ContentLength < 0)
+        {
+            // Body is delimited by the server closing the connection.
+            bConnectionClose = true;
+        }
+    }
+}
+
+void FLlamaStreamParser::ProcessBody(const uint8* Data, int32 Length, TFunctionRef<void(const FLlamaSseEvent&)> OnEvent)
+{
+    if (bCollectBody)
+    {
+        Body.Append(Data, Length);
+        return;
+    }
+
+    if (StatusCode < 200 || StatusCode >= 300)
+    {
+        const int32 Count = FMath::Min(Length, MaxErrorBodyLength - Body.Num());
+        if (Count > 0)
+        {
+            Body.Append(Data, Count);
+        }
+        return;
+    }
+
+    int32 Pos = 0;
+    while (Pos < Length)
+    {
+        const uint8* Start = Data + Pos;
+        const uint8* NewLine = FindByte(Start, Length - Pos, '\n');
+        const int32 SegmentLength = NewLine ? static_cast<int32>(NewLine - Start) : Length - Pos;
+
+        if (SseLineBuffer.Num() + SegmentLength > MaxSseLineLength)
+        {
+            State = EState::Error;
+            return;
+        }
+
+        SseLineBuffer.Append(Start, SegmentLength);
+        Pos += SegmentLength;
+
+        if (NewLine)
+        {
+            ++Pos;
+            if (ProcessSseLine())
+            {
+                DispatchEvent(OnEvent);
+            }
+            SseLineBuffer.Reset();
+            if (State == EState::Error)
+            {
+                return;
+            }
+        }
+    }
+}
+
+bool FLlamaStreamParser::ProcessSseLine()
+{
+    int32 Length = SseLineBuffer.Num();
+    if (Length > 0 && SseLineBuffer[Length - 1] == '\r')
+    {
+        --Length;
+    }
+    if (Length == 0)
+    {
+        return true;
+    }
+    if (SseLineBuffer[0] == ':')
+    {
+        return false;
+    }
+
+    const uint8* Line = SseLineBuffer.GetData();
+    const uint8* Colon = FindByte(Line, Length, ':');
+    const int32 NameLength = Colon ? static_cast<int32>(Colon - Line) : Length;
+
+    int32 ValueStart = Colon ? NameLength + 1 : Length;
+    if (ValueStart < Length && Line[ValueStart] == ' ')
+    {
+        ++ValueStart;
+    }
+
+    const bool bIsData = EqualsIgnoreCase(Line, NameLength, "data");
+    const bool bIsError = EqualsIgnoreCase(Line, NameLength, "error");
+    if (bIsData || bIsError)
+    {
+        // An event that is never terminated by an empty line would grow just like an endless line.
+        if (EventData.Num() + Length - ValueStart + 1 > MaxSseLineLength)
+        {
+            State = EState::Error;
+            return false;
+        }
+
+        if (bEventHasData)
+        {
+            EventData.Add('\n');
+        }
+        EventData.Append(Line + ValueStart, Length - ValueStart);
+        bEventHasData = true;
+        bEventIsError |= bIsError;
+    }
+
+    return false;
+}
+
+void FLlamaStreamParser::FlushPendingEvent(TFunctionRef<void(const FLlamaSseEvent&)> OnEvent)
+{
+    if (SseLineBuffer.Num() > 0)
+    {
+        ProcessSseLine();
+        SseLineBuffer.Reset();
+    }
+    if (State != EState::Error)
+    {
+        DispatchEvent(OnEvent);
+    }
+}
+
+void FLlamaStreamParser::DispatchEvent(TFunctionRef<void(const FLlamaSseEvent&)> OnEvent)
+{
+    if (!bEventHasData)
+    {
+        return;
+    }
+
+    FLlamaSseEvent Event;
+    Event.Data = FUtf8StringView(reinterpret_cast<const UTF8CHAR*>(EventData.GetData()), EventData.Num());
+    Event.bIsError = bEventIsError;
+    OnEvent(Event);
+
+    EventData.Reset();
+    bEventHasData = false;
+    bEventIsError = false;
+}
@@ -0,0 +1,111 @@
+#include "LlamaToolCalls.h"
+#include "LlamaRequestBuilder.h"
+#include "Dom/JsonObject.h"
+#include "Dom/JsonValue.h"
+
+void FLlamaToolCallAccumulator::AddDeltas(const TArray<TSharedPtr<FJsonValue>>& ToolCalls)
+{
+    for (const TSharedPtr<FJsonValue>& Value : ToolCalls)
+    {
+        const TSharedPtr<FJsonObject> Delta = Value.IsValid() ? Value->AsObject() : nullptr;
+        if (!Delta.IsValid())
+        {
+            continue;
+        }
+
+        // Without an index, a delta that carries an id starts a new call and any other delta continues the last one.
+        int32 Index;
+        if (!Delta->TryGetNumberField(TEXT("index"), Index))
+        {
+            Index = Delta->HasTypedField<EJson::String>(TEXT("id")) || Calls.IsEmpty() ? Calls.Num() : Calls.Num() - 1;
+        }
+        if (Index < NumPopped || Index > 64)
+        {
+            UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Llama] Ignoring tool call delta for call %d"), Index);
+            continue;
+        }
+        if (Index >= Calls.Num())
+        {
+            Calls.SetNum(Index + 1);
+        }
+
+        Delta->TryGetStringField(TEXT("id"), Calls[Index].Id);
+
+        const TSharedPtr<FJsonObject>* Function;
+        if (Delta->TryGetObjectField(TEXT("function"), Function))
+        {
+            FString Piece;
+            if ((*Function)->TryGetStringField(TEXT("name"), Piece))
+            {
+                Calls[Index].Name += Piece;
+            }
+            if ((*Function)->TryGetStringField(TEXT("arguments"), Piece))
+            {
+                Calls[Index].Arguments += Piece;
+            }
+        }
+    }
+}
+
+void FLlamaToolCallAccumulator::PopCompleted(TArray<FLlamaToolCall>& OutCalls, bool bFinished)
+{
+    const int32 NumCompleted = bFinished ? Calls.Num() : Calls.Num() - 1;
+    for (; NumPopped < NumCompleted; ++NumPopped)
+    {
+        OutCalls.Add(MoveTemp(Calls[NumPopped]));
+    }
+}
+
+void FLlamaToolCallAccumulator::Reset()
+{
+    Calls.Reset();
+    NumPopped = 0;
+}
+
+void FLlamaToolCallAccumulator::ParseMessage(const FJsonObject& Message, TArray<FLlamaToolCall>& OutCalls)
+{
+    const TArray<TSharedPtr<FJsonValue>>* ToolCalls;
+    if (!Message.TryGetArrayField(TEXT("tool_calls"), ToolCalls))
+    {
+        return;
+    }
+
+    for (const TSharedPtr<FJsonValue>& Value : *ToolCalls)
+    {
+        const TSharedPtr<FJsonObject> Call = Value.IsValid() ? Value->AsObject() : nullptr;
+        const TSharedPtr<FJsonObject>* Function;
+        if (Call.IsValid() && Call->TryGetObjectField(TEXT("function"), Function))
+        {
+            FLlamaToolCall& Parsed = OutCalls.AddDefaulted_GetRef();
+            Call->TryGetStringField(TEXT("id"), Parsed.Id);
+            (*Function)->TryGetStringField(TEXT("name"), Parsed.Name);
+            (*Function)->TryGetStringField(TEXT("arguments"), Parsed.Arguments);
+        }
+    }
+}
+
+void FLlamaToolCallAccumulator::AppendJson(FString& Out, TConstArrayView<FLlamaToolCall> Calls)
+{
+    Out.AppendChar(TEXT('['));
+    for (int32 i = 0; i < Calls.Num(); ++i)
+    {
+        if (i > 0)
+        {
+            Out.AppendChar(TEXT(','));
+        }
+        Out.AppendChar(TEXT('{'));
+        if (!Calls[i].Id.IsEmpty())
+        {
+            Out.Append(TEXT("\"id\":"));
+            FLlamaRequestBuilder::AppendJsonString(Out, Calls[i].Id);
+            Out.AppendChar(TEXT(','));
+        }
+        Out.Append(TEXT("\"type\":\"function\",\"function\":{\"name\":"));
+        FLlamaRequestBuilder::AppendJsonString(Out, Calls[i].Name);
+        // The arguments stay a string, as in the response they came from.
+        Out.Append(TEXT(",\"arguments\":"));
+        FLlamaRequestBuilder::AppendJsonString(Out, Calls[i].Arguments.IsEmpty() ? FStringView(TEXT("{}")) : FStringView(Calls[i].Arguments));
+        Out.Append(TEXT("}}"));
+    }
+    Out.AppendChar(TEXT(']'));
+}
@@ -0,0 +1,737 @@
+#include "CoreMinimal.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "LlamaStreamParser.h"
+#include "LlamaDeltaExtractor.h"
+#include "LlamaRequestBuilder.h"
+#include "LlamaSentenceSegmenter.h"
+#include "NpcAiTextSanitizer.h"
+#include "KnowledgeMatrix.h"
+#include "LlamaComponent.h"
+#include "Internationalization/Regex.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+#if !UE_BUILD_SHIPPING
+
+namespace LocalNpcAIBenchmarks
+{
+    void AppendUtf8(TArray<uint8>& Out, const FString& Text)
+    {
+        FTCHARToUTF8 Converted(*Text);
+        Out.Append((const uint8*)Converted.Get(), Converted.Length());
+    }
+
+    // Builds a chunked llama-server style event stream. Chunk boundaries are random and deliberately ignore event boundaries.
+    TArray<uint8> BuildChunkedStream(int32 NumTokens, FRandomStream& Random, TArray<FString>& OutExpectedEvents)
+    {
+        TArray<uint8> Body;
+        for (int32 i = 0; i < NumTokens; ++i)
+        {
+            FString Event = FString::Printf(
+                TEXT("{\"choices\":[{\"finish_reason\":null,\"index\":0,\"delta\":{\"content\":\" tok%d \\u00e9\u00e9\u4f60\"}}],\"created\":1700000000,\"id\":\"chatcmpl-%d\",\"model\":\"npc\",\"object\":\"chat.completion.chunk\"}"),
+                i, i);
+            OutExpectedEvents.Add(Event);
+            AppendUtf8(Body, TEXT("data: ") + Event + TEXT("\r\n\r\n"));
+
+            if (Random.RandHelper(8) == 0)
+            {
+                AppendUtf8(Body, TEXT(": keep-alive comment\n\n"));
+            }
+        }
+        OutExpectedEvents.Add(TEXT("[DONE]"));
+        AppendUtf8(Body, TEXT("data: [DONE]\n\n"));
+
+        TArray<uint8> Stream;
+        AppendUtf8(Stream, TEXT("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\nKeep-Alive: timeout=5\r\n\r\n"));
+
+        int32 Pos = 0;
+        while (Pos < Body.Num())
+        {
+            const int32 ChunkSize = FMath::Min(Body.Num() - Pos, 1 + Random.RandHelper(300));
+            AppendUtf8(Stream, FString::Printf(TEXT("%x\r\n"), ChunkSize));
+            Stream.Append(Body.GetData() + Pos, ChunkSize);
+            AppendUtf8(Stream, TEXT("\r\n"));
+            Pos += ChunkSize;
+        }
+        AppendUtf8(Stream, TEXT("0\r\n\r\n"));
+
+        return Stream;
+    }
+
+    void RunStreamParserBenchmark(const TArray<FString>& Args)
+    {
+        const int32 FuzzIterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 2000;
+        const int32 ThroughputIterations = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 200;
+
+        FRandomStream Random(1234);
+        FLlamaStreamParser Parser;
+
+        int32 Failures = 0;
+        for (int32 Iteration = 0; Iteration < FuzzIterations; ++Iteration)
+        {
+            TArray<FString> Expected;
+            TArray<uint8> Stream = BuildChunkedStream(1 + Random.RandHelper(40), Random, Expected);
+
+            TArray<FString> Received;
+            auto OnEvent = [&Received](const FLlamaSseEvent& Event) { Received.Add(Event.ToString()); };
+
+            Parser.Reset();
+            int32 Pos = 0;
+            while (Pos < Stream.Num())
+            {
+                // Mix single-byte reads, which split CRLFs and UTF-8 sequences, with larger reads.
+                const int32 ReadSize = Random.RandHelper(4) == 0 ? 1 : 1 + Random.RandHelper(512);
+                const int32 Count = FMath::Min(ReadSize, Stream.Num() - Pos);
+                Parser.Feed(Stream.GetData() + Pos, Count, OnEvent);
+                Pos += Count;
+            }
+
+            if (Received != Expected || !Parser.IsMessageComplete() || !Parser.IsKeepAlive())
+            {
+                Failures++;
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Benchmark] Stream parser fuzz iteration %d failed: %d of %d events, complete=%d"),
+                    Iteration, Received.Num(), Expected.Num(), Parser.IsMessageComplete());
+            }
+        }
+
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Stream parser fuzz: %d iterations, %d failures."), FuzzIterations, Failures);
+
+        TArray<FString> Expected;
+        TArray<uint8> Stream = BuildChunkedStream(2000, Random, Expected);
+
+        int64 Events = 0;
+        auto CountEvent = [&Events](const FLlamaSseEvent& Event) { Events += Event.Data.Len() > 0; };
+
+        double StartTime = FPlatformTime::Seconds();
+        for (int32 Iteration = 0; Iteration < ThroughputIterations; ++Iteration)
+        {
+            Parser.Reset();
+            for (int32 Pos = 0; Pos < Stream.Num(); Pos += 8192)
+            {
+                Parser.Feed(Stream.GetData() + Pos, FMath::Min(8192, Stream.Num() - Pos), CountEvent);
+            }
+        }
+        double Duration = FPlatformTime::Seconds() - StartTime;
+
+        const double Megabytes = static_cast<double>(Stream.Num()) * ThroughputIterations / (1024.0 * 1024.0);
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Stream parser throughput: %.2f MB/s, %.1f ns per event (%lld events in %.2f ms)."),
+            Megabytes / Duration, Duration * 1e9 / FMath::Max<int64>(1, Events), Events, Duration * 1000.0);
+    }
+
+    TArray<FString> BuildDeltaPayloads(int32 NumPayloads, FRandomStream& Random)
+    {
+        static const TCHAR* Contents[] = {
+            TEXT(" the"), TEXT(" guard"), TEXT(","), TEXT(" \\\"halt!\\\""), TEXT("\\n"), TEXT(" caf\\u00e9"),
+            TEXT(" \\ud83d\\ude00"), TEXT(" \u4f60\u597d"), TEXT(" [[action: follow"), TEXT("]]"), TEXT("\\t\\/")
+        };
+
+        TArray<FString> Payloads;
+        for (int32 i = 0; i < NumPayloads; ++i)
+        {
+            const TCHAR* Content = Contents[Random.RandHelper(UE_ARRAY_COUNT(Contents))];
+            if (i == NumPayloads - 1)
+            {
+                Payloads.Add(FString::Printf(
+                    TEXT("{\"choices\":[{\"finish_reason\":\"stop\",\"index\":0,\"delta\":{}}],\"created\":1700000000,\"id\":\"chatcmpl-%d\",\"model\":\"npc\",\"object\":\"chat.completion.chunk\",")
+                    TEXT("\"usage\":{\"completion_tokens\":%d,\"prompt_tokens\":412,\"total_tokens\":%d},")
+                    TEXT("\"timings\":{\"cache_n\":398,\"prompt_n\":14,\"prompt_ms\":21.5,\"prompt_per_token_ms\":1.53,\"predicted_n\":%d,\"predicted_ms\":812.25}}"),
+                    i, i, i + 412, i));
+            }
+            else if (i == 0)
+            {
+                Payloads.Add(TEXT("{\"choices\":[{\"finish_reason\":null,\"index\":0,\"delta\":{\"role\":\"assistant\",\"content\":null}}],\"created\":1700000000,\"id\":\"chatcmpl-0\",\"model\":\"npc\",\"object\":\"chat.completion.chunk\"}"));
+            }
+            else
+            {
+                Payloads.Add(FString::Printf(
+                    TEXT("{\"choices\":[{\"finish_reason\":null,\"index\":0,\"delta\":{\"content\":\"%s\"}}],\"created\":1700000000,\"id\":\"chatcmpl-%d\",\"model\":\"npc\",\"object\":\"chat.completion.chunk\"}"),
+                    Content, i));
+            }
+        }
+        return Payloads;
+    }
+
+    // Mirrors what the streaming loop did before the extractor: build a DOM for every chunk and look up the fields.
+    bool ExtractWithDom(const FString& Payload, FString& OutContent, FString& OutFinishReason, int32& OutPromptTokens)
+    {
+        TSharedPtr<FJsonObject> JsonObject;
+        TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Payload);
+        if (!FJsonSerializer::Deserialize(Reader, JsonObject) || !JsonObject.IsValid())
+        {
+            return false;
+        }
+
+        const TArray<TSharedPtr<FJsonValue>>* Choices;
+        const TSharedPtr<FJsonObject>* Delta;
+        if (!JsonObject->TryGetArrayField(TEXT("choices"), Choices) || Choices->Num() == 0
+            || !(*Choices)[0]->AsObject()->TryGetObjectField(TEXT("delta"), Delta))
+        {
+            return false;
+        }
+
+        (*Delta)->TryGetStringField(TEXT("content"), OutContent);
+        (*Choices)[0]->AsObject()->TryGetStringField(TEXT("finish_reason"), OutFinishReason);
+
+        const TSharedPtr<FJsonObject>* Timings;
+        if (JsonObject->TryGetObjectField(TEXT("timings"), Timings))
+        {
+            (*Timings)->TryGetNumberField(TEXT("prompt_n"), OutPromptTokens);
+        }
+        return true;
+    }
+
+    void RunDeltaExtractorBenchmark(const TArray<FString>& Args)
+    {
+        const int32 NumPayloads = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 500;
+        const int32 Iterations = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 100;
+
+        FRandomStream Random(4321);
+        TArray<FString> Payloads = BuildDeltaPayloads(FMath::Max(2, NumPayloads), Random);
+
+        // The extractor reads the same UTF-8 bytes the stream parser hands out.
+        TArray<TArray<uint8>> Utf8Payloads;
+        for (const FString& Payload : Payloads)
+        {
+            AppendUtf8(Utf8Payloads.AddDefaulted_GetRef(), Payload);
+        }
+
+        FLlamaStreamDelta Delta;
+        int32 Mismatches = 0;
+        for (int32 i = 0; i < Payloads.Num(); ++i)
+        {
+            FString DomContent, DomFinishReason;
+            int32 DomPromptTokens = 0;
+            const bool bDomOk = ExtractWithDom(Payloads[i], DomContent, DomFinishReason, DomPromptTokens);
+
+            const FUtf8StringView View(reinterpret_cast<const UTF8CHAR*>(Utf8Payloads[i].GetData()), Utf8Payloads[i].Num());
+            const bool bFastOk = FLlamaDeltaExtractor::Extract(View, Delta);
+
+            if (bDomOk != bFastOk || DomContent != Delta.GetContent() || DomFinishReason != Delta.GetFinishReason()
+                || DomPromptTokens != Delta.Timings.PromptTokens)
+            {
+                Mismatches++;
+                UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Benchmark] Delta extractor disagrees with DOM on: %s"), *Payloads[i]);
+            }
+        }
+
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Delta extractor validation: %d payloads, %d mismatches."), Payloads.Num(), Mismatches);
+
+        int64 Checksum = 0;
+
+        double StartTime = FPlatformTime::Seconds();
+        for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+        {
+            for (const TArray<uint8>& Utf8Payload : Utf8Payloads)
+            {
+                // Include the conversion the streaming loop used to pay before it could build the DOM.
+                auto Converted = StringCast<TCHAR>(reinterpret_cast<const UTF8CHAR*>(Utf8Payload.GetData()), Utf8Payload.Num());
+                FString DomContent, DomFinishReason;
+                int32 DomPromptTokens = 0;
+                ExtractWithDom(FString(Converted.Length(), Converted.Get()), DomContent, DomFinishReason, DomPromptTokens);
+                Checksum += DomContent.Len();
+            }
+        }
+        const double DomDuration = FPlatformTime::Seconds() - StartTime;
+
+        StartTime = FPlatformTime::Seconds();
+        for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+        {
+            for (const TArray<uint8>& Utf8Payload : Utf8Payloads)
+            {
+                FLlamaDeltaExtractor::Extract(FUtf8StringView(reinterpret_cast<const UTF8CHAR*>(Utf8Payload.GetData()), Utf8Payload.Num()), Delta);
+                Checksum += Delta.Content.Len();
+            }
+        }
+        const double FastDuration = FPlatformTime::Seconds() - StartTime;
+
+        const double Count = static_cast<double>(Payloads.Num()) * Iterations;
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Delta extraction: DOM %.1f ns/payload, extractor %.1f ns/payload (%.1fx), checksum %lld."),
+            DomDuration * 1e9 / Count, FastDuration * 1e9 / Count, DomDuration / FMath::Max(FastDuration, 1e-9), Checksum);
+    }
+
+    // The request body as CreateJsonRequest used to build it: a fresh DOM for the whole history, pretty printed.
+    FString BuildRequestWithDom(const FString& SystemMessage, const TArray<TPair<FString, FString>>& Messages)
+    {
+        TSharedPtr<FJsonObject> RootObject = MakeShared<FJsonObject>();
+        RootObject->SetNumberField("temperature", 0.8f);
+        RootObject->SetNumberField("top_p", 0.95f);
+        RootObject->SetNumberField("max_tokens", 300);
+        RootObject->SetNumberField("repeat_penalty", 1.1f);
+        RootObject->SetNumberField("seed", -1);
+        RootObject->SetBoolField("stream", true);
+
+        TArray<TSharedPtr<FJsonValue>> JsonMessages;
+        TSharedPtr<FJsonObject> SystemObj = MakeShared<FJsonObject>();
+        SystemObj->SetStringField("role", "system");
+        SystemObj->SetStringField("content", SystemMessage);
+        JsonMessages.Add(MakeShared<FJsonValueObject>(SystemObj));
+        for (const TPair<FString, FString>& Message : Messages)
+        {
+            TSharedPtr<FJsonObject> MsgObj = MakeShared<FJsonObject>();
+            MsgObj->SetStringField("role", Message.Key);
+            MsgObj->SetStringField("content", Message.Value);
+            JsonMessages.Add(MakeShared<FJsonValueObject>(MsgObj));
+        }
+        RootObject->SetArrayField("messages", JsonMessages);
+
+        FString OutputString;
+        TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&OutputString);
+        FJsonSerializer::Serialize(RootObject.ToSharedRef(), Writer);
+        return OutputString;
+    }
+
+    FString BuildRequestWithBuilder(const FString& SystemMessage, const FLlamaRequestBuilder& Builder)
+    {
+        FString OutputString;
+        OutputString.Reserve(Builder.GetSerializedLength() + SystemMessage.Len() + 512);
+        OutputString.Append(TEXT("{\"temperature\":0.8,\"top_p\":0.95,\"max_tokens\":300,\"repeat_penalty\":1.1,\"seed\":-1,\"stream\":true,\"messages\":["));
+        FLlamaRequestBuilder::AppendMessageObject(OutputString, TEXT("system"), SystemMessage);
+        if (Builder.Num() > 0)
+        {
+            OutputString.AppendChar(TEXT(','));
+            Builder.AppendMessages(OutputString, Builder.Num());
+        }
+        OutputString.Append(TEXT("]}"));
+        return OutputString;
+    }
+
+    bool HasSameMessages(const FString& Body, const FString& SystemMessage, const TArray<TPair<FString, FString>>& Messages)
+    {
+        TSharedPtr<FJsonObject> JsonObject;
+        TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Body);
+        const TArray<TSharedPtr<FJsonValue>>* JsonMessages;
+        if (!FJsonSerializer::Deserialize(Reader, JsonObject) || !JsonObject.IsValid()
+            || !JsonObject->TryGetArrayField(TEXT("messages"), JsonMessages) || JsonMessages->Num() != Messages.Num() + 1)
+        {
+            return false;
+        }
+
+        if ((*JsonMessages)[0]->AsObject()->GetStringField(TEXT("content")) != SystemMessage)
+        {
+            return false;
+        }
+        for (int32 i = 0; i < Messages.Num(); ++i)
+        {
+            const TSharedPtr<FJsonObject> MsgObj = (*JsonMessages)[i + 1]->AsObject();
+            if (MsgObj->GetStringField(TEXT("role")) != Messages[i].Key || MsgObj->GetStringField(TEXT("content")) != Messages[i].Value)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void RunRequestBuilderBenchmark(const TArray<FString>& Args)
+    {
+        const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 50;
+
+        const FString SystemMessage = TEXT("You are Berta, the blacksmith of Eastvale. Answer in one or two short sentences.\n\nYou can perform these actions:\n- follow: Follow the player\n- give: Give an item\n");
+
+        FRandomStream Random(99);
+        for (const int32 NumMessages : { 10, 100, 1000 })
+        {
+            TArray<TPair<FString, FString>> Messages;
+            FLlamaRequestBuilder Builder;
+            for (int32 i = 0; i < NumMessages; ++i)
+            {
+                const FString Role = i % 2 == 0 ? TEXT("user") : TEXT("assistant");
+                const FString Content = FString::Printf(TEXT("Message %d: \"Where is the %s?\"\tShe said\\n it's by the caf\u00e9.\n"), i, Random.RandHelper(2) ? TEXT("forge") : TEXT("mill"));
+                Messages.Emplace(Role, Content);
+                Builder.AppendMessage(Role, Content);
+            }
+
+            const FString DomBody = BuildRequestWithDom(SystemMessage, Messages);
+            const FString BuilderBody = BuildRequestWithBuilder(SystemMessage, Builder);
+            const bool bValid = HasSameMessages(DomBody, SystemMessage, Messages) && HasSameMessages(BuilderBody, SystemMessage, Messages);
+
+            int64 Checksum = 0;
+
+            double StartTime = FPlatformTime::Seconds();
+            for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+            {
+                Checksum += BuildRequestWithDom(SystemMessage, Messages).Len();
+            }
+            const double DomDuration = FPlatformTime::Seconds() - StartTime;
+
+            // The builder also pays once per message when it is added to the history.
+            FLlamaRequestBuilder AppendBuilder;
+            StartTime = FPlatformTime::Seconds();
+            for (const TPair<FString, FString>& Message : Messages)
+            {
+                AppendBuilder.AppendMessage(Message.Key, Message.Value);
+            }
+            const double AppendDuration = FPlatformTime::Seconds() - StartTime;
+
+            StartTime = FPlatformTime::Seconds();
+            for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+            {
+                Checksum += BuildRequestWithBuilder(SystemMessage, Builder).Len();
+            }
+            const double BuilderDuration = FPlatformTime::Seconds() - StartTime;
+
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Request body, %d messages (valid=%d): DOM %.1f us, %d bytes; builder %.1f us, %d bytes (%.1fx). Append: %.2f us per message. Checksum %lld."),
+                NumMessages, bValid, DomDuration * 1e6 / Iterations, DomBody.Len(), BuilderDuration * 1e6 / Iterations, BuilderBody.Len(),
+                DomDuration / FMath::Max(BuilderDuration, 1e-9), AppendDuration * 1e6 / NumMessages, Checksum);
+        }
+    }
+
+    // The chunking HandleStreamChunk used before FLlamaSentenceSegmenter: rescans the whole accumulated text on every token.
+    bool LegacySegment(FString& AccumulatedChunk, const FString& Token, FString& OutChunk)
+    {
+        AccumulatedChunk += Token;
+
+        TSet<FString> AbbreviationWhitelist = {
+        TEXT("Mr."), TEXT("Mrs."), TEXT("Ms."), TEXT("Dr."), TEXT("Jr.")
+        };
+
+        int32 LastDelimiterIndex = -1;
+        for (int32 i = 0; i < AccumulatedChunk.Len(); ++i)
+        {
+            TCHAR CurrentChar = AccumulatedChunk[i];
+            if (CurrentChar == '.' || CurrentChar == '!' || CurrentChar == '?' || CurrentChar == ';' || CurrentChar == '\n' || CurrentChar == '\r')
+            {
+                bool bIsAbbreviation = false;
+                if (CurrentChar == '.')
+                {
+                    int32 Start = FMath::Max(0, i - 8 + 1);
+                    FString Sub = AccumulatedChunk.Mid(Start, i - Start + 1);
+                    for (const FString& Abbr : AbbreviationWhitelist)
+                    {
+                        if (Sub.EndsWith(Abbr))
+                        {
+                            bIsAbbreviation = true;
+                            break;
+                        }
+                    }
+                }
+                if (!bIsAbbreviation)
+                {
+                    LastDelimiterIndex = i;
+                }
+            }
+        }
+
+        if (LastDelimiterIndex == -1)
+        {
+            return false;
+        }
+
+        OutChunk = AccumulatedChunk.Left(LastDelimiterIndex + 1);
+        AccumulatedChunk = AccumulatedChunk.Mid(LastDelimiterIndex + 1);
+        return true;
+    }
+
+    // Random token sizes, like a tokenizer would produce. Long runs without any split point are the legacy worst case.
+    TArray<FString> BuildTokens(int32 NumCharacters, FRandomStream& Random)
+    {
+        static const TCHAR* Words[] = { TEXT("the"), TEXT("blacksmith"), TEXT("Mr."), TEXT("Dr."), TEXT("forge"), TEXT("river,"), TEXT("old"), TEXT("mill:"), TEXT("sword") };
+
+        FString Text;
+        while (Text.Len() < NumCharacters)
+        {
+            Text += Words[Random.RandHelper(UE_ARRAY_COUNT(Words))];
+            const int32 Roll = Random.RandHelper(40);
+            Text += Roll == 0 ? TEXT(". ") : Roll == 1 ? TEXT("! ") : TEXT(" ");
+        }
+
+        TArray<FString> Tokens;
+        for (int32 Pos = 0; Pos < Text.Len();)
+        {
+            const int32 Len = FMath::Min(Text.Len() - Pos, 1 + Random.RandHelper(6));
+            Tokens.Add(Text.Mid(Pos, Len));
+            Pos += Len;
+        }
+        return Tokens;
+    }
+
+    void RunSentenceSegmenterBenchmark(const TArray<FString>& Args)
+    {
+        const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 5;
+
+        FRandomStream Random(7);
+        for (const int32 NumCharacters : { 1000, 10000, 100000 })
+        {
+            const TArray<FString> Tokens = BuildTokens(NumCharacters, Random);
+
+            TArray<FString> LegacyChunks;
+            TArray<FString> SegmenterChunks;
+            int32 ClauseChunks = 0;
+
+            double StartTime = FPlatformTime::Seconds();
+            for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+            {
+                LegacyChunks.Reset();
+                FString Accumulated;
+                FString Chunk;
+                for (const FString& Token : Tokens)
+                {
+                    if (LegacySegment(Accumulated, Token, Chunk))
+                    {
+                        LegacyChunks.Add(Chunk);
+                    }
+                }
+                LegacyChunks.Add(Accumulated);
+            }
+            const double LegacyDuration = FPlatformTime::Seconds() - StartTime;
+
+            const FLlamaChunkingSettings DefaultSettings;
+            FLlamaSentenceSegmenter Segmenter;
+            StartTime = FPlatformTime::Seconds();
+            for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+            {
+                SegmenterChunks.Reset();
+                FString Chunk;
+                for (const FString& Token : Tokens)
+                {
+                    if (Segmenter.Append(Token, DefaultSettings, Chunk))
+                    {
+                        SegmenterChunks.Add(Chunk);
+                    }
+                }
+                SegmenterChunks.Add(Segmenter.Flush());
+            }
+            const double SegmenterDuration = FPlatformTime::Seconds() - StartTime;
+
+            FLlamaChunkingSettings ClauseSettings;
+            ClauseSettings.MinCharacters = 24;
+            ClauseSettings.bSplitOnClauses = true;
+            ClauseSettings.bAggressiveFirstChunk = true;
+            FString Chunk;
+            for (const FString& Token : Tokens)
+            {
+                ClauseChunks += Segmenter.Append(Token, ClauseSettings, Chunk) ? 1 : 0;
+            }
+            Segmenter.Flush();
+
+            const bool bSameChunks = LegacyChunks == SegmenterChunks;
+
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Sentence segmenter, %d characters in %d tokens (same chunks=%d, %d chunks, %d with clauses): legacy %.1f us, segmenter %.1f us (%.1fx)."),
+                NumCharacters, Tokens.Num(), bSameChunks, SegmenterChunks.Num(), ClauseChunks, LegacyDuration * 1e6 / Iterations, SegmenterDuration * 1e6 / Iterations,
+                LegacyDuration / FMath::Max(SegmenterDuration, 1e-9));
+        }
+    }
+
+    // The regex based SanitizeString the components used before FNpcAiTextSanitizer.
+    FString LegacySanitize(const FString& String)
+    {
+        auto RegexReplace = [](const FString& InputStr, const FString& PatternStr) -> FString
+            {
+                FRegexPattern Pattern(PatternStr);
+                FString Output = InputStr;
+
+                FRegexMatcher Matcher(Pattern, Output);
+                while (Matcher.FindNext())
+                {
+                    int32 Start = Matcher.GetMatchBeginning();
+                    int32 Length = Matcher.GetMatchEnding() - Start;
+                    Output.RemoveAt(Start, Length);
+
+                    Matcher = FRegexMatcher(Pattern, Output);
+                }
+
+                return Output;
+            };
+
+        FString Result = RegexReplace(String, TEXT("\\[\\[action: .*?\\]\\]"));
+        Result = RegexReplace(Result, TEXT("\\[[^\\]]*\\]"));
+        Result = RegexReplace(Result, TEXT("\\*[^\\*]*\\*"));
+        return Result.TrimStartAndEnd();
+    }
+
+    void RunTextSanitizerBenchmark(const TArray<FString>& Args)
+    {
+        const int32 Iterations = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 20;
+
+        static const TCHAR* Pieces[] = { TEXT("Well, "), TEXT("*wipes the counter* "), TEXT("the forge is north. "), TEXT("[[action: follow]] "),
+            TEXT("[grumbles] "), TEXT("Come along! "), TEXT("*sighs [quietly]* "), TEXT("Mind the river. ") };
+
+        FRandomStream Random(11);
+        for (const int32 NumCharacters : { 200, 2000, 20000 })
+        {
+            FString Text;
+            while (Text.Len() < NumCharacters)
+            {
+                Text += Pieces[Random.RandHelper(UE_ARRAY_COUNT(Pieces))];
+            }
+
+            // Streamed in small tokens, so spans regularly open in one token and close in a later one.
+            TArray<FString> Tokens;
+            for (int32 Pos = 0; Pos < Text.Len();)
+            {
+                const int32 Len = FMath::Min(Text.Len() - Pos, 1 + Random.RandHelper(6));
+                Tokens.Add(Text.Mid(Pos, Len));
+                Pos += Len;
+            }
+
+            const FString Expected = LegacySanitize(Text);
+            FString Streamed;
+            FNpcAiTextSanitizer StreamSanitizer;
+            for (const FString& Token : Tokens)
+            {
+                StreamSanitizer.Append(Token, Streamed);
+            }
+            StreamSanitizer.Flush(Streamed);
+            const bool bValid = FNpcAiTextSanitizer::Sanitize(Text) == Expected && Streamed.TrimStartAndEnd() == Expected;
+
+            int64 Checksum = 0;
+
+            double StartTime = FPlatformTime::Seconds();
+            for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+            {
+                Checksum += LegacySanitize(Text).Len();
+            }
+            const double RegexDuration = FPlatformTime::Seconds() - StartTime;
+
+            StartTime = FPlatformTime::Seconds();
+            for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+            {
+                Checksum += FNpcAiTextSanitizer::Sanitize(Text).Len();
+            }
+            const double SanitizerDuration = FPlatformTime::Seconds() - StartTime;
+
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Text sanitizer, %d characters (valid=%d): regex %.1f us, single pass %.1f us (%.1fx). Checksum %lld."),
+                Text.Len(), bValid, RegexDuration * 1e6 / Iterations, SanitizerDuration * 1e6 / Iterations, RegexDuration / FMath::Max(SanitizerDuration, 1e-9), Checksum);
+        }
+    }
+
+    // The cosine similarity GetTopKDocuments used before FKnowledgeMatrix, with both norms recomputed for every chunk.
+    float LegacyCosineSimilarity(const TArray<float>& A, const TArray<float>& B)
+    {
+        double DotProduct = 0.0;
+        double NormA = 0.0;
+        double NormB = 0.0;
+        for (int32 i = 0; i < A.Num(); i++)
+        {
+            DotProduct += A[i] * B[i];
+            NormA += A[i] * A[i];
+            NormB += B[i] * B[i];
+        }
+
+        double Denom = FMath::Sqrt(NormA) * FMath::Sqrt(NormB);
+        return Denom <= KINDA_SMALL_NUMBER ? 0.0f : static_cast<float>(DotProduct / Denom);
+    }
+
+    // The old search: every chunk scored and copied, then all of them sorted.
+    TArray<int32> LegacyTopK(const TArray<FKnowledgeEntry>& Knowledge, const TArray<float>& Query, int32 K)
+    {
+        struct FScoredChunk
+        {
+            float Score;
+            FString Text;
+            int32 Index;
+        };
+
+        TArray<FScoredChunk> ScoredChunks;
+        ScoredChunks.Reserve(Knowledge.Num());
+        for (int32 i = 0; i < Knowledge.Num(); i++)
+        {
+            ScoredChunks.Add({ LegacyCosineSimilarity(Query, Knowledge[i].Embedding), Knowledge[i].Text, i });
+        }
+        ScoredChunks.Sort([](const FScoredChunk& A, const FScoredChunk& B) { return A.Score > B.Score; });
+
+        TArray<int32> Rows;
+        for (int32 i = 0; i < FMath::Min(K, ScoredChunks.Num()); i++)
+        {
+            Rows.Add(ScoredChunks[i].Index);
+        }
+        return Rows;
+    }
+
+    void RunKnowledgeSearchBenchmark(const TArray<FString>& Args)
+    {
+        const int32 Dimensions = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 384;
+        const int32 NumQueries = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 20;
+        const int32 K = 10;
+
+        FRandomStream Random(5);
+        for (const int32 NumChunks : { 1000, 10000, 100000 })
+        {
+            TArray<FKnowledgeEntry> Entries;
+            Entries.SetNum(NumChunks);
+            for (int32 i = 0; i < NumChunks; i++)
+            {
+                Entries[i].Text = FString::Printf(TEXT("Lore chunk %d about the village, its smith and the road north."), i);
+                Entries[i].Embedding.SetNumUninitialized(Dimensions);
+                for (float& Value : Entries[i].Embedding)
+                {
+                    Value = Random.FRandRange(-1.0f, 1.0f);
+                }
+            }
+
+            TArray<TArray<float>> Queries;
+            Queries.SetNum(NumQueries);
+            for (TArray<float>& Query : Queries)
+            {
+                Query.SetNumUninitialized(Dimensions);
+                for (float& Value : Query)
+                {
+                    Value = Random.FRandRange(-1.0f, 1.0f);
+                }
+            }
+
+            TArray<FKnowledgeEntry> MatrixEntries = Entries;
+            double StartTime = FPlatformTime::Seconds();
+            FKnowledgeMatrix Matrix;
+            Matrix.Build(MoveTemp(MatrixEntries));
+            const double BuildDuration = FPlatformTime::Seconds() - StartTime;
+
+            TArray<TArray<int32>> LegacyRows;
+            StartTime = FPlatformTime::Seconds();
+            for (const TArray<float>& Query : Queries)
+            {
+                LegacyRows.Add(LegacyTopK(Entries, Query, K));
+            }
+            const double LegacyDuration = FPlatformTime::Seconds() - StartTime;
+
+            TArray<TArray<int32>> MatrixRows;
+            MatrixRows.SetNum(NumQueries);
+            StartTime = FPlatformTime::Seconds();
+            for (int32 i = 0; i < NumQueries; i++)
+            {
+                Matrix.FindNearest(Queries[i], K, MatrixRows[i]);
+            }
+            const double MatrixDuration = FPlatformTime::Seconds() - StartTime;
+
+            const bool bSameResults = LegacyRows == MatrixRows;
+
+            UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Benchmark] Knowledge search, %d chunks of %d dimensions (same results=%d): legacy %.1f us, matrix %.1f us per query (%.1fx). Matrix built in %.2f ms."),
+                NumChunks, Dimensions, bSameResults, LegacyDuration * 1e6 / NumQueries, MatrixDuration * 1e6 / NumQueries,
+                LegacyDuration / FMath::Max(MatrixDuration, 1e-9), BuildDuration * 1e3);
+        }
+    }
+}
+
+static FAutoConsoleCommand StreamParserBenchmarkCommand(
+    TEXT("LocalNpcAI.Benchmark.StreamParser"),
+    TEXT("Fuzzes the llama stream parser with adversarial split points and reports its throughput. Args: [FuzzIterations] [ThroughputIterations]"),
+    FConsoleCommandWithArgsDelegate::CreateStatic(&LocalNpcAIBenchmarks::RunStreamParserBenchmark));
+
+static FAutoConsoleCommand DeltaExtractorBenchmarkCommand(
+    TEXT("LocalNpcAI.Benchmark.DeltaExtractor"),
+    TEXT("Checks the streamed delta extractor against the JSON DOM and compares their cost per chunk. Args: [NumPayloads] [Iterations]"),
+    FConsoleCommandWithArgsDelegate::CreateStatic(&LocalNpcAIBenchmarks::RunDeltaExtractorBenchmark));
+
+static FAutoConsoleCommand RequestBuilderBenchmarkCommand(
+    TEXT("LocalNpcAI.Benchmark.RequestBuilder"),
+    TEXT("Compares building chat request bodies from the JSON DOM with the serialized message buffer for 10, 100 and 1000 messages. Args: [Iterations]"),
+    FConsoleCommandWithArgsDelegate::CreateStatic(&LocalNpcAIBenchmarks::RunRequestBuilderBenchmark));
+
+static FAutoConsoleCommand SentenceSegmenterBenchmarkCommand(
+    TEXT("LocalNpcAI.Benchmark.SentenceSegmenter"),
+    TEXT("Compares the incremental sentence segmenter with rescanning the accumulated text per token on 1k, 10k and 100k character responses. Args: [Iterations]"),
+    FConsoleCommandWithArgsDelegate::CreateStatic(&LocalNpcAIBenchmarks::RunSentenceSegmenterBenchmark));
+
+static FAutoConsoleCommand TextSanitizerBenchmarkCommand(
+    TEXT("LocalNpcAI.Benchmark.TextSanitizer"),
+    TEXT("Checks the single-pass text sanitizer, whole and streamed token by token, against the regex version and compares their cost. Args: [Iterations]"),
+    FConsoleCommandWithArgsDelegate::CreateStatic(&LocalNpcAIBenchmarks::RunTextSanitizerBenchmark));
+
+static FAutoConsoleCommand KnowledgeSearchBenchmarkCommand(
+    TEXT("LocalNpcAI.Benchmark.KnowledgeSearch"),
+    TEXT("Compares the per-chunk cosine similarity search with the normalized SIMD knowledge matrix at 1k, 10k and 100k chunks. Args: [Dimensions] [Queries]"),
+    FConsoleCommandWithArgsDelegate::CreateStatic(&LocalNpcAIBenchmarks::RunKnowledgeSearchBenchmark));
+
+#endif
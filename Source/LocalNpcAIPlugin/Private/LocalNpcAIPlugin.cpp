@@ -1,6 +1,8 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "LocalNpcAIPlugin.h"
+#include "LlamaConnectionPool.h"
+#include "NpcAiTaskPool.h"
 
 #define LOCTEXT_NAMESPACE "FLocalNpcAIPluginModule"
 
@@ -13,6 +15,8 @@ void FLocalNpcAIPluginModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+	FNpcAiTaskPool::Get().Shutdown();
+	FLlamaConnectionPool::Get().Shutdown();
 }
 
 #undef LOCTEXT_NAMESPACE
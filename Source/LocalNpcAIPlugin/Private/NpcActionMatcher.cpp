@@ -0,0 +1,84 @@
+#include "NpcActionMatcher.h"
+
+void FNpcActionMatcher::Reset()
+{
+    Nodes.Reset();
+    Objects.Reset();
+}
+
+void FNpcActionMatcher::AddAction(const FString& Name, int32 Index)
+{
+    if (Name.IsEmpty())
+    {
+        return;
+    }
+
+    if (Nodes.IsEmpty())
+    {
+        Nodes.AddDefaulted();
+    }
+
+    int32 Node = 0;
+    for (const TCHAR Char : Name)
+    {
+        const TCHAR Folded = FChar::ToLower(Char);
+        if (const int32* Child = Nodes[Node].Children.Find(Folded))
+        {
+            Node = *Child;
+        }
+        else
+        {
+            const int32 NewNode = Nodes.AddDefaulted();
+            Nodes[Node].Children.Add(Folded, NewNode);
+            Node = NewNode;
+        }
+    }
+
+    if (Nodes[Node].Action == INDEX_NONE)
+    {
+        Nodes[Node].Action = Index;
+    }
+}
+
+void FNpcActionMatcher::AddObject(const FString& Name, int32 Index)
+{
+    if (!Objects.Contains(Name))
+    {
+        Objects.Add(Name, Index);
+    }
+}
+
+int32 FNpcActionMatcher::MatchAction(FStringView Command, int32& OutNameLength) const
+{
+    int32 Match = INDEX_NONE;
+    OutNameLength = 0;
+
+    if (Nodes.IsEmpty())
+    {
+        return Match;
+    }
+
+    int32 Node = 0;
+    for (int32 i = 0; i < Command.Len(); ++i)
+    {
+        const int32* Child = Nodes[Node].Children.Find(FChar::ToLower(Command[i]));
+        if (!Child)
+        {
+            break;
+        }
+
+        Node = *Child;
+        if (Nodes[Node].Action != INDEX_NONE)
+        {
+            Match = Nodes[Node].Action;
+            OutNameLength = i + 1;
+        }
+    }
+    return Match;
+}
+
+int32 FNpcActionMatcher::FindObject(const FString& Name) const
+{
+    const int32* Index = Objects.Find(Name);
+    return Index ? *Index : INDEX_NONE;
+}
@@ -30,6 +30,8 @@ void UNpcAiComponent::StartWhisperRecording()
 	bIsWhisperRecording = true;
 
 	WhisperComponent->StartRecording();
+
+    NotifyPlayerStartedInput();
 }
 
 void UNpcAiComponent::StopWhisperRecordingAndSendAudio()
@@ -67,10 +69,94 @@ void UNpcAiComponent::SendText(FString Input)
     }
 
     bIsUsersConversationTurn = false;
+    bIsNpcResponding = true;
+    // The reply starts a message of its own instead of being appended to the previous one.
+    bIsFirstChunk = true;
 
+    GreetInstantly();
 	LlamaComponent->SendChatMessage(Input);
 }
 
+void UNpcAiComponent::SetWorldContext(FString Context)
+{
+    if (!LlamaComponent)
+    {
+        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | NpcAiComponent] LlamaComponent is not initialized."));
+        return;
+    }
+
+    LlamaComponent->WorldContext = Context;
+}
+
+void UNpcAiComponent::NotifyPlayerStartedInput()
+{
+    if (bSpeculativePrefill && LlamaComponent)
+    {
+        LlamaComponent->PrefillPrompt();
+    }
+}
+
+void UNpcAiComponent::SetInferencePriority(EInferencePriority Priority)
+{
+    InferencePriority = Priority;
+
+    if (WhisperComponent)
+    {
+        WhisperComponent->InferencePriority = Priority;
+    }
+    if (LlamaComponent)
+    {
+        LlamaComponent->InferencePriority = Priority;
+    }
+    if (KokoroComponent)
+    {
+        KokoroComponent->InferencePriority = Priority;
+    }
+}
+
+void UNpcAiComponent::CancelCurrentTurn()
+{
+    if (WhisperComponent)
+    {
+        WhisperComponent->CancelTranscription();
+    }
+
+    StopNpcResponse();
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | NpcAiComponent] Current turn cancelled."));
+}
+
+FNpcResponseCacheStats UNpcAiComponent::GetResponseCacheStats() const
+{
+    return LlamaComponent ? LlamaComponent->GetResponseCacheStats() : FNpcResponseCacheStats();
+}
+
+FKokoroAudioCacheStats UNpcAiComponent::GetAudioCacheStats() const
+{
+    return KokoroComponent ? KokoroComponent->GetAudioCacheStats() : FKokoroAudioCacheStats();
+}
+
+void UNpcAiComponent::StopNpcResponse()
+{
+    if (LlamaComponent)
+    {
+        LlamaComponent->CancelPendingRequests();
+    }
+    if (KokoroComponent)
+    {
+        KokoroComponent->StopSpeaking();
+    }
+
+    if (bIsNpcResponding && !bIsFirstChunk && PlayerAiComponent && PlayerAiComponent->ChatWidgetInstance)
+    {
+        PlayerAiComponent->ChatWidgetInstance->AppendToLastMessage(TEXT("..."));
+    }
+
+    bIsNpcResponding = false;
+    bIsFirstChunk = true;
+    bIsUsersConversationTurn = true;
+}
+
 void UNpcAiComponent::BeginPlay()
 {
     Super::BeginPlay();
@@ -82,20 +168,26 @@ void UNpcAiComponent::BeginPlay()
     {
         WhisperComponent->RegisterComponent();
         WhisperComponent->Port = WhisperPort;
+        WhisperComponent->WhisperEndpoints = WhisperEndpoints;
 		WhisperComponent->VadMode = VadMode;
 		WhisperComponent->SecondsOfSilenceBeforeSend = SecondsOfSilenceBeforeSend;
 		WhisperComponent->MinSpeechDuration = MinSpeechDuration;
 		WhisperComponent->EnergyThreshold = EnergyThreshold;
 		WhisperComponent->WebRtcVadAggressiveness = WebRtcVadAggressiveness;
+        WhisperComponent->InferencePriority = InferencePriority;
 
         WhisperComponent->OnTranscriptionComplete.AddDynamic(this, &UNpcAiComponent::HandleWhisperTranscriptionComplete);
+        WhisperComponent->OnSpeechStarted.AddDynamic(this, &UNpcAiComponent::HandleWhisperSpeechStarted);
     }
 
     LlamaComponent = NewObject<ULlamaComponent>(this, ULlamaComponent::StaticClass(), TEXT("LlamaComponent"));
     if (LlamaComponent)
     {
-        LlamaComponent->RegisterComponent();
+        // Registering runs the component's BeginPlay, which builds the system message, the action grammar or tools and
+        // starts the knowledge build from these settings, so they have to be in place first.
         LlamaComponent->Port = LlamaPort;
+        LlamaComponent->LlamaEndpoints = LlamaEndpoints;
+        LlamaComponent->bHedgeShortRequests = bHedgeShortRequests;
         LlamaComponent->SystemMessage = SystemMessage;
         LlamaComponent->Temperature = Temperature;
         LlamaComponent->TopP = TopP;
@@ -103,22 +195,49 @@ void UNpcAiComponent::BeginPlay()
         LlamaComponent->Seed = Seed;
         LlamaComponent->RepeatPenalty = RepeatPenalty;
         LlamaComponent->bStream = bStream;
+        LlamaComponent->StreamDeliveryBudgetMs = StreamDeliveryBudgetMs;
+        LlamaComponent->ChunkingSettings = ChunkingSettings;
+        LlamaComponent->PromptLayout = PromptLayout;
+        LlamaComponent->bCachePrompt = bCachePrompt;
+        LlamaComponent->ServerSlots = ServerSlots;
+        LlamaComponent->bSaveSlotState = bSaveSlotState;
+        LlamaComponent->FallbackResponses = FallbackResponses;
+        LlamaComponent->HistoryTokenBudget = HistoryTokenBudget;
+        LlamaComponent->SummaryMaxTokens = SummaryMaxTokens;
+        LlamaComponent->InferencePriority = InferencePriority;
 
 		LlamaComponent->RagMode = RagMode;
         LlamaComponent->EmbeddingPort = EmbeddingPort;
         LlamaComponent->RerankerPort = RerankerPort;
+        LlamaComponent->EmbeddingEndpoints = EmbeddingEndpoints;
+        LlamaComponent->RerankerEndpoints = RerankerEndpoints;
 		LlamaComponent->KnowledgePath = KnowledgePath;
 		LlamaComponent->EmbeddingTopK = EmbeddingTopK;
 		LlamaComponent->RerankingTopN = RerankingTopN;
 		LlamaComponent->SentencesPerChunk = SentencesPerChunk;
         LlamaComponent->SentenceOverlap = SentenceOverlap;
+        LlamaComponent->KnowledgeBatchSize = KnowledgeBatchSize;
+        LlamaComponent->KnowledgeBatchesInFlight = KnowledgeBatchesInFlight;
+        LlamaComponent->bPersistKnowledgeIndex = bPersistKnowledgeIndex;
+        LlamaComponent->KnowledgeIndexFolder = KnowledgeIndexFolder;
+        LlamaComponent->EmbeddingModelId = EmbeddingModelId;
+
+        LlamaComponent->bUseResponseCache = bUseResponseCache;
+        LlamaComponent->ResponseCacheSimilarity = ResponseCacheSimilarity;
+        LlamaComponent->ResponseCacheTtlSeconds = ResponseCacheTtlSeconds;
+        LlamaComponent->ResponseCacheMaxEntries = ResponseCacheMaxEntries;
+        LlamaComponent->ResponseCacheContextMessages = ResponseCacheContextMessages;
 
 		LlamaComponent->KnownActions = KnownActions;
         LlamaComponent->KnownObjects = KnownObjects;
+        LlamaComponent->ActionOutputMode = ActionOutputMode;
 		
 		LlamaComponent->OnResponseReceived.AddDynamic(this, &UNpcAiComponent::HandleLlamaResponseReceived);
+        LlamaComponent->OnActionOnlyResponse.AddDynamic(this, &UNpcAiComponent::HandleLlamaActionOnlyResponse);
         LlamaComponent->OnChunkReceived.AddDynamic(this, &UNpcAiComponent::HandleLlamaChunkReceived);
         LlamaComponent->OnActionReceived.AddDynamic(this, &UNpcAiComponent::HandleLlamaActionReceived);
+
+        LlamaComponent->RegisterComponent();
     }
 
     KokoroComponent = NewObject<UKokoroComponent>(this, UKokoroComponent::StaticClass(), TEXT("KokoroComponent"));
@@ -127,9 +246,12 @@ void UNpcAiComponent::BeginPlay()
         KokoroComponent->RegisterComponent();
         KokoroComponent->AttachToComponent(this, FAttachmentTransformRules::KeepRelativeTransform);
         KokoroComponent->Port = KokoroPort;
+        KokoroComponent->KokoroEndpoints = KokoroEndpoints;
         KokoroComponent->Voice = Voice;
         KokoroComponent->Speed = Speed;
         KokoroComponent->Volume = Volume;
+        KokoroComponent->InferencePriority = InferencePriority;
+        KokoroComponent->AudioCacheEntries = bUseResponseCache ? ResponseCacheMaxEntries : 0;
 
 		KokoroComponent->OnSoundReady.AddDynamic(this, &UNpcAiComponent::HandleKokoroSoundReady);
     }
@@ -148,6 +270,123 @@ void UNpcAiComponent::BeginPlay()
     {
         PlayerAiComponent = PlayerPawn->FindComponentByClass<UPlayerAiComponent>();
     }
+
+    PregenerateLines();
+}
+
+void UNpcAiComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+    // A turn still in flight would otherwise keep its transcription, request and speech going for an NPC that is gone.
+    CancelCurrentTurn();
+
+    Super::EndPlay(EndPlayReason);
+}
+
+void UNpcAiComponent::PregenerateLines()
+{
+    if (!LlamaComponent)
+    {
+        return;
+    }
+
+    // The lines arrive long after this call, possibly after the NPC is gone.
+    TWeakObjectPtr<UNpcAiComponent> WeakThis(this);
+
+    // Both run at background priority, so they only take the servers while nobody is talking to an NPC.
+    if (GreetingPoolSize > 0)
+    {
+        LlamaComponent->GenerateLines(TEXT("Someone walks up to you to start a conversation. How do you greet them?"), GreetingPoolSize, [WeakThis](TArray<FString> Lines)
+            {
+                AsyncTask(ENamedThreads::GameThread, [WeakThis, Lines = MoveTemp(Lines)]()
+                    {
+                        UNpcAiComponent* Npc = WeakThis.Get();
+                        if (!Npc || !Npc->KokoroComponent)
+                        {
+                            return;
+                        }
+                        for (const FString& Line : Lines)
+                        {
+                            Npc->KokoroComponent->PrepareSoundWave(Line);
+                        }
+                        Npc->Greetings = Lines;
+                    });
+            });
+    }
+
+    if (BarkPoolSize > 0)
+    {
+        LlamaComponent->GenerateLines(TEXT("You are going about your day and nobody is talking to you. What do you say to yourself?"), BarkPoolSize, [WeakThis](TArray<FString> Lines)
+            {
+                AsyncTask(ENamedThreads::GameThread, [WeakThis, Lines = MoveTemp(Lines)]()
+                    {
+                        UNpcAiComponent* Npc = WeakThis.Get();
+                        if (!Npc || !Npc->KokoroComponent)
+                        {
+                            return;
+                        }
+                        for (const FString& Line : Lines)
+                        {
+                            Npc->KokoroComponent->PrepareSoundWave(Line);
+                        }
+                        Npc->Barks = Lines;
+                    });
+            });
+    }
+}
+
+FString UNpcAiComponent::PickPreparedLine(const TArray<FString>& Lines) const
+{
+    TArray<const FString*> Ready;
+    for (const FString& Line : Lines)
+    {
+        if (KokoroComponent && KokoroComponent->HasCachedAudio(Line))
+        {
+            Ready.Add(&Line);
+        }
+    }
+    return Ready.IsEmpty() ? FString() : *Ready[FMath::RandRange(0, Ready.Num() - 1)];
+}
+
+void UNpcAiComponent::GreetInstantly()
+{
+    // Only the very first message; a greeting that is not ready by then would come too late.
+    if (bHasGreeted)
+    {
+        return;
+    }
+    bHasGreeted = true;
+
+    const FString Greeting = PickPreparedLine(Greetings);
+    if (Greeting.IsEmpty())
+    {
+        return;
+    }
+
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | NpcAiComponent] Greeting with a prepared line: %s"), *Greeting);
+
+    if (PlayerAiComponent && PlayerAiComponent->ChatWidgetInstance)
+    {
+        PlayerAiComponent->ChatWidgetInstance->AddMessage(Name, Greeting);
+    }
+    KokoroComponent->CreateSoundWave(Greeting);
+    LlamaComponent->SetResponseOpener(Greeting);
+}
+
+bool UNpcAiComponent::PlayIdleBark()
+{
+    if (!KokoroComponent || !bIsUsersConversationTurn || bIsNpcResponding || bIsWhisperRecording || KokoroComponent->IsSpeaking())
+    {
+        return false;
+    }
+
+    const FString Bark = PickPreparedLine(Barks);
+    if (Bark.IsEmpty())
+    {
+        return false;
+    }
+
+    KokoroComponent->CreateSoundWave(Bark);
+    return true;
 }
 
 void UNpcAiComponent::HandleWhisperTranscriptionComplete(const FString& Transcription)
@@ -171,6 +410,10 @@ void UNpcAiComponent::HandleWhisperTranscriptionComplete(const FString& Transcri
 
     if (LlamaComponent)
     {
+        bIsUsersConversationTurn = false;
+        bIsNpcResponding = true;
+        bIsFirstChunk = true;
+        GreetInstantly();
         LlamaComponent->SendChatMessage(Transcription);
     }
     else
@@ -181,8 +424,22 @@ void UNpcAiComponent::HandleWhisperTranscriptionComplete(const FString& Transcri
 	}
 }
 
+void UNpcAiComponent::HandleWhisperSpeechStarted()
+{
+    if (bAllowBargeIn && (bIsNpcResponding || (KokoroComponent && KokoroComponent->IsSpeaking())))
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | NpcAiComponent] Player started speaking, interrupting %s."), *Name);
+
+        StopNpcResponse();
+    }
+
+    NotifyPlayerStartedInput();
+}
+
 void UNpcAiComponent::HandleLlamaResponseReceived(const FString& Response)
 {
+    bIsNpcResponding = false;
+
     if (Response.IsEmpty())
     {
         UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | NpcAiComponent] Received empty response."));
@@ -220,7 +477,7 @@ void UNpcAiComponent::HandleLlamaResponseReceived(const FString& Response)
 
     if (KokoroComponent)
     {
-        KokoroComponent->CreateSoundWave(Response);
+        KokoroComponent->CreateSoundWave(Response, LlamaComponent && LlamaComponent->IsCachedResponse(Response));
     }
     else
     {
@@ -230,8 +487,23 @@ void UNpcAiComponent::HandleLlamaResponseReceived(const FString& Response)
     bIsUsersConversationTurn = true;
 }
 
+void UNpcAiComponent::HandleLlamaActionOnlyResponse()
+{
+    // The NPC answered by acting, which the action handlers already took care of; there is nothing to say or show.
+    UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | NpcAiComponent] %s responded with actions only."), *Name);
+
+    bIsNpcResponding = false;
+    bIsUsersConversationTurn = true;
+}
+
 void UNpcAiComponent::HandleLlamaChunkReceived(const FString& Chunk, bool bDone)
 {
+    // A streamed reply that only carried out actions ends without ever producing a chunk.
+    if (bDone && bIsFirstChunk && Chunk.IsEmpty())
+    {
+        return;
+    }
+
     if (PlayerAiComponent && PlayerAiComponent->ChatWidgetInstance)
     {
         if (bIsFirstChunk)
@@ -0,0 +1,185 @@
+#include "NpcAiTaskPool.h"
+#include "Misc/QueuedThreadPool.h"
+#include "Misc/IQueuedWork.h"
+
+class FNpcAiTaskPool::FTaskWork : public IQueuedWork
+{
+public:
+    FTaskWork(FNpcAiTaskPool& InOwner, int32 InSegmentIndex, TUniqueFunction<void()>&& InTask)
+        : Owner(InOwner)
+        , SegmentIndex(InSegmentIndex)
+        , Task(MoveTemp(InTask))
+        , EnqueueTime(FPlatformTime::Seconds())
+    {
+    }
+
+    virtual void DoThreadedWork() override
+    {
+        Owner.OnTaskStarted((FPlatformTime::Seconds() - EnqueueTime) * 1000.0);
+        Task();
+        Owner.OnTaskFinished(SegmentIndex);
+
+        delete this;
+    }
+
+    virtual void Abandon() override
+    {
+        delete this;
+    }
+
+private:
+    FNpcAiTaskPool& Owner;
+    int32 SegmentIndex;
+    TUniqueFunction<void()> Task;
+    double EnqueueTime;
+};
+
+FNpcAiTaskPool& FNpcAiTaskPool::Get()
+{
+    static FNpcAiTaskPool Instance;
+    return Instance;
+}
+
+void FNpcAiTaskPool::Initialize(int32 InNumThreads)
+{
+    FScopeLock ScopeLock(&Lock);
+
+    if (!Segments.IsEmpty())
+    {
+        return;
+    }
+
+    // Most tasks spend their time waiting on a local server socket, so a handful of threads covers a crowd of NPCs.
+    if (AddSegment(InNumThreads > 0 ? InNumThreads : FMath::Clamp(FPlatformMisc::NumberOfCoresIncludingHyperthreads() / 2, 2, 8)))
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | TaskPool] Started %d worker threads"), NumThreads);
+    }
+}
+
+void FNpcAiTaskPool::EnsureThreads(int32 MinThreads)
+{
+    Initialize();
+
+    FScopeLock ScopeLock(&Lock);
+
+    if (Segments.IsEmpty() || NumThreads >= MinThreads)
+    {
+        return;
+    }
+
+    if (AddSegment(MinThreads - NumThreads))
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | TaskPool] Grew to %d worker threads to cover the backend concurrency"), NumThreads);
+    }
+}
+
+bool FNpcAiTaskPool::AddSegment(int32 InNumThreads)
+{
+    FQueuedThreadPool* Pool = FQueuedThreadPool::Allocate();
+    if (!Pool->Create(InNumThreads, 256 * 1024, TPri_Normal, TEXT("LocalNpcAIPool")))
+    {
+        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | TaskPool] Failed to create %d worker threads"), InNumThreads);
+        delete Pool;
+        return false;
+    }
+
+    FSegment& Segment = Segments.AddDefaulted_GetRef();
+    Segment.Pool = Pool;
+    Segment.NumThreads = InNumThreads;
+    NumThreads += InNumThreads;
+    return true;
+}
+
+void FNpcAiTaskPool::Shutdown()
+{
+    TArray<FSegment> SegmentsToDestroy;
+    {
+        FScopeLock ScopeLock(&Lock);
+        SegmentsToDestroy = MoveTemp(Segments);
+        Segments.Reset();
+        NumThreads = 0;
+    }
+
+    if (!SegmentsToDestroy.IsEmpty())
+    {
+        // Abandons queued tasks and waits for the running ones.
+        for (FSegment& Segment : SegmentsToDestroy)
+        {
+            Segment.Pool->Destroy();
+            delete Segment.Pool;
+        }
+
+        FScopeLock ScopeLock(&Lock);
+        Queued = 0;
+        Active = 0;
+    }
+}
+
+void FNpcAiTaskPool::Launch(TUniqueFunction<void()> Task)
+{
+    Initialize();
+
+    FScopeLock ScopeLock(&Lock);
+    if (Segments.IsEmpty())
+    {
+        UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | TaskPool] No worker threads available, dropping task"));
+        return;
+    }
+
+    // A segment with an idle thread if there is one, otherwise the one with the shortest queue.
+    int32 SegmentIndex = 0;
+    for (int32 Index = 1; Index < Segments.Num(); Index++)
+    {
+        if (Segments[Index].NumTasks - Segments[Index].NumThreads < Segments[SegmentIndex].NumTasks - Segments[SegmentIndex].NumThreads)
+        {
+            SegmentIndex = Index;
+        }
+    }
+
+    Queued++;
+    Segments[SegmentIndex].NumTasks++;
+    Segments[SegmentIndex].Pool->AddQueuedWork(new FTaskWork(*this, SegmentIndex, MoveTemp(Task)));
+}
+
+FNpcAiTaskPoolStats FNpcAiTaskPool::GetStats() const
+{
+    FScopeLock ScopeLock(&Lock);
+
+    FNpcAiTaskPoolStats Stats;
+    Stats.NumThreads = NumThreads;
+    Stats.Queued = Queued;
+    Stats.Active = Active;
+    Stats.PeakActive = PeakActive;
+    Stats.Executed = Executed;
+    Stats.AverageQueueLatencyMs = Executed > 0 ? static_cast<float>(TotalQueueLatencyMs / Executed) : 0.0f;
+    Stats.MaxQueueLatencyMs = static_cast<float>(MaxQueueLatencyMs);
+    return Stats;
+}
+
+void FNpcAiTaskPool::OnTaskStarted(double QueueLatencyMs)
+{
+    FScopeLock ScopeLock(&Lock);
+
+    Queued--;
+    Active++;
+    PeakActive = FMath::Max(PeakActive, Active);
+    TotalQueueLatencyMs += QueueLatencyMs;
+    MaxQueueLatencyMs = FMath::Max(MaxQueueLatencyMs, QueueLatencyMs);
+
+    if (Active == NumThreads)
+    {
+        UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | TaskPool] All %d worker threads busy, %d tasks waiting"), NumThreads, Queued);
+    }
+}
+
+void FNpcAiTaskPool::OnTaskFinished(int32 SegmentIndex)
+{
+    FScopeLock ScopeLock(&Lock);
+
+    Active--;
+    Executed++;
+    if (Segments.IsValidIndex(SegmentIndex))
+    {
+        Segments[SegmentIndex].NumTasks--;
+    }
+}
@@ -0,0 +1,154 @@
+#include "NpcAiTextSanitizer.h"
+
+namespace
+{
+    // Longer than any stage direction or action tag, short enough that a stray '*' or '[' only delays a streamed
+    // reply by a sentence or two.
+    constexpr int32 MaxHeldLength = 200;
+}
+
+void FNpcAiTextSanitizer::Append(FStringView Text, FString& Out, TArray<FString>* OutActionCommands)
+{
+    for (int32 i = 0; i < Text.Len(); ++i)
+    {
+        Process(Text[i], Out, OutActionCommands);
+    }
+}
+
+void FNpcAiTextSanitizer::Process(TCHAR Char, FString& Out, TArray<FString>* OutActionCommands)
+{
+    if (Bracket == EBracket::None && !bInAsterisk && Char != TEXT('[') && Char != TEXT('*'))
+    {
+        Out.AppendChar(Char);
+        return;
+    }
+
+    Held.AppendChar(Char);
+    if (Held.Len() > MaxHeldLength)
+    {
+        ReleaseHeld(Out);
+        return;
+    }
+
+    // Brackets take precedence, so an asterisk inside [...] neither opens nor closes a *...* span.
+    if (Bracket == EBracket::Single)
+    {
+        if (Char == TEXT('[') && bBracketJustOpened && !bSingleBracketsOnly)
+        {
+            // [[...]] only ends at "]]", so a single ']' inside an action tag does not let the rest of it through.
+            Bracket = EBracket::Double;
+        }
+        else if (Char == TEXT(']'))
+        {
+            CloseBracket(OutActionCommands);
+        }
+        bBracketJustOpened = false;
+        return;
+    }
+
+    if (Bracket == EBracket::Double)
+    {
+        if (Char == TEXT(']') && bSawClosingBracket)
+        {
+            CloseBracket(OutActionCommands);
+            return;
+        }
+        bSawClosingBracket = Char == TEXT(']');
+        return;
+    }
+
+    if (Char == TEXT('['))
+    {
+        Bracket = EBracket::Single;
+        BracketStart = Held.Len() - 1;
+        bBracketJustOpened = true;
+    }
+    else if (Char == TEXT('*'))
+    {
+        bInAsterisk = !bInAsterisk;
+        if (!bInAsterisk)
+        {
+            Held.Reset();
+        }
+    }
+}
+
+void FNpcAiTextSanitizer::CloseBracket(TArray<FString>* OutActionCommands)
+{
+    if (Bracket == EBracket::Double && OutActionCommands)
+    {
+        static constexpr FStringView ActionPrefix = TEXTVIEW("action:");
+
+        const FStringView Tag = FStringView(Held).Mid(BracketStart + 2, Held.Len() - BracketStart - 4);
+        if (Tag.StartsWith(ActionPrefix, ESearchCase::IgnoreCase))
+        {
+            const FStringView Command = Tag.RightChop(ActionPrefix.Len()).TrimStartAndEnd();
+            if (!Command.IsEmpty())
+            {
+                OutActionCommands->Emplace(Command);
+            }
+        }
+    }
+
+    Bracket = EBracket::None;
+    bBracketJustOpened = false;
+    bSawClosingBracket = false;
+
+    // Inside *...* the text stays held, in case the asterisk span never closes and has to be written out after all.
+    if (!bInAsterisk)
+    {
+        Held.Reset();
+    }
+}
+
+void FNpcAiTextSanitizer::ReleaseHeld(FString& Out)
+{
+    // Actions that closed inside the held text were already reported, so the text is filtered again without them.
+    const FString Unclosed = MoveTemp(Held);
+    Reset();
+    Out.AppendChar(Unclosed[0]);
+    Append(FStringView(Unclosed).RightChop(1), Out);
+}
+
+void FNpcAiTextSanitizer::Flush(FString& Out)
+{
+    while (!Held.IsEmpty())
+    {
+        if (Bracket == EBracket::Double && !bSingleBracketsOnly)
+        {
+            // Without its "]]" a [[ is just a [...] span that happens to contain another '['.
+            const FString Unclosed = MoveTemp(Held);
+            Reset();
+            bSingleBracketsOnly = true;
+            Append(Unclosed, Out);
+        }
+        else
+        {
+            ReleaseHeld(Out);
+        }
+    }
+    bSingleBracketsOnly = false;
+    Reset();
+}
+
+void FNpcAiTextSanitizer::Reset()
+{
+    Bracket = EBracket::None;
+    bBracketJustOpened = false;
+    bSawClosingBracket = false;
+    bInAsterisk = false;
+    Held.Reset();
+}
+
+FString FNpcAiTextSanitizer::Sanitize(FStringView Text, TArray<FString>* OutActionCommands)
+{
+    FString Result;
+    Result.Reserve(Text.Len());
+
+    FNpcAiTextSanitizer Sanitizer;
+    Sanitizer.Append(Text, Result, OutActionCommands);
+    Sanitizer.Flush(Result);
+
+    Result.TrimStartAndEndInline();
+    return Result;
+}
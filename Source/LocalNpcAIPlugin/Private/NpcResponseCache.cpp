@@ -0,0 +1,103 @@
+#include "NpcResponseCache.h"
+
+void FNpcResponseCache::Normalize(TArray<float>& Embedding)
+{
+    double SquaredNorm = 0.0;
+    for (const float Value : Embedding)
+    {
+        SquaredNorm += Value * Value;
+    }
+    if (SquaredNorm <= KINDA_SMALL_NUMBER)
+    {
+        return;
+    }
+
+    const float InvNorm = static_cast<float>(1.0 / FMath::Sqrt(SquaredNorm));
+    for (float& Value : Embedding)
+    {
+        Value *= InvNorm;
+    }
+}
+
+bool FNpcResponseCache::Find(const TArray<float>& Embedding, uint32 StateHash, float MinSimilarity, double Now, FString& OutResponse)
+{
+    Entries.RemoveAllSwap([Now](const FEntry& Entry) { return Entry.ExpiresAt <= Now; });
+    Stats.Entries = Entries.Num();
+    Stats.Lookups++;
+
+    TArray<float> Query = Embedding;
+    Normalize(Query);
+
+    FEntry* BestEntry = nullptr;
+    float BestSimilarity = MinSimilarity;
+    for (FEntry& Entry : Entries)
+    {
+        if (Entry.StateHash != StateHash || Entry.Embedding.Num() != Query.Num())
+        {
+            continue;
+        }
+
+        double Similarity = 0.0;
+        for (int32 i = 0; i < Query.Num(); ++i)
+        {
+            Similarity += Query[i] * Entry.Embedding[i];
+        }
+        if (Similarity >= BestSimilarity)
+        {
+            BestSimilarity = static_cast<float>(Similarity);
+            BestEntry = &Entry;
+        }
+    }
+
+    if (BestEntry)
+    {
+        BestEntry->LastUsed = Now;
+        Stats.Hits++;
+        Stats.SavedMs += BestEntry->GenerationMs;
+        OutResponse = BestEntry->Response;
+    }
+    Stats.HitRate = static_cast<float>(Stats.Hits) / Stats.Lookups;
+    return BestEntry != nullptr;
+}
+
+void FNpcResponseCache::Add(TArray<float> Embedding, uint32 StateHash, const FString& Response, double GenerationMs, double Now, double TtlSeconds, int32 MaxEntries)
+{
+    if (MaxEntries <= 0 || Embedding.IsEmpty() || Response.IsEmpty())
+    {
+        return;
+    }
+
+    while (Entries.Num() >= MaxEntries)
+    {
+        int32 Oldest = 0;
+        for (int32 i = 1; i < Entries.Num(); ++i)
+        {
+            if (Entries[i].LastUsed < Entries[Oldest].LastUsed)
+            {
+                Oldest = i;
+            }
+        }
+        Entries.RemoveAtSwap(Oldest);
+    }
+
+    FEntry& Entry = Entries.AddDefaulted_GetRef();
+    Entry.Embedding = MoveTemp(Embedding);
+    Normalize(Entry.Embedding);
+    Entry.StateHash = StateHash;
+    Entry.Response = Response;
+    Entry.GenerationMs = GenerationMs;
+    Entry.ExpiresAt = Now + TtlSeconds;
+    Entry.LastUsed = Now;
+    Stats.Entries = Entries.Num();
+}
+
+bool FNpcResponseCache::ContainsResponse(const FString& Response) const
+{
+    return Entries.ContainsByPredicate([&Response](const FEntry& Entry) { return Entry.Response.Equals(Response, ESearchCase::CaseSensitive); });
+}
+
+void FNpcResponseCache::Reset()
+{
+    Entries.Reset();
+    Stats = FNpcResponseCacheStats();
+}
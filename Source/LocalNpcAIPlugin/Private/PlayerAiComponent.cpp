@@ -35,6 +35,7 @@ void UPlayerAiComponent::BeginPlay()
             if (UNpcAiComponent* NpcComp = Actor->FindComponentByClass<UNpcAiComponent>())
             {
                 NearbyNpcs.AddUnique(NpcComp);
+                NpcComp->SetInferencePriority(EInferencePriority::Nearby);
                 UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | PlayerAiComponent] NPC already in range at start: %s"), *NpcComp->Name);
             }
         }
@@ -75,6 +76,10 @@ void UPlayerAiComponent::OnBeginOverlap(UPrimitiveComponent* OverlappedComp, AAc
     if (UNpcAiComponent* NpcComp = OtherActor->FindComponentByClass<UNpcAiComponent>())
     {
         NearbyNpcs.AddUnique(NpcComp);
+        if (NpcComp != FocusedNpc)
+        {
+            NpcComp->SetInferencePriority(EInferencePriority::Nearby);
+        }
         UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | PlayerAiComponent] NPC entered interaction range: %s"), *NpcComp->Name);
     }
 }
@@ -88,6 +93,12 @@ void UPlayerAiComponent::OnEndOverlap(UPrimitiveComponent* OverlappedComp, AActo
 
     if (UNpcAiComponent* NpcComp = OtherActor->FindComponentByClass<UNpcAiComponent>())
     {
+        if (NpcComp == FocusedNpc)
+        {
+            FocusedNpc = nullptr;
+        }
+        NpcComp->SetInferencePriority(EInferencePriority::Ambient);
+
         if (NearbyNpcs.Remove(NpcComp) > 0)
         {
             UE_LOG(LogTemp, Verbose, TEXT("[LocalAINpc | PlayerAiComponent] NPC left interaction range: %s"), *NpcComp->Name);
@@ -164,6 +175,7 @@ void UPlayerAiComponent::StartRecording()
 
 	bIsRecording = true;
 
+    SetFocusedNpc(CurrentRecordingNpc);
     CurrentRecordingNpc->StartWhisperRecording();
 }
 
@@ -235,6 +247,25 @@ void UPlayerAiComponent::SendText(FString Input)
 	CurrentTypingNpc = nullptr;
 }
 
+void UPlayerAiComponent::SetFocusedNpc(UNpcAiComponent* Npc)
+{
+    if (Npc == FocusedNpc)
+    {
+        return;
+    }
+
+    if (IsValid(FocusedNpc))
+    {
+        FocusedNpc->SetInferencePriority(NearbyNpcs.Contains(FocusedNpc) ? EInferencePriority::Nearby : EInferencePriority::Ambient);
+    }
+
+    FocusedNpc = Npc;
+    if (IsValid(FocusedNpc))
+    {
+        FocusedNpc->SetInferencePriority(EInferencePriority::PlayerFocused);
+    }
+}
+
 void UPlayerAiComponent::SetupInput()
 {
     if (!GetOwner())
@@ -325,6 +356,9 @@ void UPlayerAiComponent::OnFocusChat(const FInputActionValue& Value)
         ChatWidgetInstance->FocusChatInput();
         bIsTyping = true;
 
+        SetFocusedNpc(CurrentTypingNpc);
+        CurrentTypingNpc->NotifyPlayerStartedInput();
+
         FString Hint = FString::Printf(TEXT("Talking to %s..."), *CurrentTypingNpc->Name);
 		ChatWidgetInstance->SetHintText(Hint);
         LastHintText = Hint;
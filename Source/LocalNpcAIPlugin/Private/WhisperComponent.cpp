@@ -5,6 +5,9 @@
 #include "Interfaces/IHttpRequest.h"
 #include "Interfaces/IHttpResponse.h"
 #include "AudioResampler.h"
+#include "NpcAiTextSanitizer.h"
+#include "InferenceHealthMonitor.h"
+#include "InferenceEndpointRouter.h"
 
 UWhisperComponent::UWhisperComponent()
 {
@@ -57,6 +60,15 @@ void UWhisperComponent::BeginPlay()
             {
                 CapturedAudioData.Append(MonoBuffer.GetData(), MonoBuffer.Num());
                 SilenceSamplesCount = 0;
+
+                if (VadMode != EVadMode::Disabled && !bSpeechStartedBroadcast && CapturedAudioData.Num() >= MinSpeechDuration * SampleRate)
+                {
+                    bSpeechStartedBroadcast = true;
+                    AsyncTask(ENamedThreads::GameThread, [this]()
+                        {
+                            OnSpeechStarted.Broadcast();
+                        });
+                }
             }
             else if (CapturedAudioData.Num() > 0)
             {
@@ -65,6 +77,8 @@ void UWhisperComponent::BeginPlay()
 
                 if (SilenceSamplesCount >= SecondsOfSilenceBeforeSend * SampleRate)
                 {
+                    bSpeechStartedBroadcast = false;
+
                     if (CapturedAudioData.Num() >= MinSpeechDuration * SampleRate)
                     {
                         TArray<float> AudioToSave;
@@ -257,7 +271,40 @@ void UWhisperComponent::TranscribeAudio(const FString& AudioPath)
         return;
     }
 
-    FString Url = FString::Printf(TEXT("http://localhost:%d/inference"), Port);
+    if (!FInferenceEndpointRouter::Get().HasAvailable(EInferenceBackend::Whisper, GetWhisperEndpoints()))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Whisper] No whisper-server is available, skipping transcription"));
+
+        OnTranscriptionComplete.Broadcast(TEXT(""));
+
+        return;
+    }
+
+    const int32 Generation = RequestGeneration.load();
+
+    FInferenceScheduler::Get().Submit(EInferenceBackend::Whisper, InferencePriority, this, [this, AudioPath, Generation](FInferenceJobLeaseRef JobLease)
+        {
+            if (Generation == RequestGeneration.load())
+            {
+                SendTranscriptionRequest(AudioPath, Generation, JobLease);
+            }
+        });
+}
+
+void UWhisperComponent::SendTranscriptionRequest(const FString& AudioPath, int32 Generation, FInferenceJobLeaseRef JobLease)
+{
+    FInferenceEndpointLeasePtr EndpointLease = FInferenceEndpointRouter::Get().Acquire(EInferenceBackend::Whisper, GetWhisperEndpoints());
+    if (!EndpointLease.IsValid())
+    {
+        UE_LOG(LogTemp, Warning, TEXT("[LocalAINpc | Whisper] No whisper-server is available, skipping transcription"));
+
+        OnTranscriptionComplete.Broadcast(TEXT(""));
+
+        return;
+    }
+    const FInferenceEndpoint Endpoint = EndpointLease->GetEndpoint();
+
+    FString Url = FString::Printf(TEXT("http://%s/inference"), *Endpoint.ToString());
 	TArray<uint8> Content = CreateMultiPartRequest(AudioPath);
 
     TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
@@ -268,11 +315,32 @@ void UWhisperComponent::TranscribeAudio(const FString& AudioPath)
 
     double StartTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
 
-    Request->OnProcessRequestComplete().BindLambda([this, StartTimeBenchmark](FHttpRequestPtr Req, FHttpResponsePtr Response, bool bWasSuccessful)
+    Request->OnProcessRequestComplete().BindLambda([this, StartTimeBenchmark, Generation, JobLease, EndpointLease, Endpoint](FHttpRequestPtr Req, FHttpResponsePtr Response, bool bWasSuccessful)
         {
+            EndpointLease->Release();
+            JobLease->Finish();
+            {
+                FScopeLock Lock(&PendingRequestsLock);
+                PendingRequests.Remove(Req);
+            }
+            if (Generation != RequestGeneration.load())
+            {
+                UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Whisper] Transcription cancelled."));
+                return;
+            }
+
             double EndTimeBenchmark = FPlatformTime::Seconds() * 1000.0;
             double DurationBenchmark = EndTimeBenchmark - StartTimeBenchmark;
 
+            if (bWasSuccessful && Response.IsValid() && Response->GetResponseCode() < 500)
+            {
+                FInferenceHealthMonitor::Get().ReportSuccess(EInferenceBackend::Whisper, Endpoint, DurationBenchmark);
+            }
+            else
+            {
+                FInferenceHealthMonitor::Get().ReportFailure(EInferenceBackend::Whisper, Endpoint);
+            }
+
             if (!bWasSuccessful || !Response.IsValid())
             {
                 UE_LOG(LogTemp, Error, TEXT("[LocalAINpc | Whisper] Request failed."));
@@ -305,16 +373,44 @@ void UWhisperComponent::TranscribeAudio(const FString& AudioPath)
 
 			FString SanitizedResult = SanitizeString(ResultText);
 
-            AsyncTask(ENamedThreads::GameThread, [this, SanitizedResult]()
+            AsyncTask(ENamedThreads::GameThread, [this, SanitizedResult, Generation]()
                 {
-                    OnTranscriptionComplete.Broadcast(SanitizedResult);
+                    if (Generation == RequestGeneration.load())
+                    {
+                        OnTranscriptionComplete.Broadcast(SanitizedResult);
+                    }
                 });
         });
 
+    {
+        FScopeLock Lock(&PendingRequestsLock);
+        PendingRequests.Add(Request);
+    }
     Request->ProcessRequest();
 	UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Whisper] Transcription request for file %s sent to %s"), *AudioPath, *Url);
 }
 
+void UWhisperComponent::CancelTranscription()
+{
+    RequestGeneration++;
+    FInferenceScheduler::Get().CancelJobs(this);
+
+    TArray<FHttpRequestPtr> RequestsToCancel;
+    {
+        FScopeLock Lock(&PendingRequestsLock);
+        RequestsToCancel = MoveTemp(PendingRequests);
+    }
+    for (const FHttpRequestPtr& Request : RequestsToCancel)
+    {
+        Request->CancelRequest();
+    }
+
+    if (RequestsToCancel.Num() > 0)
+    {
+        UE_LOG(LogTemp, Log, TEXT("[LocalAINpc | Whisper] Cancelled %d pending transcriptions."), RequestsToCancel.Num());
+    }
+}
+
 TArray<uint8> UWhisperComponent::CreateMultiPartRequest(FString FilePath)
 {
     TArray<uint8> Payload;
@@ -353,35 +449,14 @@ TArray<uint8> UWhisperComponent::CreateMultiPartRequest(FString FilePath)
     return Payload;
 }
 
-FString UWhisperComponent::SanitizeString(const FString& String)
+TArray<FInferenceEndpoint> UWhisperComponent::GetWhisperEndpoints() const
 {
-    FString Result = String;
-
-    auto RegexReplace = [](const FString& InputStr, const FString& PatternStr) -> FString
-        {
-            FRegexPattern Pattern(PatternStr);
-            FString Output = InputStr;
-
-            FRegexMatcher Matcher(Pattern, Output);
-            while (Matcher.FindNext())
-            {
-                int32 Start = Matcher.GetMatchBeginning();
-                int32 Length = Matcher.GetMatchEnding() - Start;
-                Output.RemoveAt(Start, Length);
-
-                Matcher = FRegexMatcher(Pattern, Output);
-            }
-
-            return Output;
-        };
-
-    Result = RegexReplace(Result, TEXT("\\[[^\\]]*\\]"));
-
-    Result = RegexReplace(Result, TEXT("\\*[^\\*]*\\*"));
-
-    Result = Result.TrimStartAndEnd();
+    return FInferenceEndpointRouter::ResolveEndpoints(WhisperEndpoints, Port, TEXT("localhost"));
+}
 
-    return Result;
+FString UWhisperComponent::SanitizeString(const FString& String)
+{
+    return FNpcAiTextSanitizer::Sanitize(String);
 }
 
 bool UWhisperComponent::IsSpeechFrame(const float* Samples, int32 NumSamples, int32 SampleRate)
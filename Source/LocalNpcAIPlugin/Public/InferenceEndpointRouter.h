@@ -0,0 +1,91 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "InferenceScheduler.h"
+#include <atomic>
+#include "InferenceEndpointRouter.generated.h"
+
+USTRUCT(BlueprintType)
+struct FInferenceEndpointLoad
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    EInferenceBackend Backend = EInferenceBackend::Llama;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    FInferenceEndpoint Endpoint;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 Outstanding = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 Requests = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    float AverageLatencyMs = 0.0f;
+
+    // NPCs whose requests currently stick to this server.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 BoundNpcs = 0;
+};
+
+// A request's claim on one server. Like FInferenceJobLease it is released when Release is called or the last
+// reference goes away, so a request counts as outstanding for as long as it captures the lease.
+class LOCALNPCAIPLUGIN_API FInferenceEndpointLease
+{
+public:
+    FInferenceEndpointLease(EInferenceBackend InBackend, const FInferenceEndpoint& InEndpoint)
+        : Backend(InBackend), Endpoint(InEndpoint), StartTime(FPlatformTime::Seconds()) {}
+    ~FInferenceEndpointLease() { Release(); }
+
+    // Thread safe, only the first call has an effect.
+    void Release();
+
+    EInferenceBackend GetBackend() const { return Backend; }
+    const FInferenceEndpoint& GetEndpoint() const { return Endpoint; }
+
+private:
+    EInferenceBackend Backend;
+    FInferenceEndpoint Endpoint;
+    double StartTime;
+    std::atomic<bool> bReleased{ false };
+};
+
+using FInferenceEndpointLeasePtr = TSharedPtr<FInferenceEndpointLease, ESPMode::ThreadSafe>;
+
+// Spreads requests over the servers of a backend. A request goes to the server with the fewest outstanding requests,
+// unless it has an affinity key (an NPC's slot id): then it stays on the server that NPC used last, so its KV cache
+// and saved slot stay warm there, and only moves when that server is down or MaxStickyImbalance requests busier than
+// the least loaded one. Servers whose circuit is open are skipped. All methods are thread safe.
+class LOCALNPCAIPLUGIN_API FInferenceEndpointRouter
+{
+public:
+    static FInferenceEndpointRouter& Get();
+
+    // Returns null when none of the servers is available.
+    FInferenceEndpointLeasePtr Acquire(EInferenceBackend Backend, TConstArrayView<FInferenceEndpoint> Endpoints, const FString& AffinityKey = FString());
+
+    // Cheap check before queueing a request: false while every server's circuit is open.
+    bool HasAvailable(EInferenceBackend Backend, TConstArrayView<FInferenceEndpoint> Endpoints) const;
+
+    void Unbind(EInferenceBackend Backend, const FString& AffinityKey);
+
+    void SetMaxStickyImbalance(int32 InMaxStickyImbalance);
+    TArray<FInferenceEndpointLoad> GetLoad() const;
+
+    // Endpoints, or DefaultHost:DefaultPort when none are configured.
+    static TArray<FInferenceEndpoint> ResolveEndpoints(const TArray<FInferenceEndpoint>& Endpoints, int32 DefaultPort, const FString& DefaultHost = TEXT("127.0.0.1"));
+
+private:
+    friend class FInferenceEndpointLease;
+
+    void Release(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint, double LatencyMs);
+    FInferenceEndpointLoad* Find(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint);
+    FInferenceEndpointLoad& FindOrAdd(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint);
+
+    mutable FCriticalSection Lock;
+    TArray<FInferenceEndpointLoad> Servers;
+    TMap<TPair<EInferenceBackend, FString>, FInferenceEndpoint> Affinity;
+    int32 MaxStickyImbalance = 2;
+};
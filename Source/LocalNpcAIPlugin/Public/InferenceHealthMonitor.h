@@ -0,0 +1,161 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "Containers/Ticker.h"
+#include "InferenceScheduler.h"
+#include "InferenceEndpointRouter.h"
+#include "InferenceHedging.h"
+#include "InferenceHealthMonitor.generated.h"
+
+UENUM(BlueprintType)
+enum class EInferenceCircuitState : uint8
+{
+    Closed      UMETA(DisplayName = "Closed (healthy)"),
+    Open        UMETA(DisplayName = "Open (failing fast)"),
+    HalfOpen    UMETA(DisplayName = "Half open (trial request)")
+};
+
+USTRUCT(BlueprintType)
+struct FInferenceEndpointHealth
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    EInferenceBackend Backend = EInferenceBackend::Llama;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    FInferenceEndpoint Endpoint;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    EInferenceCircuitState State = EInferenceCircuitState::Closed;
+
+    // Result of the last health check.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    bool bReachable = true;
+
+    // Share of failed requests among the last 32.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    float ErrorRate = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    float AverageLatencyMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 ConsecutiveFailures = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 TimesOpened = 0;
+};
+
+// Tracks how each inference server is doing, from the outcome of every request and a periodic check of its /health
+// endpoint, and keeps a circuit breaker per server so callers fail fast instead of waiting out their timeouts.
+// Open rejects requests until a health check succeeds or the cooldown has passed; HalfOpen then lets a single trial
+// request through, whose outcome closes or reopens the circuit. All methods are thread safe.
+class LOCALNPCAIPLUGIN_API FInferenceHealthMonitor
+{
+public:
+    static FInferenceHealthMonitor& Get();
+
+    // Servers are registered by their first request, so only servers that are in use get health checks. Projects
+    // can register a server up front to have it checked before the first NPC talks to it.
+    void RegisterEndpoint(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint);
+
+    // False while the circuit is open. Once the cooldown has passed, the first caller gets through as the trial.
+    bool AllowRequest(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint);
+    // False while the circuit is open, so requests that are already waiting can give up early.
+    bool IsAvailable(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint) const;
+
+    // Any HTTP response below 500 counts as a success; connection errors, timeouts and 5xx as failures.
+    void ReportSuccess(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint, double LatencyMs);
+    void ReportFailure(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint);
+
+    // Checks every registered server whose last check is at least IntervalSeconds old.
+    void Poll(double IntervalSeconds, double TimeoutSeconds);
+
+    void Configure(int32 InFailureThreshold, double InCooldownSeconds);
+    TArray<FInferenceEndpointHealth> GetHealth() const;
+
+private:
+    struct FServerState
+    {
+        FInferenceEndpointHealth Health;
+        uint32 FailureBits = 0;
+        int32 NumOutcomes = 0;
+        double OpenUntil = 0.0;
+        double Cooldown = 0.0;
+        double TrialStart = 0.0;
+        double LastPollTime = 0.0;
+        bool bPollInFlight = false;
+    };
+
+    FServerState* Find(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint);
+    FServerState& FindOrAdd(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint);
+    const FServerState* Find(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint) const;
+    void RecordOutcome(FServerState& Server, bool bFailed);
+    void OpenCircuit(FServerState& Server, double Now, const TCHAR* Reason);
+    void CloseCircuit(FServerState& Server);
+    void HandlePollResult(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint, bool bHealthy);
+
+    mutable FCriticalSection Lock;
+    TArray<FServerState> Servers;
+    int32 FailureThreshold = 3;
+    double CooldownSeconds = 5.0;
+};
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnInferenceCircuitChanged, const FInferenceEndpointHealth&, Health);
+
+// Game-instance front end for FInferenceHealthMonitor, FInferenceEndpointRouter and FInferenceHedging: runs the health
+// checks and exposes the circuit states, the load of every server and the hedging stats to Blueprints. Settings go in DefaultGame.ini under [/Script/LocalNpcAIPlugin.InferenceHealthSubsystem].
+UCLASS(Config = Game)
+class LOCALNPCAIPLUGIN_API UInferenceHealthSubsystem : public UGameInstanceSubsystem
+{
+    GENERATED_BODY()
+
+public:
+    virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+    virtual void Deinitialize() override;
+
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Health", meta = (ClampMin = "0.1"))
+    float HealthCheckIntervalSeconds = 2.0f;
+
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Health", meta = (ClampMin = "0.1"))
+    float HealthCheckTimeoutSeconds = 1.0f;
+
+    // Consecutive failed requests that open the circuit. It also opens when half of the last requests failed.
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Health", meta = (ClampMin = "1"))
+    int32 FailureThreshold = 3;
+
+    // How long an open circuit waits before a trial request, doubled after every failed trial (up to a minute).
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Health", meta = (ClampMin = "0.1"))
+    float CircuitCooldownSeconds = 5.0f;
+
+    // How many more outstanding requests an NPC's server may have than the least loaded one before the NPC moves.
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Health", meta = (ClampMin = "0"))
+    int32 MaxStickyImbalance = 2;
+
+    // Highest share of requests that may be hedged, i.e. also sent to a second server (see FInferenceHedging).
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Health", meta = (ClampMin = "0", ClampMax = "1"))
+    float MaxHedgeRate = 0.1f;
+
+    UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | Health")
+    FOnInferenceCircuitChanged OnCircuitStateChanged;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Health")
+    TArray<FInferenceEndpointHealth> GetAllEndpointHealth() const;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Health")
+    TArray<FInferenceEndpointLoad> GetAllEndpointLoad() const;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Health")
+    TArray<FInferenceHedgeStats> GetAllHedgeStats() const;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Health")
+    bool IsBackendAvailable(EInferenceBackend Backend, const FInferenceEndpoint& Endpoint) const;
+
+private:
+    bool Tick(float DeltaTime);
+
+    FTSTicker::FDelegateHandle TickerHandle;
+    TArray<FInferenceEndpointHealth> LastHealth;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "InferenceScheduler.h"
+#include "InferenceHedging.generated.h"
+
+struct FLlamaHttpResponse;
+
+USTRUCT(BlueprintType)
+struct FInferenceHedgeStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    EInferenceBackend Backend = EInferenceBackend::Llama;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 Requests = 0;
+
+    // Requests that were also sent to a second server.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 Hedged = 0;
+
+    // Hedged requests where the second server answered first.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    int32 HedgeWins = 0;
+
+    // Latency after which a request is hedged.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Health")
+    float P90LatencyMs = 0.0f;
+};
+
+// Hedged requests for short, latency-critical calls like query embeddings and reranking. When the first server has not
+// answered within the p90 latency seen for the backend, the same request also goes to a second server; the first
+// answer is used and the other request is dropped. Hedges are capped at MaxHedgeRate of the requests, so a backend
+// that is slow everywhere does not get its load doubled, and each one waits for a free FInferenceScheduler slot of
+// the backend like any other request. All methods are thread safe.
+class LOCALNPCAIPLUGIN_API FInferenceHedging
+{
+public:
+    static FInferenceHedging& Get();
+
+    // Blocking POST to one of Endpoints, picked by FInferenceEndpointRouter, that reports the outcome to the health
+    // monitor. Returns false when no server is available or none answered. Only hedges when bHedge is set; the hedge
+    // is queued at Priority, which should be the priority the caller itself was scheduled with.
+    bool Post(EInferenceBackend Backend, EInferencePriority Priority, TConstArrayView<FInferenceEndpoint> Endpoints, const FString& Path, const FString& Body, FLlamaHttpResponse& OutResponse, bool bHedge);
+
+    void SetMaxHedgeRate(float InMaxHedgeRate);
+    TArray<FInferenceHedgeStats> GetStats() const;
+
+private:
+    struct FBackendState
+    {
+        FInferenceHedgeStats Stats;
+        TArray<double> Latencies;
+        int32 NextLatency = 0;
+        float HedgeBudget = 0.0f;
+    };
+
+    FBackendState& FindOrAdd(EInferenceBackend Backend);
+
+    // Hedge delay for a new request, or a negative value while too few latencies have been seen.
+    double BeginRequest(EInferenceBackend Backend, bool bHedge);
+    bool TryStartHedge(EInferenceBackend Backend);
+    void CancelHedge(EInferenceBackend Backend);
+    void EndRequest(EInferenceBackend Backend, double LatencyMs, bool bAnswered, bool bHedgeWon);
+
+    mutable FCriticalSection Lock;
+    TArray<FBackendState> Backends;
+    float MaxHedgeRate = 0.1f;
+};
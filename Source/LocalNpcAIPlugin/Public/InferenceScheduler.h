@@ -0,0 +1,219 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "NpcAiTaskPool.h"
+#include <atomic>
+#include "InferenceScheduler.generated.h"
+
+UENUM(BlueprintType)
+enum class EInferenceBackend : uint8
+{
+    Llama,
+    Embedding,
+    Reranker,
+    Whisper,
+    Kokoro
+};
+
+// Lower values start first. Queued jobs climb one class every AgingSeconds so nothing waits forever.
+UENUM(BlueprintType)
+enum class EInferencePriority : uint8
+{
+    PlayerFocused           UMETA(DisplayName = "Player focused"),
+    Nearby                  UMETA(DisplayName = "Nearby"),
+    Ambient                 UMETA(DisplayName = "Ambient"),
+    Background              UMETA(DisplayName = "Background indexing")
+};
+
+// One server of a backend. Components can spread their requests over several of them.
+USTRUCT(BlueprintType)
+struct FInferenceEndpoint
+{
+    GENERATED_BODY()
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Scheduler")
+    FString Host = TEXT("127.0.0.1");
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Scheduler")
+    int32 Port = 8080;
+
+    bool operator==(const FInferenceEndpoint& Other) const { return Port == Other.Port && Host == Other.Host; }
+    FString ToString() const { return FString::Printf(TEXT("%s:%d"), *Host, Port); }
+};
+
+USTRUCT(BlueprintType)
+struct FInferenceBackendStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    EInferenceBackend Backend = EInferenceBackend::Llama;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 MaxConcurrent = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Running = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Queued = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 PeakQueued = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Submitted = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Started = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Cancelled = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    float AverageWaitMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    float MaxWaitMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    float PlayerFocusedAverageWaitMs = 0.0f;
+};
+
+// Handed to a job when it starts. The backend slot is held until Finish is called or the last reference goes away,
+// so a job keeps it for as long as its request is in flight simply by capturing the lease.
+class LOCALNPCAIPLUGIN_API FInferenceJobLease
+{
+public:
+    explicit FInferenceJobLease(EInferenceBackend InBackend) : Backend(InBackend) {}
+    ~FInferenceJobLease() { Finish(); }
+
+    // Thread safe, only the first call has an effect.
+    void Finish();
+
+    EInferenceBackend GetBackend() const { return Backend; }
+
+private:
+    EInferenceBackend Backend;
+    std::atomic<bool> bFinished{ false };
+};
+
+using FInferenceJobLeaseRef = TSharedRef<FInferenceJobLease, ESPMode::ThreadSafe>;
+using FInferenceJob = TUniqueFunction<void(FInferenceJobLeaseRef Lease)>;
+
+// Queues requests to the local inference servers so they never run more than MaxConcurrent at a time per backend,
+// and starts them by priority (with aging) instead of in arrival order. Jobs always start on the game thread.
+// All methods are thread safe.
+class LOCALNPCAIPLUGIN_API FInferenceScheduler
+{
+public:
+    static FInferenceScheduler& Get();
+
+    // Job runs on the game thread once the backend has a free slot. Jobs whose Owner has been destroyed are dropped.
+    void Submit(EInferenceBackend Backend, EInferencePriority Priority, const UObject* Owner, FInferenceJob Job);
+
+    // Runs Work on the plugin's task pool once the backend has a free slot and frees the slot when Work returns.
+    // Never blocks the caller, so follow-up work goes at the end of Work instead of after a wait.
+    void Launch(EInferenceBackend Backend, EInferencePriority Priority, const UObject* Owner, TUniqueFunction<void()> Work);
+
+    // Drops Owner's jobs that have not started yet. Returns how many were removed.
+    int32 CancelJobs(const UObject* Owner);
+
+    void SetConcurrencyLimit(EInferenceBackend Backend, int32 MaxConcurrent);
+    // Only ever raises the limit, so components can make sure it covers the slots their server was started with.
+    void EnsureConcurrencyLimit(EInferenceBackend Backend, int32 MaxConcurrent);
+    void SetAgingSeconds(double InAgingSeconds);
+
+    FInferenceBackendStats GetStats(EInferenceBackend Backend) const;
+    void ResetStats();
+
+private:
+    friend class FInferenceJobLease;
+
+    struct FQueuedJob
+    {
+        EInferencePriority Priority = EInferencePriority::Ambient;
+        TWeakObjectPtr<const UObject> Owner;
+        bool bHasOwner = false;
+        double SubmitTime = 0.0;
+        FInferenceJob Job;
+    };
+
+    struct FBackendQueue
+    {
+        TArray<FQueuedJob> Jobs;
+        int32 MaxConcurrent = 1;
+        int32 Running = 0;
+
+        int32 PeakQueued = 0;
+        int32 Submitted = 0;
+        int32 Started = 0;
+        int32 Cancelled = 0;
+        double TotalWaitMs = 0.0;
+        double MaxWaitMs = 0.0;
+        int32 PlayerFocusedStarted = 0;
+        double PlayerFocusedWaitMs = 0.0;
+    };
+
+    static constexpr int32 NumBackends = static_cast<int32>(EInferenceBackend::Kokoro) + 1;
+
+    void Finish(EInferenceBackend Backend);
+    void EnsureTaskPoolThreads();
+    void ScheduleDispatch();
+    void Dispatch();
+    double GetEffectivePriority(const FQueuedJob& Job, double Now) const;
+
+    mutable FCriticalSection Lock;
+    FBackendQueue Queues[NumBackends];
+    double AgingSeconds = 2.0;
+    bool bDispatchScheduled = false;
+};
+
+// Game-instance front end for FInferenceScheduler: applies the configured concurrency caps and exposes the queue
+// metrics to Blueprints. Caps can be set in DefaultGame.ini under [/Script/LocalNpcAIPlugin.InferenceSchedulerSubsystem].
+UCLASS(Config = Game)
+class LOCALNPCAIPLUGIN_API UInferenceSchedulerSubsystem : public UGameInstanceSubsystem
+{
+    GENERATED_BODY()
+
+public:
+    virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+    virtual void Deinitialize() override;
+
+    // Should match the number of slots llama-server was started with (-np). NPCs with ServerSlots set raise it further.
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Scheduler", meta = (ClampMin = "1"))
+    int32 LlamaConcurrency = 1;
+
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Scheduler", meta = (ClampMin = "1"))
+    int32 EmbeddingConcurrency = 2;
+
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Scheduler", meta = (ClampMin = "1"))
+    int32 RerankerConcurrency = 1;
+
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Scheduler", meta = (ClampMin = "1"))
+    int32 WhisperConcurrency = 1;
+
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Scheduler", meta = (ClampMin = "1"))
+    int32 KokoroConcurrency = 2;
+
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Scheduler", meta = (ClampMin = "0.0"))
+    float AgingSeconds = 2.0f;
+
+    // Worker threads shared by all requests. 0 picks a size from the core count. The pool grows on its own to cover the
+    // concurrency of the backends that run on it (Llama, Embedding, Reranker), including caps NPCs raise later.
+    UPROPERTY(Config, EditAnywhere, BlueprintReadOnly, Category = "LocalAiNpc | Scheduler", meta = (ClampMin = "0"))
+    int32 TaskPoolThreads = 0;
+
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Scheduler")
+    void SetConcurrencyLimit(EInferenceBackend Backend, int32 MaxConcurrent);
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Scheduler")
+    FInferenceBackendStats GetBackendStats(EInferenceBackend Backend) const;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Scheduler")
+    TArray<FInferenceBackendStats> GetAllBackendStats() const;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Scheduler")
+    FNpcAiTaskPoolStats GetTaskPoolStats() const;
+};
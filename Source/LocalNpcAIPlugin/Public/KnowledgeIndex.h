@@ -0,0 +1,33 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/SecureHash.h"
+
+struct FKnowledgeEntry;
+
+// What a knowledge index was built from. An index is only used when all of it matches.
+struct FKnowledgeIndexKey
+{
+    FSHAHash SourceHash;
+    int32 SentencesPerChunk = 0;
+    int32 SentenceOverlap = 0;
+    FString ModelId;
+};
+
+// Binary file with the chunks and embeddings of a knowledge document, so a document is only embedded again when it,
+// the chunking or the embedding model changed. The file is laid out to be read straight from a memory mapping: a fixed
+// header, the vectors as one aligned float array, the chunk text offsets and the UTF-8 text of all chunks. It is a local
+// cache, so it is written in native byte order.
+class LOCALNPCAIPLUGIN_API FKnowledgeIndex
+{
+public:
+    // Returns false when the file is missing or corrupt, or was built from something else than Key.
+    static bool Load(const FString& Path, const FKnowledgeIndexKey& Key, TArray<FKnowledgeEntry>& OutEntries);
+
+    // Writes a temporary file and moves it over Path, so a reader never sees half an index. Fails when an entry has
+    // no embedding, so a build with failed requests is not cached.
+    static bool Save(const FString& Path, const FKnowledgeIndexKey& Key, const TArray<FKnowledgeEntry>& Entries);
+
+    // Index file for the document at KnowledgePath. An empty Folder uses Saved/KnowledgeIndex.
+    static FString GetIndexPath(const FString& Folder, const FString& KnowledgePath);
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FKnowledgeEntry;
+
+// The knowledge base as one row-major matrix of L2-normalized embeddings, so the cosine similarity between a query and
+// a chunk is a single dot product. Rows are padded with zeros to a multiple of 8 floats and 32-byte aligned, so every
+// dot product runs on whole SIMD registers without a scalar tail.
+class LOCALNPCAIPLUGIN_API FKnowledgeMatrix
+{
+public:
+    // Takes the chunks over. Chunks whose embedding is missing or has a different size than the first one are dropped.
+    void Build(TArray<FKnowledgeEntry>&& Entries);
+    void Reset();
+
+    // Rows of the K chunks most similar to Query, best first. Empty when Query does not match the embedding size.
+    void FindNearest(TConstArrayView<float> Query, int32 K, TArray<int32>& OutRows, TArray<float>* OutScores = nullptr) const;
+
+    int32 Num() const { return Texts.Num(); }
+    int32 GetDimensions() const { return Dimensions; }
+    const FString& GetText(int32 Row) const { return Texts[Row]; }
+
+    // Dot product of two 32-byte aligned vectors whose length is a multiple of 8. Uses AVX2 when the build targets it,
+    // SSE or NEON otherwise, and plain floats when vector intrinsics are disabled.
+    static float Dot(const float* A, const float* B, int32 Num);
+
+private:
+    const float* GetRow(int32 Row) const { return Data.GetData() + Row * Stride; }
+
+    TArray<float, TAlignedHeapAllocator<32>> Data;
+    TArray<FString> Texts;
+    int32 Dimensions = 0;
+    int32 Stride = 0;
+};
@@ -2,6 +2,9 @@
 
 #include "CoreMinimal.h"
 #include "Components/SceneComponent.h"
+#include "Interfaces/IHttpRequest.h"
+#include "InferenceScheduler.h"
+#include "InferenceEndpointRouter.h"
 #include "KokoroComponent.generated.h"
 
 USTRUCT(BlueprintType)
@@ -16,6 +19,24 @@ struct FSoundWaveWithDuration
     float Duration;
 };
 
+USTRUCT(BlueprintType)
+struct FKokoroAudioCacheStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAINpc | Kokoro")
+    int32 Hits = 0;
+
+    // Synthesis time of the lines that were played from the cache instead.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAINpc | Kokoro")
+    float SavedMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAINpc | Kokoro")
+    int32 Entries = 0;
+};
+
+class UAudioComponent;
+
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnKokoroSoundReady, FSoundWaveWithDuration, SoundWave);
 
 UCLASS(ClassGroup = (NpcAI), meta = (BlueprintSpawnableComponent))
@@ -29,6 +50,13 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
     int32 Port = 8880;
 
+    // Kokoro servers to spread speech requests over. Empty uses Port on this machine.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
+    TArray<FInferenceEndpoint> KokoroEndpoints;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Scheduler")
+    EInferencePriority InferencePriority = EInferencePriority::Ambient;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
     FString Voice;
 
@@ -38,8 +66,26 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
     double Volume = 1.0;
 
+    // Number of lines whose audio is kept, least recently used first out. 0 disables the cache. Prepared lines are
+    // kept on top of these.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro", meta = (ClampMin = "0"))
+    int32 AudioCacheEntries = 0;
+
+    // Lines that were synthesized with bCacheAudio or prepared with PrepareSoundWave are played from the audio cache,
+    // without a request.
+    UFUNCTION(BlueprintCallable, Category = "LocalAINpc | Kokoro")
+	void CreateSoundWave(const FString& Text, bool bCacheAudio = false);
+
+    UFUNCTION(BlueprintPure, Category = "LocalAINpc | Kokoro")
+    FKokoroAudioCacheStats GetAudioCacheStats() const { return AudioCacheStats; }
+
+    // Synthesizes Text at background priority and keeps its audio for as long as the component lives, so a later
+    // CreateSoundWave(Text) plays it right away. Meant for lines known in advance, like greetings and barks.
     UFUNCTION(BlueprintCallable, Category = "LocalAINpc | Kokoro")
-	void CreateSoundWave(const FString& Text);
+    void PrepareSoundWave(const FString& Text);
+
+    UFUNCTION(BlueprintPure, Category = "LocalAINpc | Kokoro")
+    bool HasCachedAudio(const FString& Text) const;
 
     UPROPERTY(BlueprintAssignable, Category = "LocalAINpc | Kokoro")
     FOnKokoroSoundReady OnSoundReady;
@@ -47,17 +93,48 @@ public:
     UFUNCTION(BlueprintCallable, Category = "LocalAINpc | Kokoro")
     void PlaySoundWave(FSoundWaveWithDuration Sound);
 
+    // Cancels pending syntheses, drops queued audio and stops the line that is currently playing.
+    UFUNCTION(BlueprintCallable, Category = "LocalAINpc | Kokoro")
+    void StopSpeaking();
+
+    UFUNCTION(BlueprintPure, Category = "LocalAINpc | Kokoro")
+    bool IsSpeaking() const;
+
 private:
     FString OutputAudioFolder = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("KokoroAudio"));
 
     FString CreateJsonRequest(FString Input);
 
     FSoundWaveWithDuration LoadSoundWaveFromWav(FString AudioPath);
+    FSoundWaveWithDuration CreateSoundWaveFromWav(const TArray<uint8>& FileData);
+
+    struct FCachedAudio
+    {
+        TArray<uint8> Wav;
+        double SynthesisMs = 0.0;
+        double LastUsed = 0.0;
+        bool bPinned = false;
+    };
+    TMap<FString, FCachedAudio> AudioCache;
+    FKokoroAudioCacheStats AudioCacheStats;
+    bool PlayFromAudioCache(const FString& Text, int32 Generation);
+    void AddToAudioCache(const FString& Text, const TArray<uint8>& Wav, double SynthesisMs, bool bPinned);
 
     TQueue<FSoundWaveWithDuration> SoundQueue;
     FCriticalSection SoundQueueLock;
     bool bIsPlayingSound = false;
     FTimerHandle AudioFinishTimer;
+    UPROPERTY()
+    UAudioComponent* ActiveAudioComponent = nullptr;
+
+    TArray<FHttpRequestPtr> PendingRequests;
+    // Kept apart from PendingRequests, since StopSpeaking leaves them running; only EndPlay cancels them.
+    TArray<FHttpRequestPtr> PreparedRequests;
+    int32 QueuedRequests = 0;
+    int32 RequestGeneration = 0;
+    void SendSpeechRequest(const FString& Text, bool bCacheAudio, int32 Generation, FInferenceJobLeaseRef JobLease);
+    TArray<FInferenceEndpoint> GetKokoroEndpoints() const;
+
     UFUNCTION()
     void PlayNextInQueue();
 	UFUNCTION()
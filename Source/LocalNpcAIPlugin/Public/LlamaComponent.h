@@ -2,6 +2,18 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "Containers/Queue.h"
+#include "LlamaConnectionPool.h"
+#include "LlamaSlotManager.h"
+#include "LlamaRequestBuilder.h"
+#include "InferenceScheduler.h"
+#include "InferenceEndpointRouter.h"
+#include "LlamaSentenceSegmenter.h"
+#include "NpcAiTextSanitizer.h"
+#include "NpcActionMatcher.h"
+#include "NpcResponseCache.h"
+#include "KnowledgeMatrix.h"
+#include <atomic>
 #include "LlamaComponent.generated.h"
 
 USTRUCT()
@@ -12,6 +24,12 @@ struct FChatMessage
     FString Role;
     UPROPERTY()
     FString Content;
+    // Serialized tool_calls array of an assistant message that called tools, empty otherwise.
+    UPROPERTY()
+    FString ToolCalls;
+    // The call a tool message reports the result of, empty otherwise.
+    UPROPERTY()
+    FString ToolCallId;
 };
 
 UENUM(BlueprintType)
@@ -22,6 +40,93 @@ enum class ERagMode : uint8
     EmbeddingPlusReranker  UMETA(DisplayName = "Embedding + Reranker")
 };
 
+UENUM(BlueprintType)
+enum class ELlamaPromptLayout : uint8
+{
+    ContextInSystemMessage  UMETA(DisplayName = "Context In System Message"),
+    ContextAfterHistory     UMETA(DisplayName = "Context After History (Cache Friendly)")
+};
+
+UENUM(BlueprintType)
+enum class ELlamaActionOutputMode : uint8
+{
+    PromptInstructions      UMETA(DisplayName = "Prompt Instructions"),
+    // Sends a GBNF grammar built from KnownActions and KnownObjects, so llama-server can only produce dialogue and
+    // well-formed action tags. The format explanation in the system message shrinks to a short list.
+    Grammar                 UMETA(DisplayName = "Grammar Constrained"),
+    // Sends KnownActions as OpenAI tools (objects become an enum parameter) and carries out the tool calls the model
+    // makes, so no action format has to be explained in the system message. Requires llama-server --jinja: without
+    // it llama-server rejects every request that carries tools.
+    ToolCalls               UMETA(DisplayName = "Tool Calls")
+};
+
+USTRUCT(BlueprintType)
+struct FLlamaPromptCacheStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 Turns = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 LastPromptTokens = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 LastCachedTokens = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int64 TotalPromptTokens = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int64 TotalCachedTokens = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    float CachedRatio = 0.0f;
+};
+
+// Time to first token as the player sees it: from the message being sent until the first text arrives (the full
+// response when not streaming). Turns whose prompt prefix was prefilled speculatively are tracked separately.
+USTRUCT(BlueprintType)
+struct FLlamaTtftStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 ColdTurns = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    float ColdAverageMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 PrefilledTurns = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    float PrefilledAverageMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    float LastMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    bool bLastWasPrefilled = false;
+};
+
+// Prompt tokens the actions cost per request, measured with the server's own chat template and tokenizer: the full
+// action tag instructions in the system message versus the tool definitions plus a one line hint.
+USTRUCT(BlueprintType)
+struct FLlamaActionPromptStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Actions")
+    int32 InstructionTokens = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Actions")
+    int32 ToolTokens = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Actions")
+    int32 SavedTokens = 0;
+};
+
 USTRUCT()
 struct FKnowledgeEntry
 {
@@ -63,10 +168,14 @@ struct FNpcObject
 };
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnLlamaResponseReceived, const FString&, Response);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnLlamaActionOnlyResponse);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnLlamaStreamTokenReceived, const FString&, Token, bool, bDone);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnLlamaChunkReceived, const FString&, Chunk, bool, bDone);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnLlamaActionReceived, const FString&, Action, AActor*, Object);
 
+struct FLlamaStreamTimings;
+struct FLlamaToolCall;
+
 UCLASS(ClassGroup = (NpcAI), meta = (BlueprintSpawnableComponent))
 class LOCALNPCAIPLUGIN_API ULlamaComponent : public UActorComponent
 {
@@ -78,6 +187,18 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
     int32 Port = 8080;
 
+    // llama-server instances to spread requests over, each started with the same model and ServerSlots. Every NPC
+    // sticks to one of them to keep its KV cache warm. Empty uses Port on this machine.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    TArray<FInferenceEndpoint> LlamaEndpoints;
+
+    // Sends query embeddings and reranking to a second server as well when the first one is slower than usual, and
+    // uses whichever answers first. Needs at least two servers for the backend. Chat completions are never hedged:
+    // a turn is pinned to the NPC's slot on its own server, where its prefix is cached, so a duplicate elsewhere would
+    // prefill the whole history from scratch, and greetings and barks are written ahead of time, not while anyone waits.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    bool bHedgeShortRequests = false;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
     FString SystemMessage;
 
@@ -99,12 +220,63 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
     bool bStream = false;
 
+    // Streamed tokens are queued by the network thread and delivered once per frame, merged into a single
+    // OnStreamTokenReceived call. Whatever does not fit in this budget is delivered on the next frame.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "bStream", ClampMin = "0.1"))
+    float StreamDeliveryBudgetMs = 1.0f;
+
+    // Where streamed replies are split into the chunks broadcast by OnChunkReceived (and spoken by text to speech).
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "bStream"))
+    FLlamaChunkingSettings ChunkingSettings;
+
+    // ContextAfterHistory keeps the system message and chat history byte-stable between turns so llama-server can
+    // reuse its KV cache for them; RAG results and WorldContext are sent with the latest user message instead.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    ELlamaPromptLayout PromptLayout = ELlamaPromptLayout::ContextAfterHistory;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    bool bCachePrompt = true;
+
+    // Volatile per-turn context, e.g. the current world state. Not stored in the chat history.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    FString WorldContext;
+
+    // Number of parallel slots llama-server was started with (-np). When set, each NPC is pinned to its own slot so
+    // its KV cache survives other NPCs talking in between. 0 lets the server pick any free slot.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (ClampMin = "0"))
+    int32 ServerSlots = 0;
+
+    // Saves an evicted NPC's slot to disk and restores it on its next turn. Requires llama-server --slot-save-path.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "ServerSlots > 0", EditConditionHides))
+    bool bSaveSlotState = false;
+
+    // Approximate token budget for the chat history (about 4 characters per token). When it is exceeded the oldest
+    // turns are folded into a rolling summary by a background request. 0 keeps the full history.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (ClampMin = "0"))
+    int32 HistoryTokenBudget = 0;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "HistoryTokenBudget > 0", EditConditionHides, ClampMin = "16"))
+    int32 SummaryMaxTokens = 200;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Scheduler")
+    EInferencePriority InferencePriority = EInferencePriority::Ambient;
+
     UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Llama")
     void SendChatMessage(FString Message);
 
+    // Sends the system message and chat history with n_predict 0 so llama-server evaluates them while the player is
+    // still talking or typing; the next SendChatMessage then only has to prefill the new user turn. Does nothing if
+    // the current prefix was already prefilled.
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Llama")
+    void PrefillPrompt();
+
     UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | Llama")
     FOnLlamaResponseReceived OnResponseReceived;
 
+    // Broadcast instead of OnResponseReceived when a reply only carried out actions and left nothing to say.
+    UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | Llama")
+    FOnLlamaActionOnlyResponse OnActionOnlyResponse;
+
     UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | Llama")
     FOnLlamaStreamTokenReceived OnStreamTokenReceived;
 
@@ -114,15 +286,54 @@ public:
     UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Llama")
     void ClearChatHistory();
 
+    // Said instead of an empty reply when a turn fails, e.g. while llama-server is down. One is picked at random;
+    // leave empty to get the empty reply.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    TArray<FString> FallbackResponses;
+
+    // The next reply starts with Opener, a line the NPC has already said (e.g. a pregenerated greeting), and
+    // llama-server continues it. OnResponseReceived only carries the continuation; the history keeps both.
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Llama")
+    void SetResponseOpener(FString Opener);
+
+    // Asks for Count persona lines (greetings, barks) at background priority, outside of the conversation. Sanitized
+    // lines are passed to OnGenerated on a task pool thread; the list is shorter or empty when the request fails.
+    // Sent to the NPC's own slot like the history summary; while a turn holds it the list comes back empty.
+    void GenerateLines(const FString& Instruction, int32 Count, TUniqueFunction<void(TArray<FString>)> OnGenerated);
+
+    // Stops the current turn: closes the stream so the server stops generating and drops any result still on its way.
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Llama")
+    void CancelPendingRequests();
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Llama")
+    static FLlamaConnectionPoolStats GetConnectionPoolStats();
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Llama")
+    FLlamaPromptCacheStats GetPromptCacheStats() const { return PromptCacheStats; }
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Llama")
+    static FLlamaSlotManagerStats GetSlotManagerStats();
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Llama")
+    FLlamaTtftStats GetTtftStats() const { return TtftStats; }
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG")
     ERagMode RagMode = ERagMode::Disabled;
 
-    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides))
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled || bUseResponseCache", EditConditionHides))
     int32 EmbeddingPort = 8081;
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode == ERagMode::EmbeddingPlusReranker", EditConditionHides))
     int32 RerankerPort = 8082;
 
+    // Empty uses EmbeddingPort on this machine.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled || bUseResponseCache", EditConditionHides))
+    TArray<FInferenceEndpoint> EmbeddingEndpoints;
+
+    // Empty uses RerankerPort on this machine.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode == ERagMode::EmbeddingPlusReranker", EditConditionHides))
+    TArray<FInferenceEndpoint> RerankerEndpoints;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides))
     FString KnowledgePath;
 
@@ -138,41 +349,201 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides, ClampMin = "0"))
     int32 SentenceOverlap = 1;
 
+    // Knowledge chunks sent to the embedding server per request.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides, ClampMin = "1"))
+    int32 KnowledgeBatchSize = 32;
+
+    // Knowledge batches queued at once. How many actually run in parallel is capped by the embedding concurrency.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides, ClampMin = "1"))
+    int32 KnowledgeBatchesInFlight = 4;
+
+    // Keeps the embedded knowledge in an index file, so the document is only embedded again when it, the chunking or
+    // EmbeddingModelId changed.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides))
+    bool bPersistKnowledgeIndex = true;
+
+    // Empty uses Saved/KnowledgeIndex.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled && bPersistKnowledgeIndex", EditConditionHides))
+    FString KnowledgeIndexFolder;
+
+    // Name of the model the embedding server runs, so indexes built with another model are not used. Empty asks the
+    // embedding server (GET /v1/models); when it cannot tell, the index is neither loaded nor saved.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled && bPersistKnowledgeIndex", EditConditionHides))
+    FString EmbeddingModelId;
+
+    // Answers messages that mean the same as one answered before in the same situation (persona, world context and
+    // the last ResponseCacheContextMessages messages) with the earlier reply, skipping RAG and generation. Every
+    // message is embedded on EmbeddingPort to look it up. Replies that carried out actions are never cached.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache")
+    bool bUseResponseCache = false;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "0.0", ClampMax = "1.0"))
+    float ResponseCacheSimilarity = 0.92f;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "1.0"))
+    float ResponseCacheTtlSeconds = 600.0f;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "1"))
+    int32 ResponseCacheMaxEntries = 32;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "0"))
+    int32 ResponseCacheContextMessages = 0;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Cache")
+    FNpcResponseCacheStats GetResponseCacheStats() const { return ResponseCache.GetStats(); }
+
+    // True for replies that are in the response cache, so their speech is worth keeping as well.
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Cache")
+    bool IsCachedResponse(const FString& Response) const { return ResponseCache.ContainsResponse(Response); }
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Actions")
     TArray<FNpcAction> KnownActions;
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Actions")
     TArray<FNpcObject> KnownObjects;
 
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Actions")
+    ELlamaActionOutputMode ActionOutputMode = ELlamaActionOutputMode::PromptInstructions;
+
 	UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | Actions")
 	FOnLlamaActionReceived OnActionReceived;
 
+    // Only filled in ToolCalls mode, shortly after BeginPlay.
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Actions")
+    FLlamaActionPromptStats GetActionPromptStats() const { return ActionPromptStats; }
+
 private:
     TArray<FChatMessage> ChatHistory;
-
-    void SendRequest(FString InSystemMessage);
-    void SendRequestStreaming(FString InSystemMessage);
-    FString CreateJsonRequest(FString InSystemMessage);
+    FLlamaRequestBuilder RequestBuilder;
+    void AddChatMessage(const FChatMessage& Message);
+
+    FString ConversationSummary;
+    int32 HistoryTokenEstimate = 0;
+    int32 HistoryGeneration = 0;
+    bool bSummaryInFlight = false;
+    void CompactHistoryIfNeeded();
+    void ApplyHistorySummary(const FString& Summary, bool bPostponed, int32 Generation, int32 NumToCompact, double StartTimeBenchmark);
+
+    // Blocking POST of a request outside the conversation to the NPC's own slot. Unpinned, the server would pick any
+    // idle slot and could evict another NPC's cache behind the slot manager's back, so while the NPC's slot is busy
+    // nothing is sent and bOutSlotBusy is set instead. Takes copies only, so it runs on a worker that may outlive the component.
+    static bool PostToOwnSlot(const TArray<FInferenceEndpoint>& Endpoints, const FString& NpcId, int32 NumSlots, bool bSaveState,
+        FString Body, FLlamaHttpResponse& OutResponse, bool& bOutSlotBusy);
+    static int32 EstimateTokens(const FChatMessage& Message);
+
+    FString NextResponseOpener;
+    FString TurnOpener;
+    FString PrependTurnOpener(const FString& Response) const;
+
+    std::atomic<int32> RequestGeneration{ 0 };
+    FString StreamedResponse;
+    // Workers hold the component weakly, so one that outlives it finds it gone instead of touching freed members.
+    static bool IsRequestCurrent(const TWeakObjectPtr<ULlamaComponent>& WeakThis, int32 Generation);
+    static void RunOnGameThread(const TWeakObjectPtr<ULlamaComponent>& WeakThis, int32 Generation, TUniqueFunction<void()> Task);
+
+    struct FStreamToken
+    {
+        FString Text;
+        bool bDone = false;
+        int32 Generation = 0;
+    };
+
+    // Filled by the streaming threads (a cancelled stream may still be winding down while the next one starts),
+    // drained on the game thread in TickComponent, which only runs while a stream is active or tokens are queued.
+    TQueue<FStreamToken, EQueueMode::Mpsc> StreamTokenQueue;
+    std::atomic<int32> ActiveStreams{ 0 };
+    void DeliverStreamTokens(double BudgetSeconds);
+
+    void SendRequestWithDocuments(const TArray<FString>& RagDocuments);
+    void SendRequest(FString InContext);
+    void SendRequestStreaming(FString InContext);
+    void StartRequest(const FString& InContext, int32 Generation, FInferenceJobLeaseRef JobLease);
+    void StartRequestStreaming(const FString& InContext, int32 Generation, FInferenceJobLeaseRef JobLease);
+    void StartPrefill(int32 Generation, FInferenceJobLeaseRef JobLease);
+    FString CreateJsonRequest(const FString& InContext, int32 SlotId, bool bPrefillOnly = false);
+
+    bool bHistoryPrefilled = false;
+    int32 PrefillGeneration = 0;
+    int32 ConfirmedPrefillGeneration = INDEX_NONE;
+    bool bTurnPrefilled = false;
+    double TurnStartTimeBenchmark = 0.0;
+    FLlamaTtftStats TtftStats;
+    void RecordTimeToFirstToken(double TtftMs, bool bPrefilled);
+
+    FString SlotNpcId;
+
+    FLlamaPromptCacheStats PromptCacheStats;
+    void RecordPromptTimings(const FLlamaStreamTimings& Timings);
 
     UFUNCTION()
     void HandleStreamChunk(const FString& PartialText, bool bDone);
-    FString AccumulatedChunk;
+    FNpcAiTextSanitizer Sanitizer;
+    FString SanitizedToken;
+    FLlamaSentenceSegmenter Segmenter;
+    FString SegmentedChunk;
     FCriticalSection ChunkMutex;
 
     FString SanitizeString(const FString& String);
+    void BroadcastFallbackResponse();
+
+    TArray<FInferenceEndpoint> GetLlamaEndpoints() const;
+    TArray<FInferenceEndpoint> GetEmbeddingEndpoints() const;
+    TArray<FInferenceEndpoint> GetRerankerEndpoints() const;
 
     double ChunkStartTimeBenchmark = 0.0;
 
-    TArray<FKnowledgeEntry> Knowledge;
-    TArray<float> EmbedText(const FString& Text);
-	void GenerateKnowledge();
-    float ComputeCosineSimilarity(const TArray<float>& A, const TArray<float>& B);
+    FKnowledgeMatrix Knowledge;
+    // OnEmbedded and OnReranked run on a task pool thread once the server has answered.
+    void EmbedText(const FString& Text, EInferencePriority Priority, TUniqueFunction<void(TArray<float>)> OnEmbedded);
+    // One request for all of Texts. Embeddings come back in the order of Texts, empty for any the server did not return.
+    void EmbedTexts(TArray<FString> Texts, EInferencePriority Priority, TUniqueFunction<void(TArray<TArray<float>>)> OnEmbedded);
+    // bIgnoreIndex embeds the document again even when its index file looks up to date.
+    // Called on the game thread; the build itself runs as a background embedding job.
+    void GenerateKnowledge(bool bIgnoreIndex = false);
+    static FString QueryEmbeddingModelId(const TArray<FInferenceEndpoint>& Endpoints);
+    struct FKnowledgeBuild;
+    void EmbedNextKnowledgeBatch(const TSharedRef<FKnowledgeBuild, ESPMode::ThreadSafe>& Build);
     TArray<FString> GetTopKDocuments(const TArray<float>& QueryEmbedding);
-    TArray<FString> RerankDocuments(const FString& Query, const TArray<FString>& Documents);
+    void RerankDocuments(const FString& Query, TArray<FString> Documents, EInferencePriority Priority, TUniqueFunction<void(TArray<FString>)> OnReranked);
 
 	void HandleNpcAction(const FString& ActionCommand);
-	FString BuildActionsSystemMessage();
+	FString BuildActionsSystemMessage(ELlamaActionOutputMode Mode) const;
+
+    // Built from KnownActions and KnownObjects in BeginPlay, together with the actions part of the system message.
+    FNpcActionMatcher ActionMatcher;
+    void BuildActionMatcher();
+
+    FString ActionGrammar;
+    FString BuildActionGrammar() const;
+    TArray<FString> StreamActionCommands;
+
+    FString ActionToolsJson;
+    TMap<FString, int32> ToolNameToAction;
+    void BuildActionTools();
+    void HandleToolCall(const FLlamaToolCall& ToolCall);
+    // What each tool call of the current turn came to, in call order, until the tool messages are added after the
+    // assistant message that made the calls.
+    TArray<FString> TurnToolResults;
+    void AddToolResultMessages(TConstArrayView<FLlamaToolCall> ToolCalls);
+
+    FLlamaActionPromptStats ActionPromptStats;
+
+    FNpcResponseCache ResponseCache;
+    // The lookup that missed for the current turn; its reply is stored under it once it is complete.
+    TArray<float> PendingCacheEmbedding;
+    uint32 PendingCacheStateHash = 0;
+    double PendingCacheStartMs = 0.0;
+    bool bPendingCacheStore = false;
+    bool bTurnTriggeredAction = false;
+    uint32 ComputeCacheStateHash() const;
+    bool RespondFromCache(const TArray<float>& Embedding, uint32 StateHash);
+    // Actions a streamed reply carried out are already known through bTurnTriggeredAction.
+    void StoreInResponseCache(const FString& Response, bool bHasActions);
+    void MeasureActionPromptTokens(const FString& BaseSystemMessage);
 
 protected:
 	virtual void BeginPlay() override;
+    virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+    virtual bool IsReadyForFinishDestroy() override;
+    virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
 };
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LlamaConnectionPool.generated.h"
+
+class FSocket;
+
+USTRUCT(BlueprintType)
+struct FLlamaConnectionPoolStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 IdleConnections = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 LeasedConnections = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 TotalLeases = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 ReusedLeases = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 Reconnects = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    float ReuseRate = 0.0f;
+};
+
+struct FLlamaConnection
+{
+    FSocket* Socket = nullptr;
+    FString Host;
+    int32 Port = 0;
+    bool bReused = false;
+    double LastUsedTime = 0.0;
+
+    bool IsValid() const { return Socket != nullptr; }
+};
+
+struct FLlamaHttpResponse
+{
+    int32 Code = 0;
+    FString Content;
+};
+
+// Shared per-endpoint pool of HTTP/1.1 keep-alive sockets used by every llama-server call
+// (chat, embeddings and reranking). All methods are thread safe.
+class LOCALNPCAIPLUGIN_API FLlamaConnectionPool
+{
+public:
+    static FLlamaConnectionPool& Get();
+
+    FLlamaConnection Lease(const FString& Host, int32 Port);
+    void Release(FLlamaConnection& Connection, bool bKeepAlive);
+    void NotifyReconnect();
+
+    // Blocking POST over a pooled connection. Retries once on a fresh socket if a reused one turns out to be stale.
+    // ShouldCancel is polled about every 20 ms while waiting; a cancelled request closes its socket so the server stops working on it.
+    bool Post(const FString& Host, int32 Port, const FString& Path, const FString& Body, FLlamaHttpResponse& OutResponse, double TimeoutSeconds = 60.0,
+        TFunction<bool()> ShouldCancel = nullptr);
+
+    // Blocking GET, e.g. for /v1/models. Retries a dropped keep-alive connection like Post.
+    bool Fetch(const FString& Host, int32 Port, const FString& Path, FLlamaHttpResponse& OutResponse, double TimeoutSeconds = 10.0);
+
+    static FString BuildRequestHeaders(const FString& Host, int32 Port, const FString& Path, int32 ContentLength, const TCHAR* Accept = TEXT("application/json"),
+        const TCHAR* Verb = TEXT("POST"));
+    static bool SendAll(FSocket* Socket, const uint8* Data, int32 Length);
+
+    FLlamaConnectionPoolStats GetStats() const;
+    void Shutdown();
+
+    int32 MaxIdlePerEndpoint = 16;
+    double IdleTimeoutSeconds = 4.0;
+
+private:
+    bool SendRequest(const TCHAR* Verb, const FString& Host, int32 Port, const FString& Path, const FString& Body, FLlamaHttpResponse& OutResponse,
+        double TimeoutSeconds, const TFunction<bool()>& ShouldCancel);
+    FSocket* Connect(const FString& Host, int32 Port);
+    static void DestroySocket(FSocket* Socket);
+    static bool IsIdleSocketUsable(FSocket* Socket);
+    bool ReadResponse(FSocket* Socket, FLlamaHttpResponse& OutResponse, bool& bOutKeepAlive, bool& bOutReceivedAny, double TimeoutSeconds, const TFunction<bool()>& ShouldCancel);
+
+    mutable FCriticalSection Lock;
+    TMap<FString, TArray<FLlamaConnection>> IdleConnections;
+
+    int32 LeasedCount = 0;
+    int32 TotalLeases = 0;
+    int32 ReusedLeases = 0;
+    int32 Reconnects = 0;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/StringView.h"
+
+struct FLlamaStreamTimings
+{
+    int32 CachedTokens = 0;
+    int32 PromptTokens = 0;
+    double PromptMs = 0.0;
+    int32 PredictedTokens = 0;
+    double PredictedMs = 0.0;
+};
+
+struct FLlamaStreamDelta
+{
+    // Views point either into the payload or into ContentBuffer and are only valid until the next Extract call.
+    FUtf8StringView Content;
+    bool bHasContent = false;
+
+    FUtf8StringView FinishReason;
+    bool bHasFinishReason = false;
+
+    FLlamaStreamTimings Timings;
+    bool bHasTimings = false;
+
+    TArray<UTF8CHAR> ContentBuffer;
+
+    void Reset();
+    FString GetContent() const;
+    FString GetFinishReason() const;
+};
+
+// Pull-style extractor for streamed chat completion chunks. Walks the payload bytes once and only materializes
+// choices[0].delta.content, choices[0].finish_reason and timings. Unescaped content is returned as a view into the
+// payload, so the common case does not allocate.
+class LOCALNPCAIPLUGIN_API FLlamaDeltaExtractor
+{
+public:
+    // Returns false when the payload has a shape the fast path does not handle, such as tool call deltas; callers should
+    // fall back to the JSON DOM.
+    static bool Extract(FUtf8StringView Payload, FLlamaStreamDelta& OutDelta);
+};
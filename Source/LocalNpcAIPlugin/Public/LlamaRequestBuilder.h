@@ -0,0 +1,27 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Append-only, already serialized chat messages. Every message is escaped once when it is added and kept as condensed
+// JSON, so building a request body is a matter of splicing the buffer in instead of re-serializing the whole history.
+class LOCALNPCAIPLUGIN_API FLlamaRequestBuilder
+{
+public:
+    // ToolCalls is an already serialized tool_calls array, or empty. ToolCallId is only set on tool messages.
+    void AppendMessage(const FString& Role, const FString& Content, FStringView ToolCalls = FStringView(), FStringView ToolCallId = FStringView());
+    void RemoveFirst(int32 Count);
+    void Reset();
+
+    int32 Num() const { return MessageOffsets.Num(); }
+    int32 GetSerializedLength() const { return SerializedMessages.Len(); }
+
+    // Appends the first Count messages as a comma separated list of message objects.
+    void AppendMessages(FString& Out, int32 Count) const;
+
+    static void AppendMessageObject(FString& Out, FStringView Role, FStringView Content, FStringView ToolCalls = FStringView(), FStringView ToolCallId = FStringView());
+    static void AppendJsonString(FString& Out, FStringView Value);
+
+private:
+    FString SerializedMessages;
+    TArray<int32> MessageOffsets;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LlamaSentenceSegmenter.generated.h"
+
+// Projects can add their own abbreviations (periods that must not end a chunk) by defining this in their Build.cs,
+// e.g. PublicDefinitions.Add("LOCALNPCAI_EXTRA_ABBREVIATIONS=TEXTVIEW(\"Prof.\"),TEXTVIEW(\"Capt.\"),");
+#ifndef LOCALNPCAI_EXTRA_ABBREVIATIONS
+#define LOCALNPCAI_EXTRA_ABBREVIATIONS
+#endif
+
+USTRUCT(BlueprintType)
+struct FLlamaChunkingSettings
+{
+    GENERATED_BODY()
+
+    // Chunks shorter than this keep growing until the next split point.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (ClampMin = "1"))
+    int32 MinCharacters = 1;
+
+    // Also split after commas, colons, closing parentheses and dashes, not only at the end of a sentence.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    bool bSplitOnClauses = false;
+
+    // Lets the first chunk of a response end at a clause boundary once it has FirstChunkMinCharacters, so text to
+    // speech can start before the first sentence is complete.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    bool bAggressiveFirstChunk = false;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "bAggressiveFirstChunk", ClampMin = "1"))
+    int32 FirstChunkMinCharacters = 12;
+};
+
+// Splits streamed text into speakable chunks. Each character is classified once when it is appended, so a whole
+// response costs O(n) no matter how many tokens it arrives in. A chunk always ends at the last split point seen so far.
+class LOCALNPCAIPLUGIN_API FLlamaSentenceSegmenter
+{
+public:
+    // Returns true and fills OutChunk when the text so far contains a chunk that is ready to be spoken.
+    bool Append(FStringView Text, const FLlamaChunkingSettings& Settings, FString& OutChunk);
+
+    // Appends the last bit of text, returns everything not handed out yet and starts over with a new response.
+    FString Flush(FStringView Text = FStringView());
+    void Reset();
+
+    static bool IsAbbreviation(FStringView Text, int32 PeriodIndex);
+
+private:
+    FString Pending;
+    int32 ScanPos = 0;
+    int32 LastSentenceEnd = INDEX_NONE;
+    int32 LastClauseEnd = INDEX_NONE;
+    bool bFirstChunk = true;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "LlamaSlotManager.generated.h"
+
+USTRUCT(BlueprintType)
+struct FLlamaSlotManagerStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 PinnedNpcs = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 Acquisitions = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 AffinityHits = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 Evictions = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 Saves = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 Restores = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Llama")
+    int32 Unpinned = 0;
+};
+
+struct FLlamaSlotLease
+{
+    FString Host;
+    int32 Port = 0;
+    FString NpcId;
+    int32 SlotId = -1;
+
+    // Filled in by AcquireSlot when the slot changes hands, consumed by PrepareSlot on a worker thread.
+    FString EvictedNpcId;
+    FString SaveFileName;
+    FString RestoreFileName;
+    bool bSaveState = false;
+
+    bool IsValid() const { return SlotId >= 0; }
+};
+
+// Pins NPC conversations to llama-server slots so each NPC keeps hitting its own KV cache. When there are more NPCs
+// than slots the least recently used idle slot is handed over; with bSaveState its KV cache is written out through
+// /slots/{id}?action=save and restored when that NPC comes back, which needs llama-server started with --slot-save-path.
+// All methods are thread safe.
+class LOCALNPCAIPLUGIN_API FLlamaSlotManager
+{
+public:
+    static FLlamaSlotManager& Get();
+
+    // Cheap bookkeeping only, safe to call on the game thread. Returns an invalid lease when every slot is busy.
+    FLlamaSlotLease AcquireSlot(const FString& Host, int32 Port, const FString& NpcId, int32 NumSlots, bool bSaveState);
+
+    // Performs the blocking save/restore requests the lease needs. Must run before the chat request is sent.
+    void PrepareSlot(const FLlamaSlotLease& Lease);
+
+    void ReleaseSlot(const FLlamaSlotLease& Lease);
+
+    // Drops an NPC's pin, e.g. when its component is destroyed.
+    void Forget(const FString& Host, int32 Port, const FString& NpcId);
+
+    FLlamaSlotManagerStats GetStats() const;
+
+private:
+    struct FSlot
+    {
+        FString OwnerNpcId;
+        double LastUsedTime = 0.0;
+        bool bBusy = false;
+    };
+
+    struct FEndpoint
+    {
+        TArray<FSlot> Slots;
+        TSet<FString> SavedNpcs;
+    };
+
+    static FString GetSaveFileName(const FString& NpcId);
+
+    mutable FCriticalSection Lock;
+    TMap<FString, FEndpoint> Endpoints;
+
+    int32 Acquisitions = 0;
+    int32 AffinityHits = 0;
+    int32 Evictions = 0;
+    int32 Saves = 0;
+    int32 Restores = 0;
+    int32 Unpinned = 0;
+};
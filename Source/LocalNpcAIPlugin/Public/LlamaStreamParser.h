@@ -0,0 +1,82 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/StringView.h"
+
+struct FLlamaSseEvent
+{
+    FUtf8StringView Data;
+    bool bIsError = false;
+
+    FString ToString() const
+    {
+        auto Converted = StringCast<TCHAR>(Data.GetData(), Data.Len());
+        return FString(Converted.Length(), Converted.Get());
+    }
+};
+
+// Incremental HTTP/1.1 response parser for llama-server event streams. Works on raw bytes as they come off the
+// socket: decodes chunked transfer framing, keeps partial lines across reads and hands out complete SSE events.
+// Buffers are reused between events, so steady-state parsing does not allocate. With bCollectBody the decoded body
+// is kept as-is instead of being split into events, which is what plain JSON responses need.
+class LOCALNPCAIPLUGIN_API FLlamaStreamParser
+{
+public:
+    explicit FLlamaStreamParser(bool bInCollectBody = false);
+
+    void Reset();
+
+    // Returns false once the stream is malformed. OnEvent views are only valid for the duration of the call.
+    bool Feed(const uint8* Data, int32 Length, TFunctionRef<void(const FLlamaSseEvent&)> OnEvent);
+
+    // Called when the peer closes the socket. Completes identity-encoded bodies that have no Content-Length.
+    void NotifyConnectionClosed(TFunctionRef<void(const FLlamaSseEvent&)> OnEvent);
+
+    bool IsHeaderComplete() const { return State != EState::StatusLine && State != EState::Headers; }
+    bool IsMessageComplete() const { return State == EState::Complete; }
+    bool HasError() const { return State == EState::Error; }
+    bool IsKeepAlive() const { return IsMessageComplete() && !bConnectionClose; }
+    int32 GetStatusCode() const { return StatusCode; }
+    const TArray<uint8>& GetBody() const { return Body; }
+
+private:
+    enum class EState : uint8
+    {
+        StatusLine,
+        Headers,
+        ChunkSize,
+        ChunkData,
+        ChunkDataEnd,
+        Trailers,
+        IdentityBody,
+        Complete,
+        Error
+    };
+
+    void ProcessHeaderLine(const uint8* Line, int32 Length);
+    void ProcessBody(const uint8* Data, int32 Length, TFunctionRef<void(const FLlamaSseEvent&)> OnEvent);
+    bool ProcessSseLine();
+    void FlushPendingEvent(TFunctionRef<void(const FLlamaSseEvent&)> OnEvent);
+    void DispatchEvent(TFunctionRef<void(const FLlamaSseEvent&)> OnEvent);
+    void BeginBody();
+
+    EState State = EState::StatusLine;
+    int32 StatusCode = 0;
+    int64 ContentLength = -1;
+    int64 RemainingBytes = 0;
+    bool bChunked = false;
+    bool bConnectionClose = false;
+
+    TArray<uint8> LineBuffer;
+    TArray<uint8> SseLineBuffer;
+    TArray<uint8> EventData;
+    TArray<uint8> Body;
+    bool bCollectBody = false;
+    bool bEventHasData = false;
+    bool bEventIsError = false;
+
+    static constexpr int32 MaxHeaderLineLength = 16 * 1024;
+    // Same cap for SSE lines and events, so a peer that never ends a line cannot grow the buffers without bound.
+    static constexpr int32 MaxSseLineLength = MaxHeaderLineLength;
+    static constexpr int32 MaxErrorBodyLength = 4 * 1024;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FJsonObject;
+class FJsonValue;
+
+struct FLlamaToolCall
+{
+    // Empty when the server did not send one.
+    FString Id;
+    FString Name;
+    // JSON object as a string, exactly as the model produced it.
+    FString Arguments;
+};
+
+// Reassembles tool calls from streamed tool_calls deltas: the first delta of a call carries its name, the arguments
+// follow in pieces. A call is complete once a delta for a later call arrives or the stream ends.
+class LOCALNPCAIPLUGIN_API FLlamaToolCallAccumulator
+{
+public:
+    // ToolCalls is the delta's tool_calls array.
+    void AddDeltas(const TArray<TSharedPtr<FJsonValue>>& ToolCalls);
+
+    // Moves the calls that cannot change anymore to OutCalls. With bFinished, that is all of them.
+    void PopCompleted(TArray<FLlamaToolCall>& OutCalls, bool bFinished = false);
+
+    int32 Num() const { return Calls.Num(); }
+    void Reset();
+
+    // Reads message.tool_calls of a non-streamed response.
+    static void ParseMessage(const FJsonObject& Message, TArray<FLlamaToolCall>& OutCalls);
+
+    // Appends Calls as the tool_calls array of an assistant message, so they can go back into the chat history.
+    static void AppendJson(FString& Out, TConstArrayView<FLlamaToolCall> Calls);
+
+private:
+    TArray<FLlamaToolCall> Calls;
+    int32 NumPopped = 0;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Resolves action tag commands like "move to door" against the NPC's known actions and objects without scanning
+// them. Action names live in a case-folded trie, so the longest name the command starts with is found in one walk
+// over the command; object names are looked up in a hash map (FString keys hash and compare case-insensitively).
+class LOCALNPCAIPLUGIN_API FNpcActionMatcher
+{
+public:
+    void Reset();
+
+    // The first of several entries with the same name wins, like the linear scans this replaces.
+    void AddAction(const FString& Name, int32 Index);
+    void AddObject(const FString& Name, int32 Index);
+
+    // Index of the longest action name Command starts with (ignoring case), or INDEX_NONE.
+    int32 MatchAction(FStringView Command, int32& OutNameLength) const;
+    int32 FindObject(const FString& Name) const;
+
+private:
+    struct FTrieNode
+    {
+        TMap<TCHAR, int32> Children;
+        int32 Action = INDEX_NONE;
+    };
+
+    TArray<FTrieNode> Nodes;
+    TMap<FString, int32> Objects;
+};
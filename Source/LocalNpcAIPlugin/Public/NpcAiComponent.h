@@ -23,6 +23,10 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Whisper")
     int32 WhisperPort = 8000;
 
+    // Servers to spread requests over instead of the port on this machine, one list per backend.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Whisper")
+    TArray<FInferenceEndpoint> WhisperEndpoints;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | VAD")
     EVadMode VadMode = EVadMode::Disabled;
 
@@ -38,9 +42,19 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | VAD", meta = (EditCondition = "VadMode == EVadMode::WebRTC", EditConditionHides, ClampMin = "0", ClampMax = "3"))
     int32 WebRtcVadAggressiveness = 3;
 
+    // Lets the player interrupt the NPC: as soon as VAD hears speech the current response and its audio are cancelled.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | VAD", meta = (EditCondition = "VadMode != EVadMode::Disabled", EditConditionHides))
+    bool bAllowBargeIn = true;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
     int32 LlamaPort = 8080;
 
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    TArray<FInferenceEndpoint> LlamaEndpoints;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    bool bHedgeShortRequests = false;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
     FString SystemMessage;
 
@@ -62,15 +76,54 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
     bool bStream = false;
 
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "bStream", ClampMin = "0.1"))
+    float StreamDeliveryBudgetMs = 1.0f;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "bStream"))
+    FLlamaChunkingSettings ChunkingSettings;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    ELlamaPromptLayout PromptLayout = ELlamaPromptLayout::ContextAfterHistory;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    bool bCachePrompt = true;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (ClampMin = "0"))
+    int32 ServerSlots = 0;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "ServerSlots > 0", EditConditionHides))
+    bool bSaveSlotState = false;
+
+    // Said instead of an empty reply when a turn fails, e.g. while llama-server is down.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    TArray<FString> FallbackResponses;
+
+    // Prefills the system message and history on llama-server as soon as the player starts talking or focuses the
+    // chat box, so only the new user turn is left to evaluate once it arrives.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama")
+    bool bSpeculativePrefill = false;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (ClampMin = "0"))
+    int32 HistoryTokenBudget = 0;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Llama", meta = (EditCondition = "HistoryTokenBudget > 0", EditConditionHides, ClampMin = "16"))
+    int32 SummaryMaxTokens = 200;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG")
     ERagMode RagMode = ERagMode::Disabled;
 
-    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides))
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled || bUseResponseCache", EditConditionHides))
     int32 EmbeddingPort = 8081;
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode == ERagMode::EmbeddingPlusReranker", EditConditionHides))
     int32 RerankerPort = 8082;
 
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled || bUseResponseCache", EditConditionHides))
+    TArray<FInferenceEndpoint> EmbeddingEndpoints;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode == ERagMode::EmbeddingPlusReranker", EditConditionHides))
+    TArray<FInferenceEndpoint> RerankerEndpoints;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides))
     FString KnowledgePath;
 
@@ -86,18 +139,55 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides, ClampMin = "0"))
     int32 SentenceOverlap = 1;
 
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides, ClampMin = "1"))
+    int32 KnowledgeBatchSize = 32;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides, ClampMin = "1"))
+    int32 KnowledgeBatchesInFlight = 4;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled", EditConditionHides))
+    bool bPersistKnowledgeIndex = true;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled && bPersistKnowledgeIndex", EditConditionHides))
+    FString KnowledgeIndexFolder;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | RAG", meta = (EditCondition = "RagMode != ERagMode::Disabled && bPersistKnowledgeIndex", EditConditionHides))
+    FString EmbeddingModelId;
+
+    // Repeated player messages ("hello", "bye") are answered with the earlier reply and its already synthesized audio.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache")
+    bool bUseResponseCache = false;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "0.0", ClampMax = "1.0"))
+    float ResponseCacheSimilarity = 0.92f;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "1.0"))
+    float ResponseCacheTtlSeconds = 600.0f;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "1"))
+    int32 ResponseCacheMaxEntries = 32;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Cache", meta = (EditCondition = "bUseResponseCache", EditConditionHides, ClampMin = "0"))
+    int32 ResponseCacheContextMessages = 0;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Actions")
     TArray<FNpcAction> KnownActions;
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Actions")
     TArray<FNpcObject> KnownObjects;
 
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Actions")
+    ELlamaActionOutputMode ActionOutputMode = ELlamaActionOutputMode::PromptInstructions;
+
     UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | Actions")
     FOnLlamaActionReceived OnActionReceived;
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
     int32 KokoroPort = 8880;
 
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
+    TArray<FInferenceEndpoint> KokoroEndpoints;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
     FString Voice;
 
@@ -106,6 +196,19 @@ public:
 
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAINpc | Kokoro")
     double Volume = 1.0;
+
+    // Greetings written for this persona and synthesized at background priority after BeginPlay. The player's first
+    // message is answered at once with one of them, and the generated reply continues after it.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Greetings", meta = (ClampMin = "0"))
+    int32 GreetingPoolSize = 0;
+
+    // Idle lines for PlayIdleBark, prepared the same way.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Greetings", meta = (ClampMin = "0"))
+    int32 BarkPoolSize = 0;
+
+    // Scheduling class for this NPC's requests. UPlayerAiComponent raises it while the player is nearby or talking to it.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Scheduler")
+    EInferencePriority InferencePriority = EInferencePriority::Ambient;
     
 	UFUNCTION(BlueprintCallable, Category = "LocalAiNpc")
 	void StartWhisperRecording();
@@ -116,6 +219,30 @@ public:
     UFUNCTION(BlueprintCallable, Category = "LocalAiNpc")
     void SendText(FString Input);
 
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc")
+    void SetWorldContext(FString Context);
+
+    // Called when the player starts typing to this NPC. Kicks off the speculative prefill when it is enabled.
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc")
+    void NotifyPlayerStartedInput();
+
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc")
+    void SetInferencePriority(EInferencePriority Priority);
+
+    // Aborts everything belonging to the current turn: pending transcription, the Llama request and queued speech.
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc")
+    void CancelCurrentTurn();
+
+    // Says one of the prepared barks unless the NPC is busy talking. Returns false when none was ready.
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc")
+    bool PlayIdleBark();
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Cache")
+    FNpcResponseCacheStats GetResponseCacheStats() const;
+
+    UFUNCTION(BlueprintPure, Category = "LocalAiNpc | Cache")
+    FKokoroAudioCacheStats GetAudioCacheStats() const;
+
     UPROPERTY()
     bool bIsUsersConversationTurn = true;
 
@@ -129,9 +256,13 @@ private:
 
     UFUNCTION()
 	void HandleWhisperTranscriptionComplete(const FString& Transcription);
+    UFUNCTION()
+    void HandleWhisperSpeechStarted();
 	UFUNCTION()
 	void HandleLlamaResponseReceived(const FString& Response);
     UFUNCTION()
+    void HandleLlamaActionOnlyResponse();
+    UFUNCTION()
     void HandleLlamaChunkReceived(const FString& Chunk, bool bDone);
     UFUNCTION()
     void HandleLlamaActionReceived(const FString& Action, AActor* Object);
@@ -142,8 +273,19 @@ private:
 
 	bool bIsFirstChunk = true;
 
+    bool bIsNpcResponding = false;
+    void StopNpcResponse();
+
+    TArray<FString> Greetings;
+    TArray<FString> Barks;
+    bool bHasGreeted = false;
+    void PregenerateLines();
+    void GreetInstantly();
+    FString PickPreparedLine(const TArray<FString>& Lines) const;
+
     UPlayerAiComponent* PlayerAiComponent;
 
 protected:
     virtual void BeginPlay() override;
+    virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 };
\ No newline at end of file
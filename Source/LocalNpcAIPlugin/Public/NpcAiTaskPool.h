@@ -0,0 +1,80 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+#include "NpcAiTaskPool.generated.h"
+
+class FQueuedThreadPool;
+
+USTRUCT(BlueprintType)
+struct FNpcAiTaskPoolStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 NumThreads = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Queued = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Active = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 PeakActive = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    int32 Executed = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    float AverageQueueLatencyMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Scheduler")
+    float MaxQueueLatencyMs = 0.0f;
+};
+
+// Shared worker threads for everything the plugin does off the game thread: chat requests, streamed replies,
+// RAG queries and knowledge builds. Replaces spawning an OS thread per request. Thread safe.
+class LOCALNPCAIPLUGIN_API FNpcAiTaskPool
+{
+public:
+    static FNpcAiTaskPool& Get();
+
+    // Creates the threads. Only the first call has an effect; Launch calls it with the default size if nobody did.
+    void Initialize(int32 NumThreads = 0);
+    // Adds threads until there are at least MinThreads. The scheduler calls it whenever a concurrency cap is raised,
+    // so a job that got a slot from its backend never waits behind another backend's work for a thread.
+    void EnsureThreads(int32 MinThreads);
+    void Shutdown();
+
+    void Launch(TUniqueFunction<void()> Task);
+
+    FNpcAiTaskPoolStats GetStats() const;
+
+private:
+    class FTaskWork;
+
+    // A queued thread pool cannot grow, so growing adds another one. NumTasks counts the tasks given to it that have
+    // not finished yet, which tells whether it has an idle thread.
+    struct FSegment
+    {
+        FQueuedThreadPool* Pool = nullptr;
+        int32 NumThreads = 0;
+        int32 NumTasks = 0;
+    };
+
+    bool AddSegment(int32 InNumThreads);
+    void OnTaskStarted(double QueueLatencyMs);
+    void OnTaskFinished(int32 SegmentIndex);
+
+    mutable FCriticalSection Lock;
+    TArray<FSegment> Segments;
+    int32 NumThreads = 0;
+
+    int32 Queued = 0;
+    int32 Active = 0;
+    int32 PeakActive = 0;
+    int32 Executed = 0;
+    double TotalQueueLatencyMs = 0.0;
+    double MaxQueueLatencyMs = 0.0;
+};
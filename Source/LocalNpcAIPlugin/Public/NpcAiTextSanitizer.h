@@ -0,0 +1,43 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Strips [[action: ...]], [...] and *...* spans (stage directions, action tags, whisper.cpp markers like [BLANK_AUDIO])
+// from text before it is shown or spoken. Works in a single pass and can be fed streamed text piece by piece: text
+// inside a span that is still open is held back until the span closes, so a span split across tokens never leaks.
+// A span that stays open for more than 200 characters is taken for a stray opener, which is then written out as is.
+class LOCALNPCAIPLUGIN_API FNpcAiTextSanitizer
+{
+public:
+    // Appends the filtered part of Text to Out. The command of every [[action: ...]] tag that closes in Text is added
+    // to OutActionCommands, so actions can be carried out while the rest of the reply is still streaming in.
+    void Append(FStringView Text, FString& Out, TArray<FString>* OutActionCommands = nullptr);
+
+    // End of the text. A span that never closed was not a span after all, so its opener is written out as is and
+    // the text after it is filtered again.
+    void Flush(FString& Out);
+    void Reset();
+
+    // Filters a complete string and trims it.
+    static FString Sanitize(FStringView Text, TArray<FString>* OutActionCommands = nullptr);
+
+private:
+    enum class EBracket : uint8
+    {
+        None,
+        Single,
+        Double
+    };
+
+    void Process(TCHAR Char, FString& Out, TArray<FString>* OutActionCommands);
+    void CloseBracket(TArray<FString>* OutActionCommands);
+    void ReleaseHeld(FString& Out);
+
+    EBracket Bracket = EBracket::None;
+    int32 BracketStart = 0;
+    bool bBracketJustOpened = false;
+    bool bSawClosingBracket = false;
+    bool bInAsterisk = false;
+    bool bSingleBracketsOnly = false;
+    FString Held;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "NpcResponseCache.generated.h"
+
+USTRUCT(BlueprintType)
+struct FNpcResponseCacheStats
+{
+    GENERATED_BODY()
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Cache")
+    int32 Lookups = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Cache")
+    int32 Hits = 0;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Cache")
+    float HitRate = 0.0f;
+
+    // Sum of the generation times of the replies that were served from the cache instead.
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Cache")
+    float SavedMs = 0.0f;
+
+    UPROPERTY(BlueprintReadOnly, Category = "LocalAiNpc | Cache")
+    int32 Entries = 0;
+};
+
+// Replies to things the player keeps saying ("hello", "who are you", "bye"). An entry is keyed by the embedding of
+// the player's message and a hash of the conversation state, so a reply is only reused for a message that means
+// the same thing in the same situation. Small enough that a linear scan beats any index.
+class LOCALNPCAIPLUGIN_API FNpcResponseCache
+{
+public:
+    // Finds the closest entry with the same state hash whose cosine similarity is at least MinSimilarity.
+    bool Find(const TArray<float>& Embedding, uint32 StateHash, float MinSimilarity, double Now, FString& OutResponse);
+
+    // Replaces the least recently used entry once MaxEntries is reached.
+    void Add(TArray<float> Embedding, uint32 StateHash, const FString& Response, double GenerationMs, double Now, double TtlSeconds, int32 MaxEntries);
+
+    bool ContainsResponse(const FString& Response) const;
+    void Reset();
+
+    const FNpcResponseCacheStats& GetStats() const { return Stats; }
+
+private:
+    struct FEntry
+    {
+        // Normalized, so the similarity is a plain dot product.
+        TArray<float> Embedding;
+        uint32 StateHash = 0;
+        FString Response;
+        double GenerationMs = 0.0;
+        double ExpiresAt = 0.0;
+        double LastUsed = 0.0;
+    };
+
+    static void Normalize(TArray<float>& Embedding);
+
+    TArray<FEntry> Entries;
+    FNpcResponseCacheStats Stats;
+};
@@ -63,6 +63,10 @@ private:
 	UNpcAiComponent* CurrentTypingNpc;
 	bool bIsTyping = false;
 
+    UPROPERTY()
+    UNpcAiComponent* FocusedNpc = nullptr;
+    void SetFocusedNpc(UNpcAiComponent* Npc);
+
     void SetupInput();
     void OnPushToTalkStarted(const FInputActionValue& Value);
     void OnPushToTalkReleased(const FInputActionValue& Value);
@@ -3,12 +3,17 @@
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
 #include "AudioCaptureCore.h"
+#include "Interfaces/IHttpRequest.h"
+#include "InferenceScheduler.h"
+#include "InferenceEndpointRouter.h"
+#include <atomic>
 extern "C" {
     #include "fvad.h"
 }
 #include "WhisperComponent.generated.h"
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnWhisperTranscriptionComplete, const FString&, Transcription);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnWhisperSpeechStarted);
 
 UENUM(BlueprintType)
 enum class EVadMode : uint8
@@ -29,6 +34,13 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Whisper")
     int32 Port = 8000;
 
+    // whisper-server instances to spread transcriptions over. Empty uses Port on this machine.
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Whisper")
+    TArray<FInferenceEndpoint> WhisperEndpoints;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | Scheduler")
+    EInferencePriority InferencePriority = EInferencePriority::Ambient;
+
     UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Whisper")
 	void StartRecording();
 
@@ -41,6 +53,14 @@ public:
     UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | Whisper")
     FOnWhisperTranscriptionComplete OnTranscriptionComplete;
 
+    // Cancels transcriptions that are still in flight; their results are never broadcast.
+    UFUNCTION(BlueprintCallable, Category = "LocalAiNpc | Whisper")
+    void CancelTranscription();
+
+    // Fired once per utterance as soon as VAD has heard MinSpeechDuration seconds of it, long before the transcription.
+    UPROPERTY(BlueprintAssignable, Category = "LocalAiNpc | VAD")
+    FOnWhisperSpeechStarted OnSpeechStarted;
+
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LocalAiNpc | VAD")
     EVadMode VadMode = EVadMode::Disabled;
 
@@ -68,6 +88,8 @@ private:
     
     void SaveWavFile(const TArray<float>& InAudioData, FString OutputPath) const;
 
+    void SendTranscriptionRequest(const FString& AudioPath, int32 Generation, FInferenceJobLeaseRef JobLease);
+    TArray<FInferenceEndpoint> GetWhisperEndpoints() const;
     TArray<uint8> CreateMultiPartRequest(FString FilePath);
     FString CurrentBoundary;
 
@@ -80,6 +102,11 @@ private:
     Audio::VectorOps::FAlignedFloatBuffer ResampledBuffer;
 	const int32 WebRtcVadSampleRate = 16000;
 	int32 SilenceSamplesCount = 0;
+    bool bSpeechStartedBroadcast = false;
+
+    TArray<FHttpRequestPtr> PendingRequests;
+    FCriticalSection PendingRequestsLock;
+    std::atomic<int32> RequestGeneration{0};
 
 protected:
     virtual void BeginPlay() override;